@@ -0,0 +1,131 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "leveldb/cache.h"
+#include "leveldb/env.h"
+#include "util/coding.h"
+#include "util/random.h"
+
+// Multi-threaded benchmark of the Cache implementations.  Every thread
+// looks up random keys, inserting the ones it misses, the way readers
+// use the block cache.
+//
+// Flags:
+//   --cache=lru|slru|clock    which Cache implementation to use; slru is
+//                             NewScanResistantLRUCache()
+//   --threads=N               number of concurrent threads
+//   --ops=N                   operations per thread
+//   --cache_size=N            cache capacity in bytes
+//   --charge=N                charge of each entry
+//   --keys=N                  number of distinct keys
+//   --lookup_percent=N        percentage of operations that only look up;
+//                             the rest are inserts
+static const char* FLAGS_cache = "lru";
+static int FLAGS_threads = 4;
+static int FLAGS_ops = 1000000;
+static int FLAGS_cache_size = 8 << 20;
+static int FLAGS_charge = 4096;
+static int FLAGS_keys = 1024;
+static int FLAGS_lookup_percent = 95;
+
+namespace leveldb {
+
+namespace {
+
+void DeleteValue(const Slice& key, void* value) {}
+
+void ThreadBody(Cache* cache, int tid, int* hits) {
+  Random rnd(1000 + tid);
+  char key[8];
+  int found = 0;
+  for (int i = 0; i < FLAGS_ops; i++) {
+    EncodeFixed64(key, rnd.Uniform(FLAGS_keys));
+    Slice k(key, sizeof(key));
+    if (static_cast<int>(rnd.Uniform(100)) < FLAGS_lookup_percent) {
+      Cache::Handle* h = cache->Lookup(k);
+      if (h != nullptr) {
+        found++;
+        cache->Release(h);
+        continue;
+      }
+    }
+    cache->Release(cache->Insert(k, nullptr, FLAGS_charge, &DeleteValue));
+  }
+  *hits = found;
+}
+
+void Run() {
+  Cache* cache;
+  if (std::strcmp(FLAGS_cache, "clock") == 0) {
+    cache = NewClockCache(FLAGS_cache_size, FLAGS_charge);
+  } else if (std::strcmp(FLAGS_cache, "lru") == 0) {
+    cache = NewLRUCache(FLAGS_cache_size);
+  } else if (std::strcmp(FLAGS_cache, "slru") == 0) {
+    cache = NewScanResistantLRUCache(FLAGS_cache_size);
+  } else {
+    std::fprintf(stderr, "unknown cache '%s'\n", FLAGS_cache);
+    std::exit(1);
+  }
+
+  std::vector<int> hits(FLAGS_threads);
+  std::vector<std::thread> threads;
+  const uint64_t start = Env::Default()->NowMicros();
+  for (int t = 0; t < FLAGS_threads; t++) {
+    threads.emplace_back(ThreadBody, cache, t, &hits[t]);
+  }
+  for (int t = 0; t < FLAGS_threads; t++) {
+    threads[t].join();
+  }
+  const uint64_t elapsed = Env::Default()->NowMicros() - start;
+
+  int64_t total_hits = 0;
+  for (int t = 0; t < FLAGS_threads; t++) {
+    total_hits += hits[t];
+  }
+  const int64_t total_ops = static_cast<int64_t>(FLAGS_ops) * FLAGS_threads;
+  std::fprintf(stdout,
+               "%-6s: %d threads, %11.3f micros/op; %.1f Mops/s; "
+               "%.1f%% hits\n",
+               FLAGS_cache, FLAGS_threads,
+               elapsed * 1e0 * FLAGS_threads / total_ops,
+               total_ops / (elapsed * 1e0), 100.0 * total_hits / total_ops);
+  delete cache;
+}
+
+}  // namespace
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int n;
+    char junk;
+    if (std::strncmp(argv[i], "--cache=", 8) == 0) {
+      FLAGS_cache = argv[i] + 8;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--ops=%d%c", &n, &junk) == 1) {
+      FLAGS_ops = n;
+    } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--charge=%d%c", &n, &junk) == 1) {
+      FLAGS_charge = n;
+    } else if (sscanf(argv[i], "--keys=%d%c", &n, &junk) == 1) {
+      FLAGS_keys = n;
+    } else if (sscanf(argv[i], "--lookup_percent=%d%c", &n, &junk) == 1) {
+      FLAGS_lookup_percent = n;
+    } else {
+      std::fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      std::exit(1);
+    }
+  }
+  leveldb::Run();
+  return 0;
+}
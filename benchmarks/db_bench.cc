@@ -11,6 +11,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/persistent_cache.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
 #include "util/crc32c.h"
@@ -18,6 +19,7 @@
 #include "util/mutexlock.h"
 #include "util/random.h"
 #include "util/testutil.h"
+#include "util/xxh3.h"
 
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
@@ -29,6 +31,8 @@
 //      deleteseq     -- delete N keys in sequential order
 //      deleterandom  -- delete N keys in random order
 //      readseq       -- read N times sequentially
+//      readseq_parallel -- read sequentially, splitting the DB into one
+//                          subrange per thread (see --threads)
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
 //      readmissing   -- read N missing keys in random order
@@ -36,6 +40,7 @@
 //      seekrandom    -- N random seeks
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
+//      xxh3          -- repeated xxh3 of 4K of data
 //   Meta operations:
 //      compact     -- Compact the entire DB
 //      stats       -- Print DB stats
@@ -57,7 +62,11 @@ static const char* FLAGS_benchmarks =
     "fill100K,"
     "crc32c,"
     "snappycomp,"
-    "snappyuncomp,";
+    "snappyuncomp,"
+    "zstdcomp,"
+    "zstduncomp,"
+    "lz4comp,"
+    "lz4uncomp,";
 
 // Number of key/values to place in database
 static int FLAGS_num = 1000000;
@@ -94,9 +103,41 @@ static int FLAGS_block_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// If true, use a CLOCK cache (NewClockCache) instead of an LRU cache for
+// the --cache_size block cache.
+static bool FLAGS_clock_cache = false;
+
+// If true, use a scan-resistant LRU cache (NewScanResistantLRUCache) for
+// the --cache_size block cache.
+static bool FLAGS_scan_resistant_cache = false;
+
+// Number of bytes to use as a cache of compressed data.
+// Negative means no compressed block cache.
+static int FLAGS_compressed_cache_size = -1;
+
+// Number of bytes to use as a cache of point lookup results.
+// Negative means no row cache.
+static int FLAGS_row_cache_size = -1;
+
+// Directory and size in bytes of a persistent block cache.  No persistent
+// cache is used unless a directory is given.
+static const char* FLAGS_persistent_cache_dir = nullptr;
+static int FLAGS_persistent_cache_size = 256 << 20;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
+// Maximum number of compactions to run at the same time.
+static int FLAGS_max_background_compactions = 1;
+
+// Maximum number of threads to split each compaction across.
+static int FLAGS_max_subcompactions = 1;
+
+// Maximum number of files to memory-map at the same time (use the Env's
+// default if not given).  Negative means no limit.
+static bool FLAGS_set_mmap_files = false;
+static int FLAGS_mmap_files = 0;
+
 // Bloom filter bits per key.
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
@@ -109,6 +150,32 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// If true, compactions bypass the page cache with O_DIRECT.
+static bool FLAGS_use_direct_io_for_compaction = false;
+
+// If true, all table reads bypass the page cache with O_DIRECT.
+static bool FLAGS_use_direct_reads = false;
+
+// Compression algorithm for table blocks: "none", "snappy", "zstd", "lz4"
+// or "lz4hc".
+static leveldb::CompressionType FLAGS_compression =
+    leveldb::kSnappyCompression;
+
+// Number of threads compressing the blocks of each table being built.
+static int FLAGS_compression_threads = 1;
+
+// Compression level for zstd.
+static int FLAGS_zstd_compression_level = 1;
+
+// Compression level for LZ4HC.
+static int FLAGS_lz4hc_compression_level = 9;
+
+// If non-zero, every table trains a zstd dictionary of this many bytes.
+static int FLAGS_zstd_max_dictionary_size = 0;
+
+// If true, new tables checksum their blocks with XXH3 instead of crc32c.
+static bool FLAGS_xxh3_checksum = false;
+
 // Use the db with the following name.
 static const char* FLAGS_db = nullptr;
 
@@ -313,6 +380,9 @@ struct ThreadState {
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* compressed_cache_;
+  Cache* row_cache_;
+  PersistentCache* persistent_cache_;
   const FilterPolicy* filter_policy_;
   DB* db_;
   int num_;
@@ -321,6 +391,7 @@ class Benchmark {
   WriteOptions write_options_;
   int reads_;
   int heap_counter_;
+  std::vector<Iterator*> parallel_iters_;  // For readseq_parallel
 
   void PrintHeader() {
     const int kKeySize = 16;
@@ -402,7 +473,17 @@ class Benchmark {
 
  public:
   Benchmark()
-      : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : nullptr),
+      : cache_(FLAGS_cache_size < 0 ? nullptr
+               : FLAGS_clock_cache   ? NewClockCache(FLAGS_cache_size)
+               : FLAGS_scan_resistant_cache
+                   ? NewScanResistantLRUCache(FLAGS_cache_size)
+                   : NewLRUCache(FLAGS_cache_size)),
+        compressed_cache_(FLAGS_compressed_cache_size >= 0
+                              ? NewLRUCache(FLAGS_compressed_cache_size)
+                              : nullptr),
+        row_cache_(FLAGS_row_cache_size >= 0 ? NewLRUCache(FLAGS_row_cache_size)
+                                             : nullptr),
+        persistent_cache_(nullptr),
         filter_policy_(FLAGS_bloom_bits >= 0
                            ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                            : nullptr),
@@ -422,11 +503,24 @@ class Benchmark {
     if (!FLAGS_use_existing_db) {
       DestroyDB(FLAGS_db, Options());
     }
+    if (FLAGS_persistent_cache_dir != nullptr) {
+      Status s =
+          NewFilePersistentCache(g_env, FLAGS_persistent_cache_dir,
+                                 FLAGS_persistent_cache_size, &persistent_cache_);
+      if (!s.ok()) {
+        std::fprintf(stderr, "persistent cache error: %s\n",
+                     s.ToString().c_str());
+        std::exit(1);
+      }
+    }
   }
 
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete compressed_cache_;
+    delete row_cache_;
+    delete persistent_cache_;
     delete filter_policy_;
   }
 
@@ -486,6 +580,15 @@ class Benchmark {
         method = &Benchmark::WriteRandom;
       } else if (name == Slice("readseq")) {
         method = &Benchmark::ReadSequential;
+      } else if (name == Slice("readseq_parallel")) {
+        Status s = db_->NewParallelIterators(ReadOptions(), nullptr, nullptr,
+                                             num_threads, &parallel_iters_);
+        if (!s.ok()) {
+          std::fprintf(stderr, "parallel iterators error: %s\n",
+                       s.ToString().c_str());
+          std::exit(1);
+        }
+        method = &Benchmark::ReadSequentialParallel;
       } else if (name == Slice("readreverse")) {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
@@ -510,10 +613,22 @@ class Benchmark {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
         method = &Benchmark::Crc32c;
+      } else if (name == Slice("xxh3")) {
+        method = &Benchmark::XXH3;
       } else if (name == Slice("snappycomp")) {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
         method = &Benchmark::SnappyUncompress;
+      } else if (name == Slice("zstdcomp")) {
+        method = &Benchmark::ZstdCompress;
+      } else if (name == Slice("zstduncomp")) {
+        method = &Benchmark::ZstdUncompress;
+      } else if (name == Slice("lz4comp")) {
+        method = &Benchmark::Lz4Compress;
+      } else if (name == Slice("lz4uncomp")) {
+        method = &Benchmark::Lz4Uncompress;
+      } else if (name == Slice("lz4hccomp")) {
+        method = &Benchmark::Lz4HCCompress;
       } else if (name == Slice("heapprofile")) {
         HeapProfile();
       } else if (name == Slice("stats")) {
@@ -638,7 +753,31 @@ class Benchmark {
     thread->stats.AddMessage(label);
   }
 
-  void SnappyCompress(ThreadState* thread) {
+  void XXH3(ThreadState* thread) {
+    // Hash about 500MB of data total
+    const int size = 4096;
+    const char* label = "(4K per op)";
+    std::string data(size, 'x');
+    int64_t bytes = 0;
+    uint64_t hash = 0;
+    while (bytes < 500 * 1048576) {
+      hash = xxh3::Hash64(data.data(), size);
+      thread->stats.FinishedSingleOp();
+      bytes += size;
+    }
+    // Print so result is not dead
+    std::fprintf(stderr, "... hash=0x%llx\r",
+                 static_cast<unsigned long long>(hash));
+
+    thread->stats.AddBytes(bytes);
+    thread->stats.AddMessage(label);
+  }
+
+  // Repeatedly compress a block of data with "compress" and report the
+  // compressed size.
+  void Compress(ThreadState* thread, const char* name,
+                bool (*compress)(const char* input, size_t length,
+                                 std::string* output)) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
     int64_t bytes = 0;
@@ -646,14 +785,16 @@ class Benchmark {
     bool ok = true;
     std::string compressed;
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+      ok = (*compress)(input.data(), input.size(), &compressed);
       produced += compressed.size();
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      char buf[100];
+      std::snprintf(buf, sizeof(buf), "(%s failure)", name);
+      thread->stats.AddMessage(buf);
     } else {
       char buf[100];
       std::snprintf(buf, sizeof(buf), "(output: %.1f%%)",
@@ -663,40 +804,105 @@ class Benchmark {
     }
   }
 
-  void SnappyUncompress(ThreadState* thread) {
+  // Repeatedly uncompress a block of data compressed by "compress".
+  void Uncompress(ThreadState* thread, const char* name,
+                  bool (*compress)(const char* input, size_t length,
+                                   std::string* output),
+                  bool (*uncompress)(const char* input, size_t length,
+                                     char* output)) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
     std::string compressed;
-    bool ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+    bool ok = (*compress)(input.data(), input.size(), &compressed);
     int64_t bytes = 0;
     char* uncompressed = new char[input.size()];
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Uncompress(compressed.data(), compressed.size(),
-                                   uncompressed);
+      ok = (*uncompress)(compressed.data(), compressed.size(), uncompressed);
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
     delete[] uncompressed;
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      char buf[100];
+      std::snprintf(buf, sizeof(buf), "(%s failure)", name);
+      thread->stats.AddMessage(buf);
     } else {
       thread->stats.AddBytes(bytes);
     }
   }
 
+  static bool ZstdCompressBlock(const char* input, size_t length,
+                                std::string* output) {
+    return port::Zstd_Compress(FLAGS_zstd_compression_level, input, length,
+                               nullptr, output);
+  }
+
+  static bool ZstdUncompressBlock(const char* input, size_t length,
+                                  char* output) {
+    return port::Zstd_Uncompress(input, length, nullptr, output);
+  }
+
+  static bool Lz4HCCompressBlock(const char* input, size_t length,
+                                 std::string* output) {
+    return port::Lz4HC_Compress(FLAGS_lz4hc_compression_level, input, length,
+                                output);
+  }
+
+  void SnappyCompress(ThreadState* thread) {
+    Compress(thread, "snappy", &port::Snappy_Compress);
+  }
+
+  void SnappyUncompress(ThreadState* thread) {
+    Uncompress(thread, "snappy", &port::Snappy_Compress,
+               &port::Snappy_Uncompress);
+  }
+
+  void ZstdCompress(ThreadState* thread) {
+    Compress(thread, "zstd", &ZstdCompressBlock);
+  }
+
+  void ZstdUncompress(ThreadState* thread) {
+    Uncompress(thread, "zstd", &ZstdCompressBlock, &ZstdUncompressBlock);
+  }
+
+  void Lz4Compress(ThreadState* thread) {
+    Compress(thread, "lz4", &port::Lz4_Compress);
+  }
+
+  void Lz4Uncompress(ThreadState* thread) {
+    Uncompress(thread, "lz4", &port::Lz4_Compress, &port::Lz4_Uncompress);
+  }
+
+  void Lz4HCCompress(ThreadState* thread) {
+    Compress(thread, "lz4hc", &Lz4HCCompressBlock);
+  }
+
   void Open() {
     assert(db_ == nullptr);
     Options options;
     options.env = g_env;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.compressed_block_cache = compressed_cache_;
+    options.row_cache = row_cache_;
+    options.persistent_cache = persistent_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_file_size = FLAGS_max_file_size;
     options.block_size = FLAGS_block_size;
     options.max_open_files = FLAGS_open_files;
+    options.max_background_compactions = FLAGS_max_background_compactions;
+    options.max_subcompactions = FLAGS_max_subcompactions;
     options.filter_policy = filter_policy_;
     options.reuse_logs = FLAGS_reuse_logs;
+    options.use_direct_io_for_compaction = FLAGS_use_direct_io_for_compaction;
+    options.use_direct_reads = FLAGS_use_direct_reads;
+    options.checksum = FLAGS_xxh3_checksum ? kXXH3Checksum : kCRC32cChecksum;
+    options.compression = FLAGS_compression;
+    options.compression_threads = FLAGS_compression_threads;
+    options.zstd_compression_level = FLAGS_zstd_compression_level;
+    options.zstd_max_dictionary_size = FLAGS_zstd_max_dictionary_size;
+    options.lz4hc_compression_level = FLAGS_lz4hc_compression_level;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       std::fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -759,6 +965,24 @@ class Benchmark {
     thread->stats.AddBytes(bytes);
   }
 
+  void ReadSequentialParallel(ThreadState* thread) {
+    // The DB may hold too little data for one subrange per thread.
+    if (thread->tid >= static_cast<int>(parallel_iters_.size())) {
+      return;
+    }
+    Iterator* iter = parallel_iters_[thread->tid];
+    int i = 0;
+    int64_t bytes = 0;
+    for (iter->SeekToFirst(); i < reads_ && iter->Valid(); iter->Next()) {
+      bytes += iter->key().size() + iter->value().size();
+      thread->stats.FinishedSingleOp();
+      ++i;
+    }
+    delete iter;
+    parallel_iters_[thread->tid] = nullptr;
+    thread->stats.AddBytes(bytes);
+  }
+
   void ReadReverse(ThreadState* thread) {
     Iterator* iter = db_->NewIterator(ReadOptions());
     int i = 0;
@@ -944,9 +1168,23 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_use_existing_db = n;
+    } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_clock_cache = n;
+    } else if (sscanf(argv[i], "--scan_resistant_cache=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_scan_resistant_cache = n;
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--use_direct_io_for_compaction=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_direct_io_for_compaction = n;
+    } else if (sscanf(argv[i], "--use_direct_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_direct_reads = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -963,10 +1201,53 @@ int main(int argc, char** argv) {
       FLAGS_block_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--compressed_cache_size=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_compressed_cache_size = n;
+    } else if (sscanf(argv[i], "--row_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_row_cache_size = n;
+    } else if (strncmp(argv[i], "--persistent_cache_dir=", 23) == 0) {
+      FLAGS_persistent_cache_dir = argv[i] + 23;
+    } else if (sscanf(argv[i], "--persistent_cache_size=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_persistent_cache_size = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--max_background_compactions=%d%c", &n,
+                      &junk) == 1) {
+      FLAGS_max_background_compactions = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--mmap_files=%d%c", &n, &junk) == 1) {
+      FLAGS_set_mmap_files = true;
+      FLAGS_mmap_files = n;
+    } else if (strcmp(argv[i], "--compression=none") == 0) {
+      FLAGS_compression = leveldb::kNoCompression;
+    } else if (strcmp(argv[i], "--compression=snappy") == 0) {
+      FLAGS_compression = leveldb::kSnappyCompression;
+    } else if (strcmp(argv[i], "--compression=zstd") == 0) {
+      FLAGS_compression = leveldb::kZstdCompression;
+    } else if (strcmp(argv[i], "--compression=lz4") == 0) {
+      FLAGS_compression = leveldb::kLZ4Compression;
+    } else if (strcmp(argv[i], "--compression=lz4hc") == 0) {
+      FLAGS_compression = leveldb::kLZ4HCCompression;
+    } else if (sscanf(argv[i], "--lz4hc_compression_level=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_lz4hc_compression_level = n;
+    } else if (sscanf(argv[i], "--compression_threads=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_compression_threads = n;
+    } else if (sscanf(argv[i], "--zstd_compression_level=%d%c", &n, &junk) ==
+               1) {
+      FLAGS_zstd_compression_level = n;
+    } else if (sscanf(argv[i], "--zstd_max_dictionary_size=%d%c", &n,
+                      &junk) == 1) {
+      FLAGS_zstd_max_dictionary_size = n;
+    } else if (sscanf(argv[i], "--xxh3_checksum=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_xxh3_checksum = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -976,6 +1257,13 @@ int main(int argc, char** argv) {
   }
 
   leveldb::g_env = leveldb::Env::Default();
+  if (FLAGS_set_mmap_files) {
+    leveldb::Status s = leveldb::g_env->SetMaxMmapFiles(FLAGS_mmap_files);
+    if (!s.ok()) {
+      std::fprintf(stderr, "%s\n", s.ToString().c_str());
+      std::exit(1);
+    }
+  }
 
   // Choose a location for the test database if none given with --db=<path>
   if (FLAGS_db == nullptr) {
@@ -8,6 +8,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <limits>
 #include <set>
 #include <string>
 #include <vector>
@@ -34,6 +35,7 @@
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
@@ -64,6 +66,8 @@ struct DBImpl::CompactionState {
   explicit CompactionState(Compaction* c)
       : compaction(c),
         smallest_snapshot(0),
+        has_start(false),
+        has_end(false),
         outfile(nullptr),
         builder(nullptr),
         total_bytes(0) {}
@@ -76,6 +80,13 @@ struct DBImpl::CompactionState {
   // we can drop all entries for the same key with sequence numbers < S.
   SequenceNumber smallest_snapshot;
 
+  // If the compaction is split into shards, the range [start,end) of user
+  // keys that this shard compacts.  A missing bound is unlimited.
+  bool has_start;
+  bool has_end;
+  std::string start;
+  std::string end;
+
   std::vector<Output> outputs;
 
   // State kept for output being generated
@@ -85,6 +96,16 @@ struct DBImpl::CompactionState {
   uint64_t total_bytes;
 };
 
+// One shard of a compaction, compacted by DBImpl::SubcompactionWork().
+struct DBImpl::SubcompactionJob {
+  DBImpl* db;
+  CompactionState* compact;
+  Iterator* input;
+  int64_t imm_micros;  // Micros spent doing imm_ compactions
+  Status status;
+  bool done;  // Guarded by db->mutex_
+};
+
 // Fix user-supplied options to be reasonable
 template <class T, class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -98,10 +119,17 @@ Options SanitizeOptions(const std::string& dbname,
   Options result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != nullptr) ? ipolicy : nullptr;
-  ClipToRange(&result.max_open_files, 64 + kNumNonTableCacheFiles, 50000);
+  if (result.max_open_files != -1) {
+    ClipToRange(&result.max_open_files, 64 + kNumNonTableCacheFiles, 50000);
+  }
+  ClipToRange(&result.max_background_compactions, 1, 64);
+  ClipToRange(&result.max_subcompactions, 1, 64);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  for (size_t& block_size : result.block_size_per_level) {
+    ClipToRange(&block_size, 1 << 10, 4 << 20);
+  }
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -118,7 +146,28 @@ Options SanitizeOptions(const std::string& dbname,
   return result;
 }
 
+// Returns the options to build the tables of "level" with.
+static Options TableOptionsForLevel(const Options& options, int level) {
+  Options result = options;
+  if (!options.compression_per_level.empty()) {
+    const size_t i = std::min<size_t>(level,
+                                      options.compression_per_level.size() - 1);
+    result.compression = options.compression_per_level[i];
+  }
+  if (!options.block_size_per_level.empty()) {
+    const size_t i = std::min<size_t>(level,
+                                      options.block_size_per_level.size() - 1);
+    result.block_size = options.block_size_per_level[i];
+  }
+  return result;
+}
+
 static int TableCacheSize(const Options& sanitized_options) {
+  if (sanitized_options.max_open_files == -1) {
+    // Every live table is held open by its FileMetaData; obsolete tables
+    // are evicted when their files are deleted.
+    return std::numeric_limits<int>::max();
+  }
   // Reserve ten files or so for other uses and give the rest to TableCache.
   return sanitized_options.max_open_files - kNumNonTableCacheFiles;
 }
@@ -144,19 +193,33 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       log_(nullptr),
       seed_(0),
       tmp_batch_(new WriteBatch),
-      background_compaction_scheduled_(false),
+      flush_scheduled_(false),
+      has_flush_thread_(false),
+      background_compactions_scheduled_(0),
+      memtable_flush_scheduled_(false),
+      manual_compaction_scheduled_(false),
+      subcompaction_pool_(nullptr),
+      running_subcompactions_(0),
+      flushing_memtable_(false),
+      writing_manifest_(false),
+      manifest_written_signal_(&mutex_),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
-                               &internal_comparator_)) {}
+                               &internal_comparator_)) {
+  env_->IncreaseBackgroundThreads(options_.max_background_compactions);
+}
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish.
   mutex_.Lock();
   shutting_down_.store(true, std::memory_order_release);
-  while (background_compaction_scheduled_) {
+  while (background_compactions_scheduled_ > 0 || flush_scheduled_) {
     background_work_finished_signal_.Wait();
   }
+  assert(picked_compactions_.empty());
+  assert(running_subcompactions_ == 0);
   mutex_.Unlock();
+  delete subcompaction_pool_;
 
   if (db_lock_ != nullptr) {
     env_->UnlockFile(db_lock_);
@@ -450,7 +513,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
       compactions++;
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
+      status = WriteLevel0Table(mem, edit, nullptr, nullptr);
       mem->Unref();
       mem = nullptr;
       if (!status.ok()) {
@@ -489,7 +552,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     // mem did not get reused; compact it.
     if (status.ok()) {
       *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, nullptr);
+      status = WriteLevel0Table(mem, edit, nullptr, nullptr);
     }
     mem->Unref();
   }
@@ -498,7 +561,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, uint64_t* file_number) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
@@ -508,10 +571,29 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Log(options_.info_log, "Level-0 table #%llu: started",
       (unsigned long long)meta.number);
 
+  // Pick the level of the table before building it, so that it is built
+  // with the options of that level.  The first and last keys of the
+  // memtable are the smallest and largest keys of the table.  While
+  // compactions are running, the table stays in level-0, since a table in
+  // a deeper level could overlap the outputs they have not installed yet.
+  int level = 0;
+  if (base != nullptr && versions_->NumCompactionsInProgress() == 0) {
+    iter->SeekToFirst();
+    if (iter->Valid()) {
+      const std::string min_user_key = ExtractUserKey(iter->key()).ToString();
+      iter->SeekToLast();
+      const std::string max_user_key = ExtractUserKey(iter->key()).ToString();
+      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+    }
+  }
+
   Status s;
   {
+    Options table_options = TableOptionsForLevel(options_, level);
+    // Flushes must be quick, so only compaction outputs train a dictionary.
+    table_options.zstd_max_dictionary_size = 0;
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, env_, table_options, table_cache_, iter, &meta);
     mutex_.Lock();
   }
 
@@ -519,17 +601,15 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long)meta.number, (unsigned long long)meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
+  if (file_number != nullptr) {
+    *file_number = meta.number;
+  } else {
+    pending_outputs_.erase(meta.number);
+  }
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
-  int level = 0;
   if (s.ok() && meta.file_size > 0) {
-    const Slice min_user_key = meta.smallest.user_key();
-    const Slice max_user_key = meta.largest.user_key();
-    if (base != nullptr) {
-      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
-    }
     edit->AddFile(level, meta.number, meta.file_size, meta.smallest,
                   meta.largest);
   }
@@ -545,11 +625,15 @@ void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != nullptr);
 
+  assert(!flushing_memtable_.load(std::memory_order_relaxed));
+  flushing_memtable_.store(true, std::memory_order_relaxed);
+
   // Save the contents of the memtable as a new Table
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t file_number;
+  Status s = WriteLevel0Table(imm_, &edit, base, &file_number);
   base->Unref();
 
   if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
@@ -560,8 +644,10 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(file_number);
+  flushing_memtable_.store(false, std::memory_order_relaxed);
 
   if (s.ok()) {
     // Commit to the new state
@@ -654,19 +740,64 @@ void DBImpl::RecordBackgroundError(const Status& s) {
   }
 }
 
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (writing_manifest_) {
+    manifest_written_signal_.Wait();
+  }
+  writing_manifest_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  writing_manifest_ = false;
+  manifest_written_signal_.SignalAll();
+  return s;
+}
+
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (background_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.load(std::memory_order_acquire)) {
+  if (shutting_down_.load(std::memory_order_acquire)) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == nullptr && manual_compaction_ == nullptr &&
-             !versions_->NeedsCompaction()) {
-    // No work to be done
-  } else {
-    background_compaction_scheduled_ = true;
+    return;
+  }
+
+  // Memtable flushes get a thread of their own if the Env has one, so
+  // that they never wait for a compaction to finish.
+  if (imm_ != nullptr && !flush_scheduled_ &&
+      !flushing_memtable_.load(std::memory_order_relaxed) &&
+      env_->ScheduleHighPriority(&DBImpl::BGFlushWork, this)) {
+    flush_scheduled_ = true;
+    has_flush_thread_.store(true, std::memory_order_relaxed);
+  }
+
+  while (background_compactions_scheduled_ <
+         options_.max_background_compactions) {
+    if (imm_ != nullptr && !flush_scheduled_ && !memtable_flush_scheduled_ &&
+        !flushing_memtable_.load(std::memory_order_relaxed)) {
+      memtable_flush_scheduled_ = true;
+    } else if (manual_compaction_ != nullptr) {
+      // A manual compaction runs alone, and no other compaction is
+      // picked until it is done.
+      if (manual_compaction_scheduled_ ||
+          background_compactions_scheduled_ > 0) {
+        break;
+      }
+      manual_compaction_scheduled_ = true;
+    } else if (!versions_->NeedsCompaction()) {
+      // No work to be done
+      break;
+    } else {
+      // Picking marks the inputs as being compacted, so the next pick
+      // uses other files.
+      Compaction* c = versions_->PickCompaction();
+      if (c == nullptr) {
+        // All the work that is needed conflicts with running compactions
+        break;
+      }
+      picked_compactions_.push_back(c);
+    }
+    background_compactions_scheduled_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
@@ -677,16 +808,18 @@ void DBImpl::BGWork(void* db) {
 
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(background_compaction_scheduled_);
+  assert(background_compactions_scheduled_ > 0);
   if (shutting_down_.load(std::memory_order_acquire)) {
     // No more background work when shutting down.
+    DropScheduledWork();
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
+    DropScheduledWork();
   } else {
     BackgroundCompaction();
   }
 
-  background_compaction_scheduled_ = false;
+  background_compactions_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
@@ -694,18 +827,64 @@ void DBImpl::BackgroundCall() {
   background_work_finished_signal_.SignalAll();
 }
 
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(flush_scheduled_);
+  if (shutting_down_.load(std::memory_order_acquire)) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (imm_ != nullptr &&
+             !flushing_memtable_.load(std::memory_order_relaxed)) {
+    CompactMemTable();
+  }
+
+  flush_scheduled_ = false;
+
+  // The new level-0 file may call for a compaction, and another memtable
+  // may be waiting to be flushed.
+  MaybeScheduleCompaction();
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::DropScheduledWork() {
+  mutex_.AssertHeld();
+  memtable_flush_scheduled_ = false;
+  manual_compaction_scheduled_ = false;
+  while (!picked_compactions_.empty()) {
+    delete picked_compactions_.front();
+    picked_compactions_.pop_front();
+  }
+}
+
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != nullptr) {
-    CompactMemTable();
+  // Take one unit of the scheduled work.  Units are interchangeable
+  // between calls, so this need not be the unit whose scheduling led to
+  // this call.
+  if (memtable_flush_scheduled_) {
+    memtable_flush_scheduled_ = false;
+    // The memtable may have been flushed by a running compaction.
+    if (imm_ != nullptr &&
+        !flushing_memtable_.load(std::memory_order_relaxed)) {
+      CompactMemTable();
+    }
     return;
   }
 
   Compaction* c;
-  bool is_manual = (manual_compaction_ != nullptr);
+  const bool is_manual = manual_compaction_scheduled_;
   InternalKey manual_end;
   if (is_manual) {
+    manual_compaction_scheduled_ = false;
+    if (manual_compaction_ == nullptr) {
+      return;  // Cancelled
+    }
     ManualCompaction* m = manual_compaction_;
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == nullptr);
@@ -717,8 +896,11 @@ void DBImpl::BackgroundCompaction() {
         m->level, (m->begin ? m->begin->DebugString().c_str() : "(begin)"),
         (m->end ? m->end->DebugString().c_str() : "(end)"),
         (m->done ? "(end)" : manual_end.DebugString().c_str()));
+  } else if (!picked_compactions_.empty()) {
+    c = picked_compactions_.front();
+    picked_compactions_.pop_front();
   } else {
-    c = versions_->PickCompaction();
+    return;
   }
 
   Status status;
@@ -731,7 +913,7 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->RemoveFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->smallest,
                        f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -810,9 +992,13 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
 
   // Make the output file
   std::string fname = TableFileName(dbname_, file_number);
-  Status s = env_->NewWritableFile(fname, &compact->outfile);
+  Status s = options_.use_direct_io_for_compaction
+                 ? env_->NewDirectWritableFile(fname, &compact->outfile)
+                 : env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        TableOptionsForLevel(options_, compact->compaction->level() + 1),
+        compact->outfile);
   }
   return s;
 }
@@ -852,8 +1038,9 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
 
   if (s.ok() && current_entries > 0) {
     // Verify that the table is usable
-    Iterator* iter =
-        table_cache_->NewIterator(ReadOptions(), output_number, current_bytes);
+    Iterator* iter = table_cache_->NewIterator(
+        ReadOptions(), output_number, current_bytes,
+        compact->compaction->level() + 1);
     s = iter->status();
     delete iter;
     if (s.ok()) {
@@ -881,12 +1068,11 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log, "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0), compact->compaction->level(),
@@ -902,32 +1088,167 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
   }
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  // Split the key range of the compaction into shards that are compacted
+  // on separate threads.  "compact" itself handles the first shard.
+  std::vector<CompactionState*> shards(1, compact);
+  if (options_.max_subcompactions > 1) {
+    std::vector<std::string> split_keys;
+    mutex_.Unlock();
+    versions_->SubcompactionSplitKeys(
+        compact->compaction, options_.max_subcompactions, &split_keys);
+    mutex_.Lock();
+    for (const std::string& split_key : split_keys) {
+      CompactionState* shard =
+          new CompactionState(compact->compaction->NewSubcompaction());
+      shard->smallest_snapshot = compact->smallest_snapshot;
+      shard->has_start = true;
+      shard->start = split_key;
+      shards.back()->has_end = true;
+      shards.back()->end = split_key;
+      shards.push_back(shard);
+    }
+    if (shards.size() > 1) {
+      Log(options_.info_log, "Compacting in %d shards",
+          static_cast<int>(shards.size()));
+    }
+  }
+
+  std::vector<SubcompactionJob> jobs(shards.size());
+  for (size_t i = 0; i < shards.size(); i++) {
+    jobs[i].db = this;
+    jobs[i].compact = shards[i];
+    jobs[i].input = versions_->MakeInputIterator(shards[i]->compaction);
+    jobs[i].imm_micros = 0;
+    jobs[i].done = false;
+  }
+  const int pool_jobs = static_cast<int>(jobs.size()) - 1;
+  ThreadPool* pool = nullptr;
+  if (pool_jobs > 0) {
+    running_subcompactions_ += pool_jobs;
+    if (subcompaction_pool_ == nullptr) {
+      subcompaction_pool_ = new ThreadPool(running_subcompactions_);
+    } else {
+      subcompaction_pool_->EnsureThreads(running_subcompactions_);
+    }
+    pool = subcompaction_pool_;
+  }
 
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
+  versions_->HintInputs(compact->compaction);
+
+  // Compact the first shard on this thread, and the others on the pool.
+  for (size_t i = 1; i < jobs.size(); i++) {
+    pool->Schedule(&DBImpl::SubcompactionWork, &jobs[i]);
+  }
+  SubcompactionWork(&jobs[0]);
+  if (pool_jobs > 0) {
+    mutex_.Lock();
+    for (size_t i = 1; i < jobs.size(); i++) {
+      while (!jobs[i].done) {
+        background_work_finished_signal_.Wait();
+      }
+    }
+    running_subcompactions_ -= pool_jobs;
+    mutex_.Unlock();
+  }
+
+  Status status;
+  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
+  for (size_t i = 0; i < jobs.size(); i++) {
+    if (status.ok()) {
+      status = jobs[i].status;
+    }
+    imm_micros += jobs[i].imm_micros;
+    delete jobs[i].input;
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+
+  mutex_.Lock();
+
+  // Collect the outputs of all shards in "compact", in key order.
+  for (size_t i = 1; i < shards.size(); i++) {
+    CompactionState* shard = shards[i];
+    compact->outputs.insert(compact->outputs.end(), shard->outputs.begin(),
+                            shard->outputs.end());
+    compact->total_bytes += shard->total_bytes;
+    shard->outputs.clear();
+    Compaction* c = shard->compaction;
+    CleanupCompaction(shard);
+    delete c;
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log, "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
 
-  input->SeekToFirst();
+void DBImpl::SubcompactionWork(void* arg) {
+  SubcompactionJob* job = reinterpret_cast<SubcompactionJob*>(arg);
+  job->status =
+      job->db->DoSubcompactionWork(job->compact, job->input, &job->imm_micros);
+  MutexLock l(&job->db->mutex_);
+  job->done = true;
+  job->db->background_work_finished_signal_.SignalAll();
+}
+
+Status DBImpl::DoSubcompactionWork(CompactionState* compact, Iterator* input,
+                                   int64_t* imm_micros) {
+  if (compact->has_start) {
+    input->Seek(
+        InternalKey(compact->start, kMaxSequenceNumber, kValueTypeForSeek)
+            .Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   while (input->Valid() && !shutting_down_.load(std::memory_order_acquire)) {
-    // Prioritize immutable compaction work
-    if (has_imm_.load(std::memory_order_relaxed)) {
+    // Prioritize immutable compaction work, unless it is done on the
+    // Env's high-priority thread or another thread is already at it.
+    // The checks are made before taking the mutex, so that compactions
+    // running during a flush do not take it for every key.
+    if (has_imm_.load(std::memory_order_relaxed) &&
+        !has_flush_thread_.load(std::memory_order_relaxed) &&
+        !flushing_memtable_.load(std::memory_order_relaxed)) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != nullptr) {
+      if (imm_ != nullptr && !flush_scheduled_ &&
+          !flushing_memtable_.load(std::memory_order_relaxed)) {
         CompactMemTable();
         // Wake up MakeRoomForWrite() if necessary.
         background_work_finished_signal_.SignalAll();
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
+    if (compact->has_end && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key, compact->end) >= 0) {
+      // The rest belongs to the next shard
+      break;
+    }
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != nullptr) {
       status = FinishCompactionOutputFile(compact, input);
@@ -1017,31 +1338,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = input->status();
   }
-  delete input;
-  input = nullptr;
-
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
-  }
-
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log, "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
@@ -1067,6 +1363,22 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
   delete state;
 }
 
+// The bounds of one of the iterators returned by NewParallelIterators().
+struct ShardBounds {
+  ShardBounds(const std::string& lower, const std::string& upper)
+      : lower(lower), upper(upper), lower_slice(this->lower),
+        upper_slice(this->upper) {}
+
+  const std::string lower;
+  const std::string upper;
+  const Slice lower_slice;
+  const Slice upper_slice;
+};
+
+static void DeleteShardBounds(void* arg1, void* arg2) {
+  delete reinterpret_cast<ShardBounds*>(arg1);
+}
+
 }  // anonymous namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
@@ -1074,25 +1386,34 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       uint32_t* seed) {
   mutex_.Lock();
   *latest_snapshot = versions_->LastSequence();
+  Iterator* internal_iter = NewInternalIteratorLocked(
+      options, mem_, imm_, versions_->current(), seed);
+  mutex_.Unlock();
+  return internal_iter;
+}
+
+Iterator* DBImpl::NewInternalIteratorLocked(const ReadOptions& options,
+                                            MemTable* mem, MemTable* imm,
+                                            Version* current, uint32_t* seed) {
+  mutex_.AssertHeld();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  list.push_back(mem->NewIterator());
+  mem->Ref();
+  if (imm != nullptr) {
+    list.push_back(imm->NewIterator());
+    imm->Ref();
   }
-  versions_->current()->AddIterators(options, &list);
+  current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
+  current->Ref();
 
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
+  IterState* cleanup = new IterState(&mutex_, mem, imm, current);
   internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
 
   *seed = ++seed_;
-  mutex_.Unlock();
   return internal_iter;
 }
 
@@ -1107,6 +1428,11 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+int DBImpl::TEST_NumPickedCompactions() {
+  MutexLock l(&mutex_);
+  return static_cast<int>(picked_compactions_.size());
+}
+
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    std::string* value) {
   Status s;
@@ -1163,7 +1489,68 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
                             ? static_cast<const SnapshotImpl*>(options.snapshot)
                                   ->sequence_number()
                             : latest_snapshot),
-                       seed);
+                       options.iterate_lower_bound, options.iterate_upper_bound,
+                       options.pin_data, seed);
+}
+
+Status DBImpl::NewParallelIterators(const ReadOptions& options,
+                                    const Slice* begin, const Slice* end,
+                                    int n, std::vector<Iterator*>* iterators) {
+  iterators->clear();
+  if (n < 1) {
+    return Status::InvalidArgument("need at least one iterator");
+  }
+
+  // All iterators share the memtables and version that are current here,
+  // and hence the same snapshot.
+  mutex_.Lock();
+  SequenceNumber sequence =
+      (options.snapshot != nullptr
+           ? static_cast<const SnapshotImpl*>(options.snapshot)
+                 ->sequence_number()
+           : versions_->LastSequence());
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != nullptr) imm->Ref();
+  current->Ref();
+
+  // Finding the split keys reads table index blocks, so do it unlocked.
+  mutex_.Unlock();
+  std::vector<std::string> split_keys;
+  versions_->ApproximateSplitKeys(current, begin, end, n, &split_keys);
+  mutex_.Lock();
+
+  for (size_t i = 0; i <= split_keys.size(); i++) {
+    // Each iterator owns a copy of its bounds.
+    const bool first = (i == 0);
+    const bool last = (i == split_keys.size());
+    ShardBounds* bounds = new ShardBounds(
+        first ? (begin != nullptr ? begin->ToString() : "")
+              : split_keys[i - 1],
+        last ? (end != nullptr ? end->ToString() : "") : split_keys[i]);
+    ReadOptions sub_options = options;
+    sub_options.iterate_lower_bound =
+        (first && begin == nullptr ? nullptr : &bounds->lower_slice);
+    sub_options.iterate_upper_bound =
+        (last && end == nullptr ? nullptr : &bounds->upper_slice);
+    uint32_t seed;
+    Iterator* internal_iter =
+        NewInternalIteratorLocked(sub_options, mem, imm, current, &seed);
+    Iterator* iter = NewDBIterator(
+        this, user_comparator(), internal_iter, sequence,
+        sub_options.iterate_lower_bound, sub_options.iterate_upper_bound,
+        sub_options.pin_data, seed);
+    iter->RegisterCleanup(&DeleteShardBounds, bounds, nullptr);
+    iterators->push_back(iter);
+  }
+
+  mem->Unref();
+  if (imm != nullptr) imm->Unref();
+  current->Unref();
+  mutex_.Unlock();
+  return Status::OK();
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -1473,6 +1860,13 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::NewParallelIterators(const ReadOptions& options, const Slice* begin,
+                                const Slice* end, int n,
+                                std::vector<Iterator*>* iterators) {
+  iterators->clear();
+  return Status::NotSupported("NewParallelIterators");
+}
+
 DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
@@ -1502,7 +1896,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   if (s.ok() && save_manifest) {
     edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
     edit.SetLogNumber(impl->logfile_number_);
-    s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
+    s = impl->LogAndApply(&edit);
   }
   if (s.ok()) {
     impl->RemoveObsoleteFiles();
@@ -20,8 +20,10 @@
 
 namespace leveldb {
 
+class Compaction;
 class MemTable;
 class TableCache;
+class ThreadPool;
 class Version;
 class VersionEdit;
 class VersionSet;
@@ -43,6 +45,9 @@ class DBImpl : public DB {
   Status Get(const ReadOptions& options, const Slice& key,
              std::string* value) override;
   Iterator* NewIterator(const ReadOptions&) override;
+  Status NewParallelIterators(const ReadOptions& options, const Slice* begin,
+                              const Slice* end, int n,
+                              std::vector<Iterator*>* iterators) override;
   const Snapshot* GetSnapshot() override;
   void ReleaseSnapshot(const Snapshot* snapshot) override;
   bool GetProperty(const Slice& property, std::string* value) override;
@@ -66,6 +71,10 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Return the number of compactions that have been picked and are
+  // waiting for a background thread.
+  int TEST_NumPickedCompactions();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -74,6 +83,7 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct SubcompactionJob;
   struct Writer;
 
   // Information for a manual compaction
@@ -105,6 +115,13 @@ class DBImpl : public DB {
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
 
+  // Like NewInternalIterator(), but over the given memtables and version,
+  // which the caller has kept alive.  "imm" may be nullptr.
+  Iterator* NewInternalIteratorLocked(const ReadOptions&, MemTable* mem,
+                                      MemTable* imm, Version* current,
+                                      uint32_t* seed)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status NewDB();
 
   // Recover the descriptor from persistent storage.  May do a significant
@@ -127,9 +144,18 @@ class DBImpl : public DB {
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // Build a table from "mem" and add it to *edit.  If "file_number" is
+  // non-null, the number of the table is stored in *file_number and kept
+  // in pending_outputs_, and the caller must remove it from there once
+  // *edit has been applied.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          uint64_t* file_number)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Apply *edit to the current version, waiting for any other thread
+  // that is writing the descriptor to finish first.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer)
@@ -140,11 +166,21 @@ class DBImpl : public DB {
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   void BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Drop all background work that was scheduled but has not started.
+  void DropScheduledWork() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void SubcompactionWork(void* job);
+  // Compact the entries of "input" that fall in the key range of
+  // "compact", which is one shard of a compaction.  May be called from
+  // several threads at once, for different shards.
+  Status DoSubcompactionWork(CompactionState* compact, Iterator* input,
+                             int64_t* imm_micros);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -192,8 +228,37 @@ class DBImpl : public DB {
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_ GUARDED_BY(mutex_);
 
-  // Has a background compaction been scheduled or is running?
-  bool background_compaction_scheduled_ GUARDED_BY(mutex_);
+  // Has BackgroundFlushCall() been scheduled on the Env's high-priority
+  // thread, or is it running?
+  bool flush_scheduled_ GUARDED_BY(mutex_);
+  // Has the Env ever accepted work for its high-priority thread?  If so,
+  // compactions leave memtable flushes to that thread.
+  std::atomic<bool> has_flush_thread_;
+
+  // Number of calls to BackgroundCall() that have been scheduled or
+  // are running.  Each one performs one unit of the work below: a
+  // memtable flush (only if the Env has no high-priority thread), a step
+  // of the manual compaction, or one of the compactions in
+  // picked_compactions_.
+  int background_compactions_scheduled_ GUARDED_BY(mutex_);
+  bool memtable_flush_scheduled_ GUARDED_BY(mutex_);
+  bool manual_compaction_scheduled_ GUARDED_BY(mutex_);
+  std::deque<Compaction*> picked_compactions_ GUARDED_BY(mutex_);
+
+  // Runs the shards of sharded compactions other than the first, which
+  // the compacting thread runs itself.  Created on first use, and grown
+  // to the most shards that were running at once, so that concurrent
+  // compactions do not wait for each other's shards.
+  ThreadPool* subcompaction_pool_ GUARDED_BY(mutex_);
+  int running_subcompactions_ GUARDED_BY(mutex_);
+
+  // Is imm_ being written to a table?  Set under mutex_, but read without
+  // it by compactions deciding whether to flush imm_ themselves.
+  std::atomic<bool> flushing_memtable_;
+
+  // Is a thread inside VersionSet::LogAndApply()?
+  bool writing_manifest_ GUARDED_BY(mutex_);
+  port::CondVar manifest_written_signal_ GUARDED_BY(mutex_);
 
   ManualCompaction* manual_compaction_ GUARDED_BY(mutex_);
 
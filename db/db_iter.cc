@@ -4,12 +4,15 @@
 
 #include "db/db_iter.h"
 
+#include <cstring>
+
 #include "db/db_impl.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
+#include "util/arena.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
@@ -46,15 +49,26 @@ class DBIter : public Iterator {
   enum Direction { kForward, kReverse };
 
   DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
+         const Slice* lower_bound, const Slice* upper_bound, bool pin_data,
          uint32_t seed)
       : db_(db),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        has_lower_bound_(lower_bound != nullptr),
+        has_upper_bound_(upper_bound != nullptr),
+        pin_data_(pin_data),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
-        bytes_until_read_sampling_(RandomCompactionPeriod()) {}
+        bytes_until_read_sampling_(RandomCompactionPeriod()) {
+    if (has_lower_bound_) {
+      lower_bound_.assign(lower_bound->data(), lower_bound->size());
+    }
+    if (has_upper_bound_) {
+      upper_bound_.assign(upper_bound->data(), upper_bound->size());
+    }
+  }
 
   DBIter(const DBIter&) = delete;
   DBIter& operator=(const DBIter&) = delete;
@@ -63,10 +77,16 @@ class DBIter : public Iterator {
   bool Valid() const override { return valid_; }
   Slice key() const override {
     assert(valid_);
+    if (pin_data_) {
+      return pinned_key_;
+    }
     return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
   }
   Slice value() const override {
     assert(valid_);
+    if (pin_data_) {
+      return pinned_value_;
+    }
     return (direction_ == kForward) ? iter_->value() : saved_value_;
   }
   Status status() const override {
@@ -88,10 +108,33 @@ class DBIter : public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  // Returns true iff "user_key" lies past the end of the iteration range.
+  bool AtOrAfterUpperBound(const Slice& user_key) const {
+    return has_upper_bound_ &&
+           user_comparator_->Compare(user_key, upper_bound_) >= 0;
+  }
+
+  // Returns true iff "user_key" lies before the start of the iteration range.
+  bool BeforeLowerBound(const Slice& user_key) const {
+    return has_lower_bound_ &&
+           user_comparator_->Compare(user_key, lower_bound_) < 0;
+  }
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
 
+  // Makes "k" and "v" the current entry of a pin_data_ iterator.  Values
+  // live in pinned blocks or memtables and are used in place, but block
+  // iterators rebuild delta-encoded keys in a reused buffer, so the key
+  // is copied into pinned_keys_.
+  void PinEntry(const Slice& k, const Slice& v) {
+    char* mem = pinned_keys_.Allocate(k.size() > 0 ? k.size() : 1);
+    std::memcpy(mem, k.data(), k.size());
+    pinned_key_ = Slice(mem, k.size());
+    pinned_value_ = v;
+  }
+
   inline void ClearSavedValue() {
     if (saved_value_.capacity() > 1048576) {
       std::string empty;
@@ -110,9 +153,17 @@ class DBIter : public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const bool has_lower_bound_;
+  const bool has_upper_bound_;
+  std::string lower_bound_;  // Inclusive; meaningful iff has_lower_bound_
+  std::string upper_bound_;  // Exclusive; meaningful iff has_upper_bound_
   Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
   std::string saved_value_;  // == current raw value when direction_==kReverse
+  const bool pin_data_;
+  Arena pinned_keys_;   // Backs pinned_key_ and its predecessors
+  Slice pinned_key_;    // == current key when pin_data_
+  Slice pinned_value_;  // == current value when pin_data_
   Direction direction_;
   bool valid_;
   Random rnd_;
@@ -181,6 +232,11 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   do {
     ParsedInternalKey ikey;
     if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      if (AtOrAfterUpperBound(ikey.user_key)) {
+        // Every remaining entry is outside the range, so stop here
+        // rather than pulling in further blocks.
+        break;
+      }
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -195,6 +251,9 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           } else {
             valid_ = true;
             saved_key_.clear();
+            if (pin_data_) {
+              PinEntry(ikey.user_key, iter_->value());
+            }
             return;
           }
           break;
@@ -241,6 +300,10 @@ void DBIter::FindPrevUserEntry() {
     do {
       ParsedInternalKey ikey;
       if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+        if (BeforeLowerBound(ikey.user_key)) {
+          // Every remaining entry is outside the range.
+          break;
+        }
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
@@ -252,12 +315,17 @@ void DBIter::FindPrevUserEntry() {
           ClearSavedValue();
         } else {
           Slice raw_value = iter_->value();
-          if (saved_value_.capacity() > raw_value.size() + 1048576) {
-            std::string empty;
-            swap(empty, saved_value_);
-          }
           SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
-          saved_value_.assign(raw_value.data(), raw_value.size());
+          if (pin_data_) {
+            // The value stays valid after iter_ moves on.
+            pinned_value_ = raw_value;
+          } else {
+            if (saved_value_.capacity() > raw_value.size() + 1048576) {
+              std::string empty;
+              swap(empty, saved_value_);
+            }
+            saved_value_.assign(raw_value.data(), raw_value.size());
+          }
         }
       }
       iter_->Prev();
@@ -272,6 +340,9 @@ void DBIter::FindPrevUserEntry() {
     direction_ = kForward;
   } else {
     valid_ = true;
+    if (pin_data_) {
+      PinEntry(saved_key_, pinned_value_);
+    }
   }
 }
 
@@ -279,8 +350,10 @@ void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
-  AppendInternalKey(&saved_key_,
-                    ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+  AppendInternalKey(
+      &saved_key_,
+      ParsedInternalKey(BeforeLowerBound(target) ? Slice(lower_bound_) : target,
+                        sequence_, kValueTypeForSeek));
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
@@ -290,6 +363,10 @@ void DBIter::Seek(const Slice& target) {
 }
 
 void DBIter::SeekToFirst() {
+  if (has_lower_bound_) {
+    Seek(lower_bound_);
+    return;
+  }
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
@@ -303,7 +380,21 @@ void DBIter::SeekToFirst() {
 void DBIter::SeekToLast() {
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (has_upper_bound_) {
+    // Position at the last entry before the upper bound.
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(upper_bound_,
+                                                     kMaxSequenceNumber,
+                                                     kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -311,8 +402,10 @@ void DBIter::SeekToLast() {
 
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+                        const Slice* lower_bound, const Slice* upper_bound,
+                        bool pin_data, uint32_t seed) {
+  return new DBIter(db, user_key_comparator, internal_iter, sequence,
+                    lower_bound, upper_bound, pin_data, seed);
 }
 
 }  // namespace leveldb
@@ -16,10 +16,17 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "lower_bound" (inclusive) or
+// "upper_bound" (exclusive) is non-null, only user keys inside the
+// bounds are yielded; the bounds are copied.  If "pin_data" is true,
+// "*internal_iter" must keep the data it has yielded alive until it is
+// deleted (see ReadOptions::pin_data); the returned iterator then hands
+// out values without copying them, and its key() and value() remain
+// valid until it is deleted.
 Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed);
+                        const Slice* lower_bound, const Slice* upper_bound,
+                        bool pin_data, uint32_t seed);
 
 }  // namespace leveldb
 
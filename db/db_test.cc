@@ -5,7 +5,11 @@
 #include "leveldb/db.h"
 
 #include <atomic>
+#include <map>
+#include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "db/db_impl.h"
@@ -15,6 +19,7 @@
 #include "leveldb/cache.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/persistent_cache.h"
 #include "leveldb/table.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
@@ -120,6 +125,18 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Copy the result of every random read into the caller's buffer, as if
+  // table files were not mmap-ed, so that blocks are block-cachable.
+  bool copy_random_reads_;
+
+  // Number of files opened through NewDirectRandomAccessFile() and
+  // NewDirectWritableFile().
+  AtomicCounter direct_file_counter_;
+
+  // Work passed to Schedule() is queued, and not run, while this is true.
+  // ReleaseBackgroundWork() hands the queued work to the base Env.
+  std::atomic<bool> hold_background_work_;
+
   explicit SpecialEnv(Env* base)
       : EnvWrapper(base),
         delay_data_sync_(false),
@@ -128,7 +145,37 @@ class SpecialEnv : public EnvWrapper {
         non_writable_(false),
         manifest_sync_error_(false),
         manifest_write_error_(false),
-        count_random_reads_(false) {}
+        count_random_reads_(false),
+        copy_random_reads_(false),
+        hold_background_work_(false),
+        running_background_work_(0) {}
+
+  ~SpecialEnv() override {
+    // Work may still be returning from RunBackgroundWork() after the DB
+    // saw it finish.
+    while (running_background_work_.load(std::memory_order_acquire) > 0) {
+      target()->SleepForMicroseconds(100);
+    }
+  }
+
+  void Schedule(void (*function)(void*), void* arg) override {
+    BackgroundWork* work = new BackgroundWork{this, function, arg};
+    MutexLock l(&held_mu_);
+    if (hold_background_work_.load(std::memory_order_acquire)) {
+      held_.push_back(work);
+    } else {
+      target()->Schedule(&SpecialEnv::RunBackgroundWork, work);
+    }
+  }
+
+  void ReleaseBackgroundWork() {
+    MutexLock l(&held_mu_);
+    hold_background_work_.store(false, std::memory_order_release);
+    for (size_t i = 0; i < held_.size(); i++) {
+      target()->Schedule(&SpecialEnv::RunBackgroundWork, held_[i]);
+    }
+    held_.clear();
+  }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
     class DataFile : public WritableFile {
@@ -218,12 +265,65 @@ class SpecialEnv : public EnvWrapper {
       }
     };
 
+    class CopyingFile : public RandomAccessFile {
+     private:
+      RandomAccessFile* target_;
+
+     public:
+      explicit CopyingFile(RandomAccessFile* target) : target_(target) {}
+      ~CopyingFile() override { delete target_; }
+      Status Read(uint64_t offset, size_t n, Slice* result,
+                  char* scratch) const override {
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && result->data() != scratch) {
+          std::memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+    };
+
     Status s = target()->NewRandomAccessFile(f, r);
+    if (s.ok() && copy_random_reads_) {
+      *r = new CopyingFile(*r);
+    }
     if (s.ok() && count_random_reads_) {
       *r = new CountingFile(*r, &random_read_counter_);
     }
     return s;
   }
+
+  Status NewDirectRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) override {
+    direct_file_counter_.Increment();
+    return target()->NewDirectRandomAccessFile(f, r);
+  }
+
+  Status NewDirectWritableFile(const std::string& f,
+                               WritableFile** r) override {
+    direct_file_counter_.Increment();
+    return target()->NewDirectWritableFile(f, r);
+  }
+
+ private:
+  struct BackgroundWork {
+    SpecialEnv* env;
+    void (*function)(void*);
+    void* arg;
+  };
+
+  static void RunBackgroundWork(void* arg) {
+    BackgroundWork* work = reinterpret_cast<BackgroundWork*>(arg);
+    SpecialEnv* env = work->env;
+    env->running_background_work_++;
+    (*work->function)(work->arg);
+    delete work;
+    env->running_background_work_--;
+  }
+
+  std::atomic<int> running_background_work_;
+  port::Mutex held_mu_;
+  std::vector<BackgroundWork*> held_;
 };
 
 class DBTest : public testing::Test {
@@ -275,6 +375,15 @@ class DBTest : public testing::Test {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kUnlimitedOpenFiles:
+        options.max_open_files = -1;
+        break;
+      case kParallelCompactions:
+        options.max_background_compactions = 4;
+        break;
+      case kSubcompactions:
+        options.max_subcompactions = 4;
+        break;
       default:
         break;
     }
@@ -531,7 +640,16 @@ class DBTest : public testing::Test {
 
  private:
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kReuse, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kReuse,
+    kFilter,
+    kUncompressed,
+    kUnlimitedOpenFiles,
+    kParallelCompactions,
+    kSubcompactions,
+    kEnd
+  };
 
   const FilterPolicy* filter_policy_;
   int option_config_;
@@ -963,6 +1081,530 @@ TEST_F(DBTest, IterMultiWithDelete) {
   } while (ChangeOptions());
 }
 
+TEST_F(DBTest, IterBounds) {
+  do {
+    ASSERT_LEVELDB_OK(Put("a", "va"));
+    ASSERT_LEVELDB_OK(Put("b", "vb"));
+    ASSERT_LEVELDB_OK(Put("c", "vc"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_LEVELDB_OK(Put("d", "vd"));
+    ASSERT_LEVELDB_OK(Put("e", "ve"));
+    ASSERT_LEVELDB_OK(Delete("c"));
+
+    Slice lower("b");
+    Slice upper("e");
+    ReadOptions options;
+    options.iterate_lower_bound = &lower;
+    options.iterate_upper_bound = &upper;
+    Iterator* iter = db_->NewIterator(options);
+
+    iter->SeekToFirst();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "d->vd");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->SeekToLast();
+    ASSERT_EQ(IterStatus(iter), "d->vd");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+    iter->Seek("a");
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Seek("c");
+    ASSERT_EQ(IterStatus(iter), "d->vd");
+    iter->Prev();
+    ASSERT_EQ(IterStatus(iter), "b->vb");
+    iter->Next();
+    ASSERT_EQ(IterStatus(iter), "d->vd");
+    iter->Seek("e");
+    ASSERT_EQ(IterStatus(iter), "(invalid)");
+    delete iter;
+  } while (ChangeOptions());
+}
+
+TEST_F(DBTest, IterBoundsSkipFiles) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  Reopen(&options);
+
+  // Two table files with disjoint key ranges.
+  ASSERT_LEVELDB_OK(Put("a", "va"));
+  ASSERT_LEVELDB_OK(Put("b", "vb"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_LEVELDB_OK(Put("x", "vx"));
+  ASSERT_LEVELDB_OK(Put("y", "vy"));
+  dbfull()->TEST_CompactMemTable();
+
+  Slice upper("c");
+  ReadOptions read_options;
+  read_options.iterate_upper_bound = &upper;
+  env_->count_random_reads_ = true;
+
+  Reopen(&options);  // Start with an empty table cache.
+  env_->random_read_counter_.Reset();
+  Iterator* iter = db_->NewIterator(read_options);
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+  const int bounded_reads = env_->random_read_counter_.Read();
+
+  Reopen(&options);
+  env_->random_read_counter_.Reset();
+  iter = db_->NewIterator(ReadOptions());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+  }
+  delete iter;
+  const int unbounded_reads = env_->random_read_counter_.Read();
+  env_->count_random_reads_ = false;
+
+  // The bounded scan never opens the table holding "x" and "y".
+  ASSERT_GT(bounded_reads, 0);
+  ASSERT_LT(bounded_reads, unbounded_reads);
+}
+
+// Returns the keys yielded by "iters", in order, and deletes them.
+static std::vector<std::string> ScanParallelIterators(
+    const std::vector<Iterator*>& iters) {
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < iters.size(); i++) {
+    for (iters[i]->SeekToFirst(); iters[i]->Valid(); iters[i]->Next()) {
+      keys.push_back(iters[i]->key().ToString());
+    }
+    EXPECT_LEVELDB_OK(iters[i]->status());
+    delete iters[i];
+  }
+  return keys;
+}
+
+TEST_F(DBTest, ParallelIterators) {
+  const int kNumKeys = 1000;
+  std::vector<std::string> all_keys;
+  for (int i = 0; i < kNumKeys; i++) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    all_keys.push_back(buf);
+    ASSERT_LEVELDB_OK(Put(buf, std::string(1000, 'v')));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_LEVELDB_OK(Put("key000500", "new"));  // Still in the memtable
+
+  std::vector<Iterator*> iters;
+  ASSERT_LEVELDB_OK(
+      db_->NewParallelIterators(ReadOptions(), nullptr, nullptr, 4, &iters));
+  ASSERT_EQ(4, iters.size());
+
+  // Writes after the call are not visible to any of the iterators.
+  ASSERT_LEVELDB_OK(Put("key000100", "later"));
+  ASSERT_LEVELDB_OK(Put("zzz", "later"));
+  std::vector<std::string> values;
+  for (size_t i = 0; i < iters.size(); i++) {
+    int count = 0;
+    for (iters[i]->SeekToFirst(); iters[i]->Valid(); iters[i]->Next()) {
+      count++;
+      if (iters[i]->key() == "key000100" || iters[i]->key() == "key000500") {
+        values.push_back(iters[i]->value().ToString());
+      }
+    }
+    // The subranges hold roughly equal amounts of data.
+    ASSERT_GT(count, kNumKeys / 8);
+    ASSERT_LT(count, kNumKeys / 2);
+  }
+  ASSERT_EQ(2, values.size());
+  ASSERT_EQ(std::string(1000, 'v'), values[0]);
+  ASSERT_EQ("new", values[1]);
+  ASSERT_EQ(all_keys, ScanParallelIterators(iters));
+
+  // A bounded range is covered exactly.  The bounds only need to live
+  // for the duration of the call.
+  std::string begin_key = "key000100";
+  std::string end_key = "key000200";
+  Slice begin(begin_key);
+  Slice end(end_key);
+  ReadOptions prefetch_options;
+  prefetch_options.async_prefetch = true;
+  ASSERT_LEVELDB_OK(
+      db_->NewParallelIterators(prefetch_options, &begin, &end, 3, &iters));
+  ASSERT_EQ(3, iters.size());
+  begin_key.assign(begin_key.size(), 'x');
+  end_key.assign(end_key.size(), 'x');
+  begin = Slice("key000100");
+  end = Slice("key000200");
+  ASSERT_EQ(std::vector<std::string>(all_keys.begin() + 100,
+                                     all_keys.begin() + 200),
+            ScanParallelIterators(iters));
+
+  // A range too small to split yields a single iterator.
+  Slice tiny_end("key000101");
+  ASSERT_LEVELDB_OK(
+      db_->NewParallelIterators(ReadOptions(), &begin, &tiny_end, 8, &iters));
+  ASSERT_EQ(1, iters.size());
+  ASSERT_EQ(std::vector<std::string>(1, "key000100"),
+            ScanParallelIterators(iters));
+}
+
+TEST_F(DBTest, ClockBlockCache) {
+  Options options = CurrentOptions();
+  options.block_cache = NewClockCache(64 << 10);
+  options.block_size = 256;
+  Reopen(&options);
+
+  for (int i = 0; i < 1000; i++) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    ASSERT_LEVELDB_OK(Put(buf, std::string(100, 'a' + (i % 26))));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Read everything twice; the cache is smaller than the data.
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 1000; i += 7) {
+      char buf[20];
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_EQ(std::string(100, 'a' + (i % 26)), Get(buf));
+    }
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    ASSERT_EQ(1000, count);
+    delete iter;
+  }
+
+  Close();
+  delete options.block_cache;
+}
+
+TEST_F(DBTest, CacheIndexAndFilterBlocks) {
+  env_->copy_random_reads_ = true;
+  for (int pin = 0; pin < 2; pin++) {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.create_if_missing = true;
+    options.block_cache = NewLRUCache(1 << 20);
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.cache_index_and_filter_blocks = true;
+    options.pin_l0_index_and_filter_blocks = (pin == 1);
+    DestroyAndReopen(&options);
+
+    char buf[20];
+    for (int i = 0; i < 100; i++) {
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_LEVELDB_OK(Put(buf, std::string(100, 'v')));
+    }
+    dbfull()->TEST_CompactMemTable();
+
+    // Opening the new table put its index and filter blocks in the cache.
+    ASSERT_GT(options.block_cache->TotalCharge(), 0);
+    options.block_cache->Prune();
+    if (pin) {
+      ASSERT_GT(options.block_cache->TotalCharge(), 0);
+    } else {
+      ASSERT_EQ(0, options.block_cache->TotalCharge());
+    }
+
+    // Evicted blocks are read back on demand.
+    for (int i = 0; i < 100; i++) {
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_EQ(std::string(100, 'v'), Get(buf));
+    }
+    ASSERT_EQ("NOT_FOUND", Get("missing"));
+    ASSERT_GT(options.block_cache->TotalCharge(), 0);
+
+    // The flush placed the table below level-0, so once it has been read
+    // as a table of that level, its blocks are no longer pinned.
+    ASSERT_EQ(0, NumTableFilesAtLevel(0));
+    options.block_cache->Prune();
+    ASSERT_EQ(0, options.block_cache->TotalCharge());
+
+    Close();
+    delete options.block_cache;
+    delete options.filter_policy;
+  }
+}
+
+TEST_F(DBTest, UnlimitedOpenFilesOpensTablesAtOpen) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.max_open_files = -1;
+  Reopen(&options);
+  for (int t = 0; t < 4; t++) {
+    char buf[20];
+    for (int i = 0; i < 10; i++) {
+      std::snprintf(buf, sizeof(buf), "key%03d", t * 10 + i);
+      ASSERT_LEVELDB_OK(Put(buf, "v"));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+
+  env_->count_random_reads_ = true;
+  Reopen(&options);
+
+  // Every table was opened by DB::Open, so a lookup only reads the one
+  // data block that holds the key.
+  env_->random_read_counter_.Reset();
+  ASSERT_EQ("v", Get("key025"));
+  ASSERT_EQ(1, env_->random_read_counter_.Read());
+
+  // Tables written after the open are kept open too.
+  ASSERT_LEVELDB_OK(Put("key100", "w"));
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  env_->random_read_counter_.Reset();
+  ASSERT_EQ("w", Get("key100"));
+  ASSERT_EQ("v", Get("key000"));
+  ASSERT_EQ(2, env_->random_read_counter_.Read());
+}
+
+TEST_F(DBTest, PersistentCache) {
+  // The persistent cache lives in its own directory, and its reads are
+  // not counted as table reads.
+  const std::string cache_dir = testing::TempDir() + "db_test_pcache";
+  PersistentCache* persistent_cache;
+  ASSERT_LEVELDB_OK(NewFilePersistentCache(Env::Default(), cache_dir, 1 << 20,
+                                           &persistent_cache));
+
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent block cache hits
+  options.persistent_cache = persistent_cache;
+  Reopen(&options);
+
+  char buf[20];
+  for (int i = 0; i < 500; i++) {
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    ASSERT_LEVELDB_OK(Put(buf, std::string(100, 'a' + i % 26)));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  env_->count_random_reads_ = true;
+  Reopen(&options);
+  for (int pass = 0; pass < 2; pass++) {
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < 500; i += 10) {
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_EQ(std::string(100, 'a' + i % 26), Get(buf));
+    }
+    if (pass == 0) {
+      ASSERT_GT(env_->random_read_counter_.Read(), 0);
+    } else {
+      // Every block came from the persistent cache.
+      ASSERT_EQ(0, env_->random_read_counter_.Read());
+    }
+  }
+
+  Close();
+  delete options.block_cache;
+  delete persistent_cache;
+  Env::Default()->RemoveDir(cache_dir);
+}
+
+// A PersistentCache that keeps blocks in memory and can be told to hand
+// out damaged copies of them.
+class DamagingPersistentCache : public PersistentCache {
+ public:
+  DamagingPersistentCache() : damage(false), erased(0), last_id_(0) {}
+
+  Status Insert(const Slice& key, const Slice& data) override {
+    MutexLock l(&mu_);
+    blocks_.insert(std::make_pair(key.ToString(), data.ToString()));
+    return Status::OK();
+  }
+
+  Status Lookup(const Slice& key, std::string* data) override {
+    MutexLock l(&mu_);
+    auto it = blocks_.find(key.ToString());
+    if (it == blocks_.end()) {
+      return Status::NotFound(Slice());
+    }
+    *data = it->second;
+    if (damage.load(std::memory_order_relaxed) && !data->empty()) {
+      (*data)[data->size() - 1] = 0x7f;  // Not a compression type
+    }
+    return Status::OK();
+  }
+
+  void Erase(const Slice& key) override {
+    MutexLock l(&mu_);
+    blocks_.erase(key.ToString());
+    erased++;
+  }
+
+  uint64_t NewId() override {
+    MutexLock l(&mu_);
+    return ++last_id_;
+  }
+
+  std::atomic<bool> damage;
+  int erased;  // Guarded by mu_; read after the DB is closed
+
+ private:
+  port::Mutex mu_;
+  std::map<std::string, std::string> blocks_;
+  uint64_t last_id_;
+};
+
+TEST_F(DBTest, PersistentCacheFallsBackToTable) {
+  DamagingPersistentCache persistent_cache;
+  env_->copy_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent block cache hits
+  options.persistent_cache = &persistent_cache;
+  Reopen(&options);
+
+  char buf[20];
+  for (int i = 0; i < 500; i++) {
+    std::snprintf(buf, sizeof(buf), "key%06d", i);
+    ASSERT_LEVELDB_OK(Put(buf, std::string(100, 'a' + i % 26)));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Blocks that cannot be decoded from the persistent cache are read
+  // from the table file instead, and dropped from the persistent cache.
+  for (int pass = 0; pass < 2; pass++) {
+    persistent_cache.damage.store(pass == 1, std::memory_order_relaxed);
+    for (int i = 0; i < 500; i += 10) {
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_EQ(std::string(100, 'a' + i % 26), Get(buf));
+    }
+  }
+
+  Close();
+  delete options.block_cache;
+  ASSERT_GT(persistent_cache.erased, 0);
+}
+
+TEST_F(DBTest, RowCache) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.row_cache = NewLRUCache(1 << 20);
+  Reopen(&options);
+
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  ASSERT_LEVELDB_OK(Put("bar", "b1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  ASSERT_LEVELDB_OK(Delete("bar"));
+  dbfull()->TEST_CompactMemTable();
+
+  env_->count_random_reads_ = true;
+  Reopen(&options);
+  for (int pass = 0; pass < 2; pass++) {
+    env_->random_read_counter_.Reset();
+    ASSERT_EQ("v2", Get("foo"));
+    ASSERT_EQ("NOT_FOUND", Get("bar"));  // Found as a deletion
+    if (pass == 1) {
+      // Every lookup was answered from the row cache.
+      ASSERT_EQ(0, env_->random_read_counter_.Read());
+    }
+  }
+  ASSERT_GT(options.row_cache->TotalCharge(), 0);
+
+  // Keys that no table holds are not cached.
+  const size_t charge = options.row_cache->TotalCharge();
+  ASSERT_EQ("NOT_FOUND", Get("baz"));
+  ASSERT_EQ(charge, options.row_cache->TotalCharge());
+
+  Close();
+  delete options.row_cache;
+}
+
+TEST_F(DBTest, RowCacheSnapshots) {
+  Options options = CurrentOptions();
+  options.row_cache = NewLRUCache(1 << 20);
+  Reopen(&options);
+
+  ASSERT_LEVELDB_OK(Put("foo", "v1"));
+  const Snapshot* s1 = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(Put("foo", "v2"));
+  const Snapshot* s2 = db_->GetSnapshot();
+  ASSERT_LEVELDB_OK(Delete("foo"));
+  dbfull()->TEST_CompactMemTable();
+
+  // All three entries are in one table; the cached row is the newest.
+  for (int pass = 0; pass < 2; pass++) {
+    ASSERT_EQ("NOT_FOUND", Get("foo"));
+    ASSERT_EQ("v2", Get("foo", s2));
+    ASSERT_EQ("v1", Get("foo", s1));
+  }
+
+  db_->ReleaseSnapshot(s1);
+  db_->ReleaseSnapshot(s2);
+  Close();
+  delete options.row_cache;
+}
+
+TEST_F(DBTest, PinData) {
+  do {
+    // Several blocks worth of data spread over a table and the memtable,
+    // with overwrites and deletions.
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    for (int i = 0; i < 200; i++) {
+      char buf[20];
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      ASSERT_LEVELDB_OK(Put(buf, std::string(500, 'a' + (i % 26))));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 200; i++) {
+      char buf[20];
+      std::snprintf(buf, sizeof(buf), "key%06d", i);
+      if (i % 10 == 3) {
+        ASSERT_LEVELDB_OK(Delete(buf));
+        continue;
+      }
+      if (i % 10 == 7) {
+        ASSERT_LEVELDB_OK(Put(buf, "new"));
+      }
+      keys.push_back(buf);
+      values.push_back(i % 10 == 7 ? "new"
+                                   : std::string(500, 'a' + (i % 26)));
+    }
+
+    ReadOptions options;
+    options.pin_data = true;
+    Iterator* iter = db_->NewIterator(options);
+
+    // Every Slice handed out stays valid until the iterator is deleted.
+    std::vector<Slice> seen_keys;
+    std::vector<Slice> seen_values;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      seen_keys.push_back(iter->key());
+      seen_values.push_back(iter->value());
+    }
+    ASSERT_EQ(keys.size(), seen_keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(keys[i], seen_keys[i].ToString());
+      ASSERT_EQ(values[i], seen_values[i].ToString());
+    }
+
+    seen_keys.clear();
+    seen_values.clear();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      seen_keys.push_back(iter->key());
+      seen_values.push_back(iter->value());
+    }
+    ASSERT_EQ(keys.size(), seen_keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      const size_t j = keys.size() - 1 - i;
+      ASSERT_EQ(keys[j], seen_keys[i].ToString());
+      ASSERT_EQ(values[j], seen_values[i].ToString());
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    delete iter;
+  } while (ChangeOptions());
+}
+
 TEST_F(DBTest, Recover) {
   do {
     ASSERT_LEVELDB_OK(Put("foo", "v1"));
@@ -1028,6 +1670,42 @@ static std::string Key(int i) {
   return std::string(buf);
 }
 
+TEST_F(DBTest, DirectIOForCompaction) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.use_direct_io_for_compaction = true;
+  Reopen(&options);
+
+  // Two overlapping tables, so that there is something to compact.
+  Random rnd(301);
+  std::vector<std::string> values(200);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 200; i++) {
+      values[i] = RandomString(&rnd, 3000);
+      ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+    }
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ(0, env_->direct_file_counter_.Read());
+
+  // Compactions read their inputs and write their outputs directly.
+  dbfull()->CompactRange(nullptr, nullptr);
+  ASSERT_GT(env_->direct_file_counter_.Read(), 0);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  // With direct reads, lookups read directly too.
+  options.use_direct_io_for_compaction = false;
+  options.use_direct_reads = true;
+  Reopen(&options);
+  env_->direct_file_counter_.Reset();
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  ASSERT_GT(env_->direct_file_counter_.Read(), 0);
+}
+
 TEST_F(DBTest, MinorCompactionsHappen) {
   Options options = CurrentOptions();
   options.write_buffer_size = 10000;
@@ -1122,6 +1800,151 @@ TEST_F(DBTest, RepeatedWritesToSameKey) {
   }
 }
 
+TEST_F(DBTest, ParallelCompactions) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 100000000;  // Large write buffer
+  options.max_background_compactions = 4;
+  Reopen(&options);
+
+  // Three small tables with disjoint key ranges.  The first memtable
+  // flushes go to level-2, since nothing overlaps them.
+  const char* kPrefixes[] = {"a", "b", "c"};
+  for (const char* prefix : kPrefixes) {
+    ASSERT_LEVELDB_OK(Put(std::string(prefix) + "1", "v"));
+    ASSERT_LEVELDB_OK(Put(std::string(prefix) + "9", "v"));
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ("0,0,3", FilesPerLevel());
+
+  // Each of these tables overlaps only one table in level-2, so it goes
+  // to level-1.  Together they put level-1 over its size limit, and each
+  // can be compacted independently of the others.
+  env_->hold_background_work_.store(true, std::memory_order_release);
+  Random rnd(301);
+  const int kNumKeys = 4000;
+  std::map<std::string, std::string> values;
+  char key[20];
+  for (const char* prefix : kPrefixes) {
+    for (int i = 0; i < kNumKeys; i++) {
+      std::snprintf(key, sizeof(key), "%s5_%06d", prefix, i);
+      values[key] = RandomString(&rnd, 1000);
+      ASSERT_LEVELDB_OK(Put(key, values[key]));
+    }
+    ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  }
+  ASSERT_EQ("0,3,3", FilesPerLevel());
+
+  // All three compactions were picked at once, and are released together.
+  const int num_picked = dbfull()->TEST_NumPickedCompactions();
+  env_->ReleaseBackgroundWork();
+  ASSERT_EQ(3, num_picked);
+  for (int i = 0; i < 1000; i++) {
+    if (NumTableFilesAtLevel(1) == 0) {
+      break;
+    }
+    DelayMilliseconds(10);
+  }
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_EQ(0, dbfull()->TEST_NumPickedCompactions());
+  for (const auto& kv : values) {
+    ASSERT_EQ(kv.second, Get(kv.first));
+  }
+
+  Reopen(&options);
+  for (const auto& kv : values) {
+    ASSERT_EQ(kv.second, Get(kv.first));
+  }
+}
+
+TEST_F(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000000;  // Large write buffer
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // Write about 1MB, then delete and overwrite some of it.
+  Random rnd(301);
+  const int kNumKeys = 1000;
+  std::vector<std::string> values(kNumKeys);
+  for (int i = 0; i < kNumKeys; i++) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  for (int i = 0; i < kNumKeys; i += 7) {
+    ASSERT_LEVELDB_OK(Delete(Key(i)));
+    values[i] = "NOT_FOUND";
+  }
+  for (int i = 3; i < kNumKeys; i += 11) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+
+  // The compaction is split into shards, each with its own output,
+  // although all of the data would fit in one table.
+  dbfull()->TEST_CompactRange(0, nullptr, nullptr);
+  dbfull()->TEST_CompactRange(1, nullptr, nullptr);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_EQ(0, NumTableFilesAtLevel(1));
+  ASSERT_GT(NumTableFilesAtLevel(2), 1);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  // Every live key is returned once.
+  int expected = 0;
+  for (int i = 0; i < kNumKeys; i++) {
+    expected += (values[i] != "NOT_FOUND");
+  }
+  std::string last;
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_LT(last, iter->key().ToString());
+    last = iter->key().ToString();
+    count++;
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(expected, count);
+}
+
+TEST_F(DBTest, FlushWhileCompactionsAreHeld) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.write_buffer_size = 100000;  // Small write buffer
+  Reopen(&options);
+
+  // Memtables are still flushed while no compaction can run, so writes
+  // do not wait for the compactions to get a thread.
+  env_->hold_background_work_.store(true, std::memory_order_release);
+  // The same keys are written repeatedly, so that the tables overlap
+  // and stay in level-0.
+  Random rnd(301);
+  const int kNumKeys = 10;
+  std::vector<std::string> values(kNumKeys);
+  for (int i = 0; i < 8 * kNumKeys; i++) {
+    values[i % kNumKeys] = RandomString(&rnd, 10000);
+    ASSERT_LEVELDB_OK(Put(Key(i % kNumKeys), values[i % kNumKeys]));
+  }
+  ASSERT_LEVELDB_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_GE(NumTableFilesAtLevel(0), config::kL0_CompactionTrigger);
+
+  env_->ReleaseBackgroundWork();
+  for (int i = 0; i < 1000; i++) {
+    if (NumTableFilesAtLevel(0) < config::kL0_CompactionTrigger) {
+      break;
+    }
+    DelayMilliseconds(10);
+  }
+  ASSERT_LT(NumTableFilesAtLevel(0), config::kL0_CompactionTrigger);
+  for (int i = 0; i < kNumKeys; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
 TEST_F(DBTest, SparseMerge) {
   Options options = CurrentOptions();
   options.compression = kNoCompression;
@@ -1172,6 +1995,34 @@ static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   return result;
 }
 
+TEST_F(DBTest, BlockSizePerLevel) {
+  Options options = CurrentOptions();
+  options.compression = kNoCompression;
+  options.block_size_per_level = {1024, 1024, 256 * 1024, 1024};
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values(100);
+  for (int i = 0; i < 100; i++) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_LEVELDB_OK(Put(Key(i), values[i]));
+  }
+
+  // The memtable is flushed to level 2, whose tables hold everything in
+  // a single block, so a range within the table has no size.
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,0,1", FilesPerLevel());
+  ASSERT_EQ(0, Size(Key(10), Key(20)));
+
+  // Compacting it into level 3 writes small blocks.
+  dbfull()->TEST_CompactRange(2, nullptr, nullptr);
+  ASSERT_EQ("0,0,0,1", FilesPerLevel());
+  ASSERT_TRUE(Between(Size(Key(10), Key(20)), 9000, 12000));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
 TEST_F(DBTest, ApproximateSizes) {
   do {
     Options options = CurrentOptions();
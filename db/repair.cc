@@ -203,7 +203,10 @@ class Repairer {
     FileMetaData meta;
     meta.number = next_file_number_++;
     Iterator* iter = mem->NewIterator();
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    Options table_options = options_;
+    table_options.zstd_max_dictionary_size = 0;  // As for memtable flushes
+    status =
+        BuildTable(dbname_, env_, table_options, table_cache_, iter, &meta);
     delete iter;
     mem->Unref();
     mem = nullptr;
@@ -229,7 +232,7 @@ class Repairer {
     // on checksum verification.
     ReadOptions r;
     r.verify_checksums = options_.paranoid_checks;
-    return table_cache_->NewIterator(r, meta.number, meta.file_size);
+    return table_cache_->NewIterator(r, meta.number, meta.file_size, -1);
   }
 
   void ScanTable(uint64_t number) {
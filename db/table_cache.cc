@@ -14,6 +14,7 @@ namespace leveldb {
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  bool pinned;  // Whether the table pins its index and filter blocks
 };
 
 static void DeleteEntry(const Slice& key, void* value) {
@@ -29,35 +30,62 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+static void DeleteTableAndFile(void* arg1, void* arg2) {
+  delete reinterpret_cast<Table*>(arg1);
+  delete reinterpret_cast<RandomAccessFile*>(arg2);
+}
+
 TableCache::TableCache(const std::string& dbname, const Options& options,
                        int entries)
     : env_(options.env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {}
+      cache_(NewLRUCache(entries)),
+      row_cache_id_(options.row_cache ? options.row_cache->NewId() : 0) {}
 
 TableCache::~TableCache() { delete cache_; }
 
+Status TableCache::OpenFile(uint64_t file_number, bool direct,
+                            RandomAccessFile** file) {
+  std::string fname = TableFileName(dbname_, file_number);
+  Status s = direct ? env_->NewDirectRandomAccessFile(fname, file)
+                    : env_->NewRandomAccessFile(fname, file);
+  if (!s.ok()) {
+    std::string old_fname = SSTTableFileName(dbname_, file_number);
+    Status old_s = direct ? env_->NewDirectRandomAccessFile(old_fname, file)
+                          : env_->NewRandomAccessFile(old_fname, file);
+    if (old_s.ok()) {
+      s = Status::OK();
+    }
+  }
+  return s;
+}
+
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             int level, Cache::Handle** handle) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   Slice key(buf, sizeof(buf));
   *handle = cache_->Lookup(key);
+  if (*handle != nullptr && level > 0 &&
+      reinterpret_cast<TableAndFile*>(cache_->Value(*handle))->pinned) {
+    // The table was opened in level-0 and has since been moved to a
+    // deeper level, so reopen it without pinned blocks.  Readers that
+    // still hold the old table keep it until they release it.
+    cache_->Release(*handle);
+    cache_->Erase(key);
+    *handle = cache_->Lookup(key);  // Another reader may have reopened it
+  }
+  bool pin = false;
   if (*handle == nullptr) {
-    std::string fname = TableFileName(dbname_, file_number);
     RandomAccessFile* file = nullptr;
     Table* table = nullptr;
-    s = env_->NewRandomAccessFile(fname, &file);
-    if (!s.ok()) {
-      std::string old_fname = SSTTableFileName(dbname_, file_number);
-      if (env_->NewRandomAccessFile(old_fname, &file).ok()) {
-        s = Status::OK();
-      }
-    }
+    s = OpenFile(file_number, options_.use_direct_reads, &file);
     if (s.ok()) {
-      s = Table::Open(options_, file, file_size, &table);
+      file->Hint(RandomAccessFile::kRandom);
+      pin = options_.pin_l0_index_and_filter_blocks && level == 0;
+      s = Table::Open(options_, file, file_size, pin, &table);
     }
 
     if (!s.ok()) {
@@ -69,6 +97,7 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
+      tf->pinned = pin;
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
@@ -77,13 +106,13 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
 
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number, uint64_t file_size,
-                                  Table** tableptr) {
+                                  int level, Table** tableptr) {
   if (tableptr != nullptr) {
     *tableptr = nullptr;
   }
 
   Cache::Handle* handle = nullptr;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (!s.ok()) {
     return NewErrorIterator(s);
   }
@@ -97,20 +126,159 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+Iterator* TableCache::NewDirectIterator(const ReadOptions& options,
+                                        uint64_t file_number,
+                                        uint64_t file_size) {
+  RandomAccessFile* file = nullptr;
+  Status s = OpenFile(file_number, /*direct=*/true, &file);
+  Table* table = nullptr;
+  if (s.ok()) {
+    // Blocks of this private table are never found in the caches, which
+    // are keyed by table, so do not look for them there.
+    Options table_options = options_;
+    table_options.block_cache = nullptr;
+    table_options.compressed_block_cache = nullptr;
+    table_options.persistent_cache = nullptr;
+    s = Table::Open(table_options, file, file_size, &table);
+  }
+  if (!s.ok()) {
+    delete file;
+    return NewErrorIterator(s);
+  }
+
+  Iterator* result = table->NewIterator(options);
+  result->RegisterCleanup(&DeleteTableAndFile, table, file);
+  return result;
+}
+
 Status TableCache::Get(const ReadOptions& options, uint64_t file_number,
-                       uint64_t file_size, const Slice& k, void* arg,
+                       uint64_t file_size, int level, const Slice& k,
+                       void* arg,
                        void (*handle_result)(void*, const Slice&,
                                              const Slice&)) {
   Cache::Handle* handle = nullptr;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, handle_result);
+    s = GetFromTable(options, file_number, t, k, arg, handle_result);
     cache_->Release(handle);
   }
   return s;
 }
 
+Status TableCache::Get(const ReadOptions& options, uint64_t file_number,
+                       Table* table, const Slice& k, void* arg,
+                       void (*handle_result)(void*, const Slice&,
+                                             const Slice&)) {
+  return GetFromTable(options, file_number, table, k, arg, handle_result);
+}
+
+// The row cache maps (row_cache_id, file number, user key) to the newest
+// entry for the user key in the file, encoded as the entry's internal key
+// length (varint32), internal key and value.  Files are immutable, so
+// entries never go stale, and they do not depend on the snapshot being
+// read.  Files without an entry for the user key are not recorded, since
+// a miss probes many files (e.g. every level-0 file) and recording them
+// all would evict the rows that are found.
+static void DeleteRow(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+static void SaveRow(void* arg, const Slice& ikey, const Slice& value) {
+  std::string* row = reinterpret_cast<std::string*>(arg);
+  PutLengthPrefixedSlice(row, ikey);
+  row->append(value.data(), value.size());
+}
+
+Status TableCache::GetFromTable(const ReadOptions& options,
+                                uint64_t file_number, Table* table,
+                                const Slice& k, void* arg,
+                                void (*handle_result)(void*, const Slice&,
+                                                      const Slice&)) {
+  Cache* row_cache = options_.row_cache;
+  if (row_cache == nullptr) {
+    return table->InternalGet(options, k, arg, handle_result);
+  }
+
+  const Slice user_key = ExtractUserKey(k);
+  std::string row_key;
+  PutFixed64(&row_key, row_cache_id_);
+  PutFixed64(&row_key, file_number);
+  row_key.append(user_key.data(), user_key.size());
+
+  Cache::Handle* handle = row_cache->Lookup(row_key);
+  std::string* row;
+  if (handle != nullptr) {
+    row = reinterpret_cast<std::string*>(row_cache->Value(handle));
+  } else {
+    // Find the newest entry for the user key, which answers reads at any
+    // snapshot that can see it.
+    row = new std::string;
+    InternalKey newest(user_key, kMaxSequenceNumber, kValueTypeForSeek);
+    Status s = table->InternalGet(options, newest.Encode(), row, &SaveRow);
+    if (!s.ok()) {
+      delete row;
+      return s;
+    }
+    const Comparator* ucmp =
+        reinterpret_cast<const InternalKeyComparator*>(options_.comparator)
+            ->user_comparator();
+    Slice input(*row);
+    Slice found_key;
+    if (GetLengthPrefixedSlice(&input, &found_key) &&
+        ucmp->Compare(ExtractUserKey(found_key), user_key) != 0) {
+      row->clear();  // The seek landed on a later user key
+    }
+    if (options.fill_cache && !row->empty()) {
+      handle = row_cache->Insert(
+          row_key, row, row_key.size() + sizeof(std::string) + row->capacity(),
+          &DeleteRow);
+    }
+  }
+
+  Status s;
+  Slice input(*row);
+  Slice found_key;
+  if (GetLengthPrefixedSlice(&input, &found_key)) {
+    const SequenceNumber snapshot = DecodeFixed64(k.data() + k.size() - 8) >> 8;
+    const SequenceNumber found =
+        DecodeFixed64(found_key.data() + found_key.size() - 8) >> 8;
+    if (found <= snapshot) {
+      (*handle_result)(arg, found_key, input);
+    } else {
+      // The newest entry is not visible to this read; look for an older
+      // one in the table.
+      s = table->InternalGet(options, k, arg, handle_result);
+    }
+  }
+  if (handle != nullptr) {
+    row_cache->Release(handle);
+  } else {
+    delete row;
+  }
+  return s;
+}
+
+Status TableCache::Pin(uint64_t file_number, uint64_t file_size, int level,
+                       Table** table, Cache::Handle** handle) {
+  Status s = FindTable(file_number, file_size, level, handle);
+  if (s.ok()) {
+    *table = reinterpret_cast<TableAndFile*>(cache_->Value(*handle))->table;
+  }
+  return s;
+}
+
+void TableCache::Unpin(Cache::Handle* handle) { cache_->Release(handle); }
+
+void TableCache::Hint(uint64_t file_number, uint64_t file_size, int level,
+                      RandomAccessFile::AccessPattern pattern) {
+  Cache::Handle* handle = nullptr;
+  if (FindTable(file_number, file_size, level, &handle).ok()) {
+    reinterpret_cast<TableAndFile*>(cache_->Value(handle))->file->Hint(pattern);
+    cache_->Release(handle);
+  }
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
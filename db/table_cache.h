@@ -12,44 +12,88 @@
 
 #include "db/dbformat.h"
 #include "leveldb/cache.h"
+#include "leveldb/env.h"
 #include "leveldb/table.h"
 #include "port/port.h"
 
 namespace leveldb {
 
-class Env;
-
 class TableCache {
  public:
   TableCache(const std::string& dbname, const Options& options, int entries);
   ~TableCache();
 
   // Return an iterator for the specified file number (the corresponding
-  // file length must be exactly "file_size" bytes).  If "tableptr" is
+  // file length must be exactly "file_size" bytes).  "level" is the level
+  // of the file, or -1 if it is not known, and decides whether the index
+  // and filter blocks of the table are pinned.  A table that was opened
+  // in level-0 is reopened when it is found in a deeper level, so that
+  // files moved out of level-0 are unpinned.  If "tableptr" is
   // non-null, also sets "*tableptr" to point to the Table object
   // underlying the returned iterator, or to nullptr if no Table object
   // underlies the returned iterator.  The returned "*tableptr" object is owned
   // by the cache and should not be deleted, and is valid for as long as the
   // returned iterator is live.
   Iterator* NewIterator(const ReadOptions& options, uint64_t file_number,
-                        uint64_t file_size, Table** tableptr = nullptr);
+                        uint64_t file_size, int level,
+                        Table** tableptr = nullptr);
+
+  // Like NewIterator(), but reads the file through a handle returned by
+  // Env::NewDirectRandomAccessFile() that is private to the iterator and
+  // closed with it.  Meant for compaction inputs, which are read once.
+  Iterator* NewDirectIterator(const ReadOptions& options, uint64_t file_number,
+                              uint64_t file_size);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  "level" is as
+  // for NewIterator().
   Status Get(const ReadOptions& options, uint64_t file_number,
-             uint64_t file_size, const Slice& k, void* arg,
+             uint64_t file_size, int level, const Slice& k, void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Like Get() above, but for a table that the caller keeps open.
+  Status Get(const ReadOptions& options, uint64_t file_number, Table* table,
+             const Slice& k, void* arg,
+             void (*handle_result)(void*, const Slice&, const Slice&));
+
+  // Open the table for the specified file number and keep it open until
+  // "*handle" is passed to Unpin().  On success, sets "*table" to the
+  // table, which is valid until then.  "level" is as for NewIterator().
+  Status Pin(uint64_t file_number, uint64_t file_size, int level,
+             Table** table, Cache::Handle** handle);
+
+  // Release a handle returned by Pin().
+  void Unpin(Cache::Handle* handle);
+
+  // Advise that the specified file will be read with "pattern", opening
+  // it if needed.  Tables are opened for the random reads of point
+  // lookups.  "level" is as for NewIterator().
+  void Hint(uint64_t file_number, uint64_t file_size, int level,
+            RandomAccessFile::AccessPattern pattern);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
  private:
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  // Opens the table file for the specified file number, bypassing the
+  // page cache if "direct" is true.
+  Status OpenFile(uint64_t file_number, bool direct, RandomAccessFile** file);
+
+  Status FindTable(uint64_t file_number, uint64_t file_size, int level,
+                   Cache::Handle**);
+
+  // Implements Get() for an open table, answering from the row cache
+  // when possible.
+  Status GetFromTable(const ReadOptions& options, uint64_t file_number,
+                      Table* table, const Slice& k, void* arg,
+                      void (*handle_result)(void*, const Slice&,
+                                            const Slice&));
 
   Env* const env_;
   const std::string dbname_;
   const Options& options_;
   Cache* cache_;
+  const uint64_t row_cache_id_;  // Prefix of this DB's keys in row_cache
 };
 
 }  // namespace leveldb
@@ -10,13 +10,21 @@
 #include <vector>
 
 #include "db/dbformat.h"
+#include "leveldb/cache.h"
 
 namespace leveldb {
 
+class Table;
 class VersionSet;
 
 struct FileMetaData {
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) {}
+  FileMetaData()
+      : refs(0),
+        allowed_seeks(1 << 30),
+        file_size(0),
+        table(nullptr),
+        table_handle(nullptr),
+        being_compacted(false) {}
 
   int refs;
   int allowed_seeks;  // Seeks allowed until compaction
@@ -24,6 +32,16 @@ struct FileMetaData {
   uint64_t file_size;    // File size in bytes
   InternalKey smallest;  // Smallest internal key served by table
   InternalKey largest;   // Largest internal key served by table
+
+  // If max_open_files is -1, the open table and the TableCache handle
+  // that keeps it open.  Set before the file becomes visible in a
+  // Version and never changed afterwards.
+  Table* table;
+  Cache::Handle* table_handle;
+
+  // True while the file is an input of a running compaction.  Guarded by
+  // the DB mutex.
+  bool being_compacted;
 };
 
 class VersionEdit {
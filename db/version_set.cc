@@ -18,6 +18,7 @@
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 #include "util/logging.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
@@ -78,6 +79,9 @@ Version::~Version() {
       assert(f->refs > 0);
       f->refs--;
       if (f->refs <= 0) {
+        if (f->table_handle != nullptr) {
+          vset_->table_cache_->Unpin(f->table_handle);
+        }
         delete f;
       }
     }
@@ -160,19 +164,32 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 // is the largest key that occurs in the file, and value() is an
 // 16-byte value containing the file number and file size, both
 // encoded using EncodeFixed64.
+//
+// Only the files in [first, limit) of the level are visible; the
+// iterator behaves as if the level contained no other files.
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
                        const std::vector<FileMetaData*>* flist)
-      : icmp_(icmp), flist_(flist), index_(flist->size()) {  // Marks as invalid
-  }
-  bool Valid() const override { return index_ < flist_->size(); }
+      : LevelFileNumIterator(icmp, flist, 0, flist->size()) {}
+  LevelFileNumIterator(const InternalKeyComparator& icmp,
+                       const std::vector<FileMetaData*>* flist, uint32_t first,
+                       uint32_t limit)
+      : icmp_(icmp),
+        flist_(flist),
+        first_(first),
+        limit_(limit),
+        index_(limit) {  // Marks as invalid
+    assert(first_ <= limit_ && limit_ <= flist_->size());
+  }
+  bool Valid() const override { return index_ < limit_; }
   void Seek(const Slice& target) override {
-    index_ = FindFile(icmp_, *flist_, target);
+    index_ = std::max<uint32_t>(FindFile(icmp_, *flist_, target), first_);
+    if (index_ > limit_) index_ = limit_;
   }
-  void SeekToFirst() override { index_ = 0; }
+  void SeekToFirst() override { index_ = first_; }
   void SeekToLast() override {
-    index_ = flist_->empty() ? 0 : flist_->size() - 1;
+    index_ = (first_ == limit_) ? limit_ : limit_ - 1;
   }
   void Next() override {
     assert(Valid());
@@ -180,8 +197,8 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   void Prev() override {
     assert(Valid());
-    if (index_ == 0) {
-      index_ = flist_->size();  // Marks as invalid
+    if (index_ == first_) {
+      index_ = limit_;  // Marks as invalid
     } else {
       index_--;
     }
@@ -192,8 +209,10 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   Slice value() const override {
     assert(Valid());
-    EncodeFixed64(value_buf_, (*flist_)[index_]->number);
-    EncodeFixed64(value_buf_ + 8, (*flist_)[index_]->file_size);
+    const FileMetaData* f = (*flist_)[index_];
+    EncodeFixed64(value_buf_, f->number);
+    EncodeFixed64(value_buf_ + 8, f->file_size);
+    EncodeFixed64(value_buf_ + 16, reinterpret_cast<uintptr_t>(f->table));
     return Slice(value_buf_, sizeof(value_buf_));
   }
   Status status() const override { return Status::OK(); }
@@ -201,46 +220,164 @@ class Version::LevelFileNumIterator : public Iterator {
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const uint32_t first_;
+  const uint32_t limit_;
   uint32_t index_;
 
-  // Backing store for value().  Holds the file number and size.
-  mutable char value_buf_[16];
+  // Backing store for value().  Holds the file number and size, and the
+  // Table that is kept open for the file, if any.
+  mutable char value_buf_[24];
 };
 
+// Return an iterator over the table of "f", which is in "level".  Tables
+// that are kept open in "f" are read directly, the rest through "cache".
+static Iterator* NewFileIterator(TableCache* cache, const ReadOptions& options,
+                                 const FileMetaData* f, int level,
+                                 Table** tableptr = nullptr) {
+  if (f->table != nullptr) {
+    if (tableptr != nullptr) {
+      *tableptr = f->table;
+    }
+    return f->table->NewIterator(options);
+  }
+  return cache->NewIterator(options, f->number, f->file_size, level, tableptr);
+}
+
 static Iterator* GetFileIterator(void* arg, const ReadOptions& options,
                                  const Slice& file_value) {
   TableCache* cache = reinterpret_cast<TableCache*>(arg);
-  if (file_value.size() != 16) {
+  if (file_value.size() != 24) {
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
-  } else {
-    return cache->NewIterator(options, DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
   }
+  Table* table = reinterpret_cast<Table*>(
+      static_cast<uintptr_t>(DecodeFixed64(file_value.data() + 16)));
+  if (table != nullptr) {
+    return table->NewIterator(options);
+  }
+  // Only used for files above level 0, which are never pinned.  Any such
+  // level will do to unpin a table that was opened in level-0.
+  return cache->NewIterator(options, DecodeFixed64(file_value.data()),
+                            DecodeFixed64(file_value.data() + 8), 1);
+}
+
+// Like GetFileIterator(), but reads the file with O_DIRECT through a
+// handle private to the iterator.
+static Iterator* GetDirectFileIterator(void* arg, const ReadOptions& options,
+                                       const Slice& file_value) {
+  TableCache* cache = reinterpret_cast<TableCache*>(arg);
+  if (file_value.size() != 24) {
+    return NewErrorIterator(
+        Status::Corruption("FileReader invoked with unexpected value"));
+  }
+  return cache->NewDirectIterator(options, DecodeFixed64(file_value.data()),
+                                  DecodeFixed64(file_value.data() + 8));
+}
+
+// Tables order their keys with the internal key comparator, so the
+// iterators below a Version are given the user key upper bound of
+// "options" as the first internal key with that user key, stored in
+// *upper.
+static ReadOptions TableReadOptions(const ReadOptions& options,
+                                    std::string* upper, Slice* upper_slice) {
+  ReadOptions result = options;
+  result.iterate_lower_bound = nullptr;
+  if (options.iterate_upper_bound != nullptr) {
+    AppendInternalKey(upper,
+                      ParsedInternalKey(*options.iterate_upper_bound,
+                                        kMaxSequenceNumber, kValueTypeForSeek));
+    *upper_slice = *upper;
+    result.iterate_upper_bound = upper_slice;
+  }
+  return result;
 }
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
+  // Restrict the level to the files that may hold keys inside the
+  // iteration bounds so that files outside them are never opened.
+  const std::vector<FileMetaData*>& files = files_[level];
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  uint32_t first = 0;
+  uint32_t limit = files.size();
+  if (options.iterate_lower_bound != nullptr) {
+    InternalKey lower(*options.iterate_lower_bound, kMaxSequenceNumber,
+                      kValueTypeForSeek);
+    first = FindFile(vset_->icmp_, files, lower.Encode());
+  }
+  if (options.iterate_upper_bound != nullptr) {
+    // Files are sorted and disjoint, so binary search for the first
+    // file that starts at or after the (exclusive) upper bound.
+    uint32_t left = first;
+    while (left < limit) {
+      uint32_t mid = (left + limit) / 2;
+      if (ucmp->Compare(files[mid]->smallest.user_key(),
+                        *options.iterate_upper_bound) < 0) {
+        left = mid + 1;
+      } else {
+        limit = mid;
+      }
+    }
+  }
+  if (first > limit) first = limit;
+  std::string upper;
+  Slice upper_slice;
   return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]), &GetFileIterator,
-      vset_->table_cache_, options);
+      new LevelFileNumIterator(vset_->icmp_, &files, first, limit),
+      &GetFileIterator, vset_->table_cache_, &vset_->icmp_,
+      TableReadOptions(options, &upper, &upper_slice));
+}
+
+// Returns true iff "f" may hold user keys inside the iteration bounds
+// of "options".
+static bool FileInIterateBounds(const Comparator* ucmp,
+                                const ReadOptions& options,
+                                const FileMetaData* f) {
+  if (options.iterate_lower_bound != nullptr &&
+      ucmp->Compare(f->largest.user_key(), *options.iterate_lower_bound) < 0) {
+    return false;
+  }
+  if (options.iterate_upper_bound != nullptr &&
+      ucmp->Compare(f->smallest.user_key(), *options.iterate_upper_bound) >=
+          0) {
+    return false;
+  }
+  return true;
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
   // Merge all level zero files together since they may overlap
+  std::string upper;
+  Slice upper_slice;
+  const ReadOptions table_options =
+      TableReadOptions(options, &upper, &upper_slice);
   for (size_t i = 0; i < files_[0].size(); i++) {
-    iters->push_back(vset_->table_cache_->NewIterator(
-        options, files_[0][i]->number, files_[0][i]->file_size));
+    if (!FileInIterateBounds(ucmp, options, files_[0][i])) {
+      continue;
+    }
+    iters->push_back(
+        NewFileIterator(vset_->table_cache_, table_options, files_[0][i], 0));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
   // walks through the non-overlapping files in the level, opening them
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
-    if (!files_[level].empty()) {
-      iters->push_back(NewConcatenatingIterator(options, level));
+    if (files_[level].empty()) {
+      continue;
+    }
+    if (options.iterate_lower_bound != nullptr ||
+        options.iterate_upper_bound != nullptr) {
+      if (!SomeFileOverlapsRange(vset_->icmp_, true, files_[level],
+                                 options.iterate_lower_bound,
+                                 options.iterate_upper_bound)) {
+        continue;
+      }
     }
+    iters->push_back(NewConcatenatingIterator(options, level));
   }
 }
 
@@ -351,9 +488,15 @@ Status Version::Get(const ReadOptions& options, const LookupKey& k,
       state->last_file_read = f;
       state->last_file_read_level = level;
 
-      state->s = state->vset->table_cache_->Get(*state->options, f->number,
-                                                f->file_size, state->ikey,
-                                                &state->saver, SaveValue);
+      TableCache* table_cache = state->vset->table_cache_;
+      if (f->table != nullptr) {
+        state->s = table_cache->Get(*state->options, f->number, f->table,
+                                    state->ikey, &state->saver, SaveValue);
+      } else {
+        state->s = table_cache->Get(*state->options, f->number, f->file_size,
+                                    level, state->ikey, &state->saver,
+                                    SaveValue);
+      }
       if (!state->s.ok()) {
         state->found = true;
         return false;
@@ -746,7 +889,8 @@ VersionSet::VersionSet(const std::string& dbname, const Options* options,
       descriptor_file_(nullptr),
       descriptor_log_(nullptr),
       dummy_versions_(this),
-      current_(nullptr) {
+      current_(nullptr),
+      compactions_in_progress_(0) {
   AppendVersion(new Version(this));
 }
 
@@ -797,6 +941,18 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
   Finalize(v);
 
+  // Files that only "v" refers to are the ones added by "edit".
+  std::vector<std::pair<int, FileMetaData*>> new_files;
+  if (options_->max_open_files == -1) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      for (FileMetaData* f : v->files_[level]) {
+        if (f->refs == 1 && f->table == nullptr) {
+          new_files.push_back(std::make_pair(level, f));
+        }
+      }
+    }
+  }
+
   // Initialize new descriptor log file if necessary by creating
   // a temporary file that contains a snapshot of the current version.
   std::string new_manifest_file;
@@ -818,6 +974,10 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   {
     mu->Unlock();
 
+    // The new files were just written and verified, so they are usually
+    // still open in the table cache, and there are few of them.
+    OpenTables(new_files, /*parallel=*/false);
+
     // Write new record to MANIFEST log
     if (s.ok()) {
       std::string record;
@@ -968,6 +1128,15 @@ Status VersionSet::Recover(bool* save_manifest) {
     builder.SaveTo(v);
     // Install recovered version
     Finalize(v);
+    if (options_->max_open_files == -1) {
+      std::vector<std::pair<int, FileMetaData*>> files;
+      for (int level = 0; level < config::kNumLevels; level++) {
+        for (FileMetaData* f : v->files_[level]) {
+          files.push_back(std::make_pair(level, f));
+        }
+      }
+      OpenTables(files, /*parallel=*/true);
+    }
     AppendVersion(v);
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
@@ -1023,34 +1192,87 @@ void VersionSet::MarkFileNumberUsed(uint64_t number) {
   }
 }
 
+namespace {
+
+struct OpenTableWork {
+  TableCache* table_cache;
+  Logger* info_log;
+  int level;
+  FileMetaData* file;
+};
+
+void OpenTableWorkItem(void* arg) {
+  OpenTableWork* work = reinterpret_cast<OpenTableWork*>(arg);
+  FileMetaData* f = work->file;
+  Status s = work->table_cache->Pin(f->number, f->file_size, work->level,
+                                    &f->table, &f->table_handle);
+  if (!s.ok()) {
+    // Reads of the file go through the table cache instead, and report
+    // the error if it persists.
+    f->table = nullptr;
+    f->table_handle = nullptr;
+    Log(work->info_log, "Opening table #%llu: %s\n",
+        static_cast<unsigned long long>(f->number), s.ToString().c_str());
+  }
+}
+
+}  // namespace
+
+void VersionSet::OpenTables(
+    const std::vector<std::pair<int, FileMetaData*>>& files, bool parallel) {
+  // Opening a table reads its footer, index and filter, so a large DB
+  // opens much faster with several reads in flight.
+  static const int kMaxOpenThreads = 16;
+  std::vector<OpenTableWork> work(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    work[i].table_cache = table_cache_;
+    work[i].info_log = options_->info_log;
+    work[i].level = files[i].first;
+    work[i].file = files[i].second;
+  }
+  if (!parallel || files.size() <= 1) {
+    for (size_t i = 0; i < work.size(); i++) {
+      OpenTableWorkItem(&work[i]);
+    }
+    return;
+  }
+  ThreadPool pool(std::min<int>(kMaxOpenThreads, files.size()));
+  for (size_t i = 0; i < work.size(); i++) {
+    pool.Schedule(&OpenTableWorkItem, &work[i]);
+  }
+  // The pool's destructor waits for all work items.
+}
+
+double VersionSet::LevelScore(Version* v, int level) const {
+  if (level == 0) {
+    // We treat level-0 specially by bounding the number of files
+    // instead of number of bytes for two reasons:
+    //
+    // (1) With larger write-buffer sizes, it is nice not to do too
+    // many level-0 compactions.
+    //
+    // (2) The files in level-0 are merged on every read and
+    // therefore we wish to avoid too many files when the individual
+    // file size is small (perhaps because of a small write-buffer
+    // setting, or very high compression ratios, or lots of
+    // overwrites/deletions).
+    return v->files_[level].size() /
+           static_cast<double>(config::kL0_CompactionTrigger);
+  } else {
+    // Compute the ratio of current size to size limit.
+    const uint64_t level_bytes = TotalFileSize(v->files_[level]);
+    return static_cast<double>(level_bytes) /
+           MaxBytesForLevel(options_, level);
+  }
+}
+
 void VersionSet::Finalize(Version* v) {
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
 
   for (int level = 0; level < config::kNumLevels - 1; level++) {
-    double score;
-    if (level == 0) {
-      // We treat level-0 specially by bounding the number of files
-      // instead of number of bytes for two reasons:
-      //
-      // (1) With larger write-buffer sizes, it is nice not to do too
-      // many level-0 compactions.
-      //
-      // (2) The files in level-0 are merged on every read and
-      // therefore we wish to avoid too many files when the individual
-      // file size is small (perhaps because of a small write-buffer
-      // setting, or very high compression ratios, or lots of
-      // overwrites/deletions).
-      score = v->files_[level].size() /
-              static_cast<double>(config::kL0_CompactionTrigger);
-    } else {
-      // Compute the ratio of current size to size limit.
-      const uint64_t level_bytes = TotalFileSize(v->files_[level]);
-      score =
-          static_cast<double>(level_bytes) / MaxBytesForLevel(options_, level);
-    }
-
+    const double score = LevelScore(v, level);
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -1129,8 +1351,8 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
         // "ikey" falls in the range for this table.  Add the
         // approximate offset of "ikey" within the table.
         Table* tableptr;
-        Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
+        Iterator* iter = NewFileIterator(table_cache_, ReadOptions(),
+                                         files[i], level, &tableptr);
         if (tableptr != nullptr) {
           result += tableptr->ApproximateOffsetOf(ikey.Encode());
         }
@@ -1141,6 +1363,174 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
   return result;
 }
 
+uint64_t VersionSet::ApproximateOffsetInFiles(
+    const std::vector<FileMetaData*>& files, const InternalKey& ikey) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
+      result += files[i]->file_size;
+    } else if (icmp_.Compare(files[i]->smallest, ikey) <= 0) {
+      Table* tableptr;
+      Iterator* iter =
+          NewFileIterator(table_cache_, ReadOptions(), files[i], -1, &tableptr);
+      if (tableptr != nullptr) {
+        result += tableptr->ApproximateOffsetOf(ikey.Encode());
+      }
+      delete iter;
+    }
+  }
+  return result;
+}
+
+void VersionSet::ApproximateSplitKeys(Version* v, const Slice* begin,
+                                      const Slice* end, int n,
+                                      std::vector<std::string>* split_keys) {
+  split_keys->clear();
+  if (n <= 1) {
+    return;
+  }
+
+  InternalKey begin_storage, end_storage;
+  InternalKey* ibegin = nullptr;
+  InternalKey* iend = nullptr;
+  if (begin != nullptr) {
+    begin_storage = InternalKey(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+    ibegin = &begin_storage;
+  }
+  if (end != nullptr) {
+    end_storage = InternalKey(*end, kMaxSequenceNumber, kValueTypeForSeek);
+    iend = &end_storage;
+  }
+
+  std::vector<FileMetaData*> overlaps;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    std::vector<FileMetaData*> inputs;
+    v->GetOverlappingInputs(level, ibegin, iend, &inputs);
+    overlaps.insert(overlaps.end(), inputs.begin(), inputs.end());
+  }
+  SplitKeys(overlaps, std::vector<FileMetaData*>(), begin, end, n, split_keys);
+}
+
+void VersionSet::SubcompactionSplitKeys(Compaction* c, int n,
+                                        std::vector<std::string>* split_keys) {
+  split_keys->clear();
+  if (n <= 1) {
+    return;
+  }
+
+  std::vector<FileMetaData*> inputs = c->inputs_[0];
+  inputs.insert(inputs.end(), c->inputs_[1].begin(), c->inputs_[1].end());
+  InternalKey smallest, largest;
+  GetRange(inputs, &smallest, &largest);
+  const Slice begin = smallest.user_key();
+  const Slice end = largest.user_key();
+
+  // Splitting at grandparent boundaries keeps the outputs of the shards
+  // from overlapping more grandparent files than one output would.
+  SplitKeys(inputs, c->grandparents_, &begin, &end, n, split_keys);
+}
+
+void VersionSet::SplitKeys(const std::vector<FileMetaData*>& files,
+                           const std::vector<FileMetaData*>& boundary_files,
+                           const Slice* begin, const Slice* end, int n,
+                           std::vector<std::string>* split_keys) {
+  // File boundaries are always candidate split points.  When the range
+  // covers only a few files, also use the index keys of those files so
+  // that a range inside a single large table can still be divided.
+  static const size_t kCandidatesPerSplit = 16;
+  const size_t max_candidates = kCandidatesPerSplit * n;
+  std::vector<std::string> candidates;
+  for (size_t i = 0; i < files.size(); i++) {
+    candidates.push_back(files[i]->smallest.user_key().ToString());
+    candidates.push_back(files[i]->largest.user_key().ToString());
+  }
+  for (size_t i = 0; i < boundary_files.size(); i++) {
+    candidates.push_back(boundary_files[i]->smallest.user_key().ToString());
+    candidates.push_back(boundary_files[i]->largest.user_key().ToString());
+  }
+  if (files.size() < max_candidates) {
+    std::vector<std::string> index_keys;
+    for (size_t i = 0; i < files.size(); i++) {
+      Table* tableptr;
+      Iterator* iter =
+          NewFileIterator(table_cache_, ReadOptions(), files[i], -1, &tableptr);
+      if (tableptr != nullptr) {
+        tableptr->AppendIndexKeys(&index_keys);
+      }
+      delete iter;
+    }
+    for (size_t i = 0; i < index_keys.size(); i++) {
+      candidates.push_back(ExtractUserKey(index_keys[i]).ToString());
+    }
+  }
+
+  // Keep the distinct candidates strictly inside (begin,end), in order.
+  const Comparator* ucmp = icmp_.user_comparator();
+  std::vector<std::string> inside;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    const Slice c = candidates[i];
+    if ((begin == nullptr || ucmp->Compare(c, *begin) > 0) &&
+        (end == nullptr || ucmp->Compare(c, *end) < 0)) {
+      inside.push_back(candidates[i]);
+    }
+  }
+  std::sort(inside.begin(), inside.end(),
+            [ucmp](const std::string& a, const std::string& b) {
+              return ucmp->Compare(a, b) < 0;
+            });
+  inside.erase(std::unique(inside.begin(), inside.end(),
+                           [ucmp](const std::string& a, const std::string& b) {
+                             return ucmp->Compare(a, b) == 0;
+                           }),
+               inside.end());
+  if (inside.empty()) {
+    return;
+  }
+
+  // Thin out the candidates so that the offset lookups below stay cheap
+  // for ranges that span many files.
+  if (inside.size() > max_candidates) {
+    std::vector<std::string> sampled;
+    for (size_t i = 0; i < max_candidates; i++) {
+      sampled.push_back(inside[i * inside.size() / max_candidates]);
+    }
+    inside.swap(sampled);
+  }
+
+  uint64_t begin_offset = 0;
+  if (begin != nullptr) {
+    begin_offset = ApproximateOffsetInFiles(
+        files, InternalKey(*begin, kMaxSequenceNumber, kValueTypeForSeek));
+  }
+  uint64_t end_offset = 0;
+  if (end != nullptr) {
+    end_offset = ApproximateOffsetInFiles(
+        files, InternalKey(*end, kMaxSequenceNumber, kValueTypeForSeek));
+  } else {
+    end_offset = TotalFileSize(files);
+  }
+  if (end_offset <= begin_offset) {
+    return;
+  }
+  const uint64_t total = end_offset - begin_offset;
+
+  // Walk the candidates in order, emitting the first one whose offset
+  // reaches each 1/n-th of the range.
+  int next_split = 1;
+  for (size_t i = 0; i < inside.size() && next_split < n; i++) {
+    InternalKey ikey(inside[i], kMaxSequenceNumber, kValueTypeForSeek);
+    uint64_t offset = ApproximateOffsetInFiles(files, ikey);
+    uint64_t target = begin_offset + total * next_split / n;
+    if (offset < target) {
+      continue;
+    }
+    split_keys->push_back(inside[i]);
+    while (next_split < n && begin_offset + total * next_split / n <= offset) {
+      next_split++;
+    }
+  }
+}
+
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   for (Version* v = dummy_versions_.next_; v != &dummy_versions_;
        v = v->next_) {
@@ -1211,10 +1601,25 @@ void VersionSet::GetRange2(const std::vector<FileMetaData*>& inputs1,
   GetRange(all, smallest, largest);
 }
 
+void VersionSet::HintInputs(Compaction* c) {
+  if (options_->use_direct_io_for_compaction) {
+    return;  // The inputs are not read through the table cache
+  }
+  // The inputs are read from start to end.  They are deleted once the
+  // compaction is done, so the hint does not outlive it in the common case.
+  for (int which = 0; which < 2; which++) {
+    for (FileMetaData* f : c->inputs_[which]) {
+      table_cache_->Hint(f->number, f->file_size, c->level() + which,
+                         RandomAccessFile::kSequential);
+    }
+  }
+}
+
 Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   ReadOptions options;
   options.verify_checksums = options_->paranoid_checks;
   options.fill_cache = false;
+  const bool direct = options_->use_direct_io_for_compaction;
 
   // Level-0 files have to be merged together.  For other levels,
   // we will make a concatenating iterator per level.
@@ -1227,14 +1632,17 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
       if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          list[num++] = table_cache_->NewIterator(options, files[i]->number,
-                                                  files[i]->file_size);
+          list[num++] =
+              direct ? table_cache_->NewDirectIterator(
+                           options, files[i]->number, files[i]->file_size)
+                     : NewFileIterator(table_cache_, options, files[i], 0);
         }
       } else {
         // Create concatenating iterator for the files from this level
         list[num++] = NewTwoLevelIterator(
             new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            direct ? &GetDirectFileIterator : &GetFileIterator, table_cache_,
+            &icmp_, options);
       }
     }
   }
@@ -1245,42 +1653,81 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
 }
 
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
-
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != nullptr);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level + 1 < config::kNumLevels);
-    c = new Compaction(options_, level);
+  // the compactions triggered by seeks.  Levels are tried from the
+  // highest score down, and within a level, files are tried in key order
+  // starting after compact_pointer_[level], skipping the files that
+  // running compactions use.
+  std::vector<std::pair<double, int>> levels;
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    const double score = LevelScore(current_, level);
+    if (score >= 1) {
+      levels.emplace_back(score, level);
+    }
+  }
+  std::stable_sort(levels.begin(), levels.end(),
+                   [](const std::pair<double, int>& a,
+                      const std::pair<double, int>& b) {
+                     return a.first > b.first;
+                   });
+
+  for (const std::pair<double, int>& entry : levels) {
+    const int level = entry.second;
+    const std::vector<FileMetaData*>& files = current_->files_[level];
 
     // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
+    size_t first = 0;
+    for (size_t i = 0; i < files.size(); i++) {
       if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
+          icmp_.Compare(files[i]->largest.Encode(), compact_pointer_[level]) >
+              0) {
+        first = i;
         break;
       }
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+
+    if (level == 0) {
+      // Level-0 files may overlap each other, so a level-0 compaction
+      // cannot run next to another one.
+      bool busy = false;
+      for (size_t i = 0; i < files.size(); i++) {
+        busy |= files[i]->being_compacted;
+      }
+      if (!busy) {
+        Compaction* c = PickCompactionFrom(level, files[first]);
+        if (c != nullptr) {
+          return c;
+        }
+      }
+      continue;
+    }
+
+    // Wrap around to the beginning of the key space
+    for (size_t i = 0; i < files.size(); i++) {
+      FileMetaData* f = files[(first + i) % files.size()];
+      if (!f->being_compacted) {
+        Compaction* c = PickCompactionFrom(level, f);
+        if (c != nullptr) {
+          return c;
+        }
+      }
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(options_, level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
-    return nullptr;
   }
 
+  FileMetaData* f = current_->file_to_compact_;
+  if (f != nullptr && !f->being_compacted) {
+    return PickCompactionFrom(current_->file_to_compact_level_, f);
+  }
+  return nullptr;
+}
+
+Compaction* VersionSet::PickCompactionFrom(int level, FileMetaData* f) {
+  assert(level >= 0);
+  assert(level + 1 < config::kNumLevels);
+  Compaction* c = new Compaction(options_, level);
   c->input_version_ = current_;
   c->input_version_->Ref();
+  c->inputs_[0].push_back(f);
 
   // Files in level 0 may overlap each other, so pick up all overlapping ones
   if (level == 0) {
@@ -1293,8 +1740,10 @@ Compaction* VersionSet::PickCompaction() {
     assert(!c->inputs_[0].empty());
   }
 
-  SetupOtherInputs(c);
-
+  if (!SetupOtherInputs(c)) {
+    delete c;
+    return nullptr;
+  }
   return c;
 }
 
@@ -1377,7 +1826,17 @@ void AddBoundaryInputs(const InternalKeyComparator& icmp,
   }
 }
 
-void VersionSet::SetupOtherInputs(Compaction* c) {
+// Returns true if one of "files" is an input of a running compaction.
+static bool AnyBeingCompacted(const std::vector<FileMetaData*>& files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i]->being_compacted) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
   InternalKey smallest, largest;
 
@@ -1386,6 +1845,9 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
 
   current_->GetOverlappingInputs(level + 1, &smallest, &largest,
                                  &c->inputs_[1]);
+  if (AnyBeingCompacted(c->inputs_[0]) || AnyBeingCompacted(c->inputs_[1])) {
+    return false;
+  }
 
   // Get entire range covered by compaction
   InternalKey all_start, all_limit;
@@ -1402,7 +1864,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     const int64_t expanded0_size = TotalFileSize(expanded0);
     if (expanded0.size() > c->inputs_[0].size() &&
         inputs1_size + expanded0_size <
-            ExpandedCompactionByteSizeLimit(options_)) {
+            ExpandedCompactionByteSizeLimit(options_) &&
+        !AnyBeingCompacted(expanded0)) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
@@ -1436,6 +1899,9 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   // key range next time.
   compact_pointer_[level] = largest.Encode().ToString();
   c->edit_.SetCompactPointer(level, largest);
+
+  c->MarkInputs(true);
+  return true;
 }
 
 Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
@@ -1467,7 +1933,10 @@ Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
   c->input_version_ = current_;
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
-  SetupOtherInputs(c);
+  if (!SetupOtherInputs(c)) {
+    delete c;
+    return nullptr;
+  }
   return c;
 }
 
@@ -1475,6 +1944,7 @@ Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
       input_version_(nullptr),
+      inputs_marked_(false),
       grandparent_index_(0),
       seen_key_(false),
       overlapped_bytes_(0) {
@@ -1485,10 +1955,25 @@ Compaction::Compaction(const Options* options, int level)
 
 Compaction::~Compaction() {
   if (input_version_ != nullptr) {
+    MarkInputs(false);
     input_version_->Unref();
   }
 }
 
+void Compaction::MarkInputs(bool value) {
+  if (inputs_marked_ == value) {
+    return;
+  }
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      assert(inputs_[which][i]->being_compacted != value);
+      inputs_[which][i]->being_compacted = value;
+    }
+  }
+  inputs_marked_ = value;
+  input_version_->vset_->compactions_in_progress_ += (value ? 1 : -1);
+}
+
 bool Compaction::IsTrivialMove() const {
   const VersionSet* vset = input_version_->vset_;
   // Avoid a move if there is lots of overlapping grandparent data.
@@ -1552,8 +2037,20 @@ bool Compaction::ShouldStopBefore(const Slice& internal_key) {
   }
 }
 
+Compaction* Compaction::NewSubcompaction() const {
+  assert(input_version_ != nullptr);
+  Compaction* c = new Compaction(input_version_->vset_->options_, level_);
+  c->input_version_ = input_version_;
+  c->input_version_->Ref();
+  c->inputs_[0] = inputs_[0];
+  c->inputs_[1] = inputs_[1];
+  c->grandparents_ = grandparents_;
+  return c;
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != nullptr) {
+    MarkInputs(false);
     input_version_->Unref();
     input_version_ = nullptr;
   }
@@ -227,7 +227,9 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
-  // Pick level and inputs for a new compaction.
+  // Pick level and inputs for a new compaction.  Files that are inputs
+  // of compactions that have not been deleted yet are never picked, so
+  // that the returned compaction can run concurrently with them.
   // Returns nullptr if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
@@ -235,11 +237,16 @@ class VersionSet {
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns nullptr if there is nothing in that
-  // level that overlaps the specified range.  Caller should delete
-  // the result.
+  // level that overlaps the specified range, or if the inputs are in use
+  // by another compaction.  Caller should delete the result.
   Compaction* CompactRange(int level, const InternalKey* begin,
                            const InternalKey* end);
 
+  // Return the number of compactions whose inputs are in use, i.e. that
+  // were returned by PickCompaction() or CompactRange() and have neither
+  // released their inputs nor been deleted.
+  int NumCompactionsInProgress() const { return compactions_in_progress_; }
+
   // Return the maximum overlapping data (in bytes) at next level for any
   // file at a level >= 1.
   int64_t MaxNextLevelOverlappingBytes();
@@ -248,6 +255,11 @@ class VersionSet {
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
 
+  // Advise that the inputs of "*c" will be read sequentially.  Opens the
+  // input tables that are not open yet, so call it without holding the
+  // DB mutex, once per compaction.
+  void HintInputs(Compaction* c);
+
   // Returns true iff some level needs a compaction.
   bool NeedsCompaction() const {
     Version* v = current_;
@@ -262,6 +274,20 @@ class VersionSet {
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
 
+  // Store in "*split_keys" up to n-1 increasing user keys that fall strictly
+  // inside the user key range [begin,end) and divide it into subranges
+  // holding roughly equal amounts of table data as of version "v".
+  // begin==nullptr is treated as a key before all keys, and end==nullptr
+  // as a key after all keys.  Data still in the memtables is not counted.
+  void ApproximateSplitKeys(Version* v, const Slice* begin, const Slice* end,
+                            int n, std::vector<std::string>* split_keys);
+
+  // Store in "*split_keys" up to n-1 increasing user keys that divide the
+  // inputs of "c" into key ranges holding roughly equal amounts of data,
+  // so that the ranges can be compacted separately.
+  void SubcompactionSplitKeys(Compaction* c, int n,
+                              std::vector<std::string>* split_keys);
+
   // Return a human-readable short (single-line) summary of the number
   // of files per level.  Uses *scratch as backing store.
   struct LevelSummaryStorage {
@@ -279,6 +305,35 @@ class VersionSet {
 
   void Finalize(Version* v);
 
+  // Return the approximate number of bytes of "files" before "ikey".
+  uint64_t ApproximateOffsetInFiles(const std::vector<FileMetaData*>& files,
+                                    const InternalKey& ikey);
+
+  // Implements the above split functions: divides the data of "files" in
+  // (begin,end), using the boundaries of "files" and "boundary_files" and
+  // the index keys of "files" as candidate split keys.
+  void SplitKeys(const std::vector<FileMetaData*>& files,
+                 const std::vector<FileMetaData*>& boundary_files,
+                 const Slice* begin, const Slice* end, int n,
+                 std::vector<std::string>* split_keys);
+
+  // Return the compaction score of "level" in "v".  Score >= 1 means the
+  // level needs to be compacted.
+  double LevelScore(Version* v, int level) const;
+
+  // Return a compaction of the file "f" of "level" in the current
+  // version, or nullptr if the compaction would use a file that is
+  // being compacted.
+  Compaction* PickCompactionFrom(int level, FileMetaData* f);
+
+  // Keep the tables of "files", a list of (level, file) pairs, open for
+  // the lifetime of their FileMetaData.  Used when max_open_files is -1.
+  // If "parallel" is true, several tables are opened at once; meant for
+  // opening a whole DB, not the few outputs of a compaction.
+  // REQUIRES: the files are not yet visible to other threads.
+  void OpenTables(const std::vector<std::pair<int, FileMetaData*>>& files,
+                  bool parallel);
+
   void GetRange(const std::vector<FileMetaData*>& inputs, InternalKey* smallest,
                 InternalKey* largest);
 
@@ -286,7 +341,11 @@ class VersionSet {
                  const std::vector<FileMetaData*>& inputs2,
                  InternalKey* smallest, InternalKey* largest);
 
-  void SetupOtherInputs(Compaction* c);
+  // Add the inputs of "c" from "level+1", and from "level" where that
+  // does not change them, and mark all of them as being compacted.
+  // Returns false, and leaves the compaction state of all files
+  // unchanged, if one of the inputs is already being compacted.
+  bool SetupOtherInputs(Compaction* c);
 
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
@@ -313,6 +372,9 @@ class VersionSet {
   // Per-level key at which the next compaction at that level should start.
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
+
+  // Number of compactions that have marked their inputs as being compacted.
+  int compactions_in_progress_;
 };
 
 // A Compaction encapsulates information about a compaction.
@@ -354,19 +416,30 @@ class Compaction {
   bool ShouldStopBefore(const Slice& internal_key);
 
   // Release the input version for the compaction, once the compaction
-  // is successful.
+  // is successful.  The inputs may then be picked by other compactions.
   void ReleaseInputs();
 
+  // Return a new compaction with the same inputs, for compacting part of
+  // the key range of this one on another thread.  ShouldStopBefore() and
+  // IsBaseLevelForKey() keep their own position in the result, which
+  // must be deleted before this compaction.
+  // REQUIRES: the inputs have not been released.
+  Compaction* NewSubcompaction() const;
+
  private:
   friend class Version;
   friend class VersionSet;
 
   Compaction(const Options* options, int level);
 
+  // Set the being_compacted flag of all inputs to "value".
+  void MarkInputs(bool value);
+
   int level_;
   uint64_t max_output_file_size_;
   Version* input_version_;
   VersionEdit edit_;
+  bool inputs_marked_;  // The inputs are marked as being compacted
 
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];  // The two sets of inputs
@@ -28,9 +28,37 @@ namespace leveldb {
 class LEVELDB_EXPORT Cache;
 
 // Create a new cache with a fixed size capacity.  This implementation
-// of Cache uses a least-recently-used eviction policy.
+// of Cache uses a least-recently-used eviction policy.  Entries inserted
+// with InsertHighPriority() are evicted after the others, as long as they
+// use at most half of the capacity.
 LEVELDB_EXPORT Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity that is resistant to
+// scans.  Entries are inserted on probation and are only protected from
+// eviction once they are looked up again; eviction removes the least
+// recently used entry on probation before any protected entry.  A large
+// scan that reads every block once therefore does not push out a working
+// set that is being hit repeatedly.
+//
+// Protected entries, which include the entries inserted with
+// InsertHighPriority(), may use at most "protected_fraction" of the
+// capacity.  A fraction of 0 behaves like NewLRUCache().
+LEVELDB_EXPORT Cache* NewScanResistantLRUCache(size_t capacity,
+                                               double protected_fraction = 0.8);
+
+// Create a new cache with a fixed size capacity.  This implementation
+// of Cache uses the CLOCK eviction policy, which approximates LRU, and
+// serves Lookup() and Release() without taking any locks, so it scales
+// better than NewLRUCache() when many threads read from the cache.
+//
+// Entries are kept in fixed-size hash tables with room for about twice
+// capacity/estimated_entry_charge entries.  If entries are much smaller
+// than "estimated_entry_charge" on average, they are evicted before the
+// capacity is used up.  The default suits a block cache with the default
+// Options::block_size.
+LEVELDB_EXPORT Cache* NewClockCache(size_t capacity,
+                                    size_t estimated_entry_charge = 4096);
+
 class LEVELDB_EXPORT Cache {
  public:
   Cache() = default;
@@ -57,6 +85,19 @@ class LEVELDB_EXPORT Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Like Insert(), but the entry is evicted only after entries that were
+  // inserted by Insert(), which is meant for small entries that are
+  // expensive to lose, such as the index and filter blocks of tables.
+  // Implementations may bound the share of the capacity that such
+  // entries get this preference for.  The default implementation
+  // ignores the priority and calls Insert().
+  virtual Handle* InsertHighPriority(const Slice& key, void* value,
+                                     size_t charge,
+                                     void (*deleter)(const Slice& key,
+                                                     void* value)) {
+    return Insert(key, value, charge, deleter);
+  }
+
   // If the cache has no mapping for "key", returns nullptr.
   //
   // Else return a handle that corresponds to the mapping.  The caller
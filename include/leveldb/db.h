@@ -7,6 +7,7 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <vector>
 
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
@@ -95,6 +96,27 @@ class LEVELDB_EXPORT DB {
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
 
+  // Split the key range [*begin,*end) into at most n subranges holding
+  // roughly equal amounts of data, and store in "*iterators" one iterator
+  // per subrange, in key order.  Each iterator only yields the keys of its
+  // own subrange, and all of them observe the same snapshot of the
+  // database, so they may be handed to different threads to scan the range
+  // in parallel.  Fewer than n iterators are returned when the range holds
+  // too little data to be divided further.
+  //
+  // begin==nullptr is treated as a key before all keys in the database.
+  // end==nullptr is treated as a key after all keys in the database.
+  // The iterate_lower_bound and iterate_upper_bound fields of "options"
+  // are ignored.
+  //
+  // Like the result of NewIterator(), each iterator is initially invalid
+  // and must be deleted by the caller before this db is deleted.
+  //
+  // The default implementation returns a NotSupported status.
+  virtual Status NewParallelIterators(const ReadOptions& options,
+                                      const Slice* begin, const Slice* end,
+                                      int n, std::vector<Iterator*>* iterators);
+
   // Return a handle to the current DB state.  Iterators created with
   // this handle will all observe a stable snapshot of the current DB
   // state.  The caller must call ReleaseSnapshot(result) when the
@@ -85,6 +85,28 @@ class LEVELDB_EXPORT Env {
   virtual Status NewRandomAccessFile(const std::string& fname,
                                      RandomAccessFile** result) = 0;
 
+  // Set the maximum number of files returned by NewRandomAccessFile()
+  // that are memory-mapped at the same time; files opened once the limit
+  // is reached are read with system calls instead.  Mapping a file saves
+  // a system call and a copy on every read, at the cost of address space.
+  // A negative value removes the limit, e.g. to map every table of a
+  // database that fits in memory, and 0 disables mapping.  Files that are
+  // already open are not affected.
+  //
+  // The default implementation returns NotSupported, for environments
+  // that do not memory-map files.
+  virtual Status SetMaxMmapFiles(int max_mmap_files);
+
+  // Like NewRandomAccessFile(), but reads from the returned file bypass
+  // the operating system's page cache where the platform supports it, so
+  // they neither evict cached pages nor add to the cache.  Meant for data
+  // that is cached elsewhere or read only once.  The returned file never
+  // memory-maps the file.
+  //
+  // The default implementation calls NewRandomAccessFile().
+  virtual Status NewDirectRandomAccessFile(const std::string& fname,
+                                           RandomAccessFile** result);
+
   // Create an object that writes to a new file with the specified
   // name.  Deletes any existing file with the same name and creates a
   // new file.  On success, stores a pointer to the new file in
@@ -95,6 +117,15 @@ class LEVELDB_EXPORT Env {
   virtual Status NewWritableFile(const std::string& fname,
                                  WritableFile** result) = 0;
 
+  // Like NewWritableFile(), but writes to the returned file bypass the
+  // operating system's page cache where the platform supports it.  Data
+  // may stay buffered in the file object until Sync() or Close() even
+  // if Flush() is called, so the file should not be read before then.
+  //
+  // The default implementation calls NewWritableFile().
+  virtual Status NewDirectWritableFile(const std::string& fname,
+                                       WritableFile** result);
+
   // Create an object that either appends to an existing file, or
   // writes to a new file (if the file does not exist to begin with).
   // On success, stores a pointer to the new file in *result and
@@ -197,6 +228,25 @@ class LEVELDB_EXPORT Env {
   // serialized.
   virtual void Schedule(void (*function)(void* arg), void* arg) = 0;
 
+  // Allow up to "number" functions added by Schedule() to run at the
+  // same time, each in its own background thread.  Does nothing if the
+  // Env already allows at least that many, so that several users of an
+  // Env can each ask for the threads they need.
+  //
+  // The default implementation does nothing, for environments that do
+  // not manage a pool of background threads.
+  virtual void IncreaseBackgroundThreads(int number);
+
+  // Arrange to run "(*function)(arg)" once in a background thread that
+  // only runs functions added by this method, so that they never wait
+  // behind long-running functions added by Schedule().  Meant for short
+  // work that foreground threads may be waiting for, such as writing a
+  // memtable to a table file.
+  //
+  // Returns false, and does nothing, if the Env has no such thread.  The
+  // default implementation returns false.
+  virtual bool ScheduleHighPriority(void (*function)(void* arg), void* arg);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -248,6 +298,18 @@ class LEVELDB_EXPORT SequentialFile {
   virtual Status Skip(uint64_t n) = 0;
 };
 
+// A read to be performed by RandomAccessFile::MultiRead().
+struct LEVELDB_EXPORT ReadRequest {
+  // Set by the caller, as for RandomAccessFile::Read().
+  uint64_t offset = 0;
+  size_t n = 0;
+  char* scratch = nullptr;
+
+  // Set by MultiRead().
+  Slice result;
+  Status status;
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class LEVELDB_EXPORT RandomAccessFile {
  public:
@@ -269,6 +331,27 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // Perform the reads described by requests[0..n-1], storing the result
+  // and status of each read in its request as Read() would.  Unlike a
+  // series of Read() calls, the reads may be in flight at the same time,
+  // which lets devices with deep queues serve them in parallel.  Returns
+  // OK if every read succeeded, else the status of a failed read.
+  //
+  // The default implementation calls Read() for each request in turn.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status MultiRead(ReadRequest* requests, size_t n) const;
+
+  // How the file is going to be read.
+  enum AccessPattern { kNormal, kRandom, kSequential };
+
+  // Advise the implementation that the file will be read with the given
+  // pattern from now on, e.g. so that it can tune read-ahead.  This is
+  // only a hint; the default implementation ignores it.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void Hint(AccessPattern pattern);
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -349,9 +432,20 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
                              RandomAccessFile** r) override {
     return target_->NewRandomAccessFile(f, r);
   }
+  Status SetMaxMmapFiles(int max_mmap_files) override {
+    return target_->SetMaxMmapFiles(max_mmap_files);
+  }
+  Status NewDirectRandomAccessFile(const std::string& f,
+                                   RandomAccessFile** r) override {
+    return target_->NewDirectRandomAccessFile(f, r);
+  }
   Status NewWritableFile(const std::string& f, WritableFile** r) override {
     return target_->NewWritableFile(f, r);
   }
+  Status NewDirectWritableFile(const std::string& f,
+                               WritableFile** r) override {
+    return target_->NewDirectWritableFile(f, r);
+  }
   Status NewAppendableFile(const std::string& f, WritableFile** r) override {
     return target_->NewAppendableFile(f, r);
   }
@@ -384,6 +478,12 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) override {
     return target_->Schedule(f, a);
   }
+  void IncreaseBackgroundThreads(int number) override {
+    target_->IncreaseBackgroundThreads(number);
+  }
+  bool ScheduleHighPriority(void (*f)(void*), void* a) override {
+    return target_->ScheduleHighPriority(f, a);
+  }
   void StartThread(void (*f)(void*), void* a) override {
     return target_->StartThread(f, a);
   }
@@ -0,0 +1,46 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A MemoryAllocator provides the memory that the blocks read from table
+// files are stored in, e.g. while they are held by the block cache.
+// Applications may supply one to place that memory in an arena of their
+// choice, such as a dedicated jemalloc arena or huge pages, or to account
+// for it separately from the rest of the heap.
+//
+// A MemoryAllocator must be safe to call concurrently from multiple
+// threads, and must outlive every DB, Table and Cache that uses it.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
+#define STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
+
+#include <cstddef>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT MemoryAllocator {
+ public:
+  MemoryAllocator() = default;
+
+  MemoryAllocator(const MemoryAllocator&) = delete;
+  MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+  virtual ~MemoryAllocator();
+
+  // Return the name of this allocator.
+  virtual const char* Name() const = 0;
+
+  // Return a pointer to "size" bytes of memory, aligned like memory from
+  // malloc().  Like operator new, an allocator that runs out of memory
+  // must not return nullptr.
+  virtual void* Allocate(size_t size) = 0;
+
+  // Free memory returned by an earlier call to Allocate().
+  virtual void Deallocate(void* p) = 0;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_MEMORY_ALLOCATOR_H_
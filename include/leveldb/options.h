@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "leveldb/export.h"
 
@@ -16,6 +17,9 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class MemoryAllocator;
+class PersistentCache;
+class Slice;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -26,7 +30,19 @@ enum CompressionType {
   // NOTE: do not change the values of existing entries, as these are
   // part of the persistent format on disk.
   kNoCompression = 0x0,
-  kSnappyCompression = 0x1
+  kSnappyCompression = 0x1,
+  kZstdCompression = 0x2,
+  kLZ4Compression = 0x3,
+  kLZ4HCCompression = 0x4
+};
+
+// Each block of a table file is stored with a checksum of its contents.
+// The following enum describes how the checksums of a table are computed.
+enum ChecksumType {
+  // NOTE: do not change the values of existing entries, as these are
+  // part of the persistent format on disk.
+  kCRC32cChecksum = 0x0,
+  kXXH3Checksum = 0x1
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -84,8 +100,32 @@ struct LEVELDB_EXPORT Options {
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
   // one open file per 2MB of working set).
+  //
+  // If -1, every table file of the DB is kept open, and reads find the
+  // open table without going through the table cache.  The tables are
+  // opened in parallel when the DB is opened.  Use this when the process
+  // may hold one file descriptor (or mmap) per table file.
   int max_open_files = 1000;
 
+  // Maximum number of compactions the DB runs at the same time, each on
+  // its own thread of the Env's background pool.  Compactions that run
+  // together never share input files, and each one writes its own output
+  // tables.  Raise it on machines with several cores and fast storage so
+  // that compaction keeps up with heavy write loads.  A memtable flush
+  // counts as one of these compactions.
+  //
+  // Default: 1 (the DB runs one compaction at a time)
+  int max_background_compactions = 1;
+
+  // Maximum number of threads that one compaction is split across.  A
+  // compaction whose inputs span enough data is divided into this many
+  // key ranges of about equal size, each compacted on its own thread into
+  // its own output tables.  The outputs of all ranges are installed
+  // together, as for a compaction that is not split.
+  //
+  // Default: 1 (each compaction runs on a single thread)
+  int max_subcompactions = 1;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -93,6 +133,62 @@ struct LEVELDB_EXPORT Options {
   // If null, leveldb will automatically create and use an 8MB internal cache.
   Cache* block_cache = nullptr;
 
+  // If non-null, use the specified cache to hold compressed blocks in the
+  // form in which they are stored in table files.  It is consulted after a
+  // miss in block_cache and before reading from the file, and a hit costs
+  // a decompression instead of a read.  Since compressed blocks are
+  // smaller, this cache holds more data per byte of memory than
+  // block_cache does.  Blocks stored uncompressed are not added to it.
+  Cache* compressed_block_cache = nullptr;
+
+  // If non-null, the blocks read from table files are stored in memory
+  // obtained from the specified allocator (see leveldb/memory_allocator.h)
+  // instead of memory from new[].  This covers the data blocks held by
+  // block_cache as well as index and filter blocks.  Compressed blocks are
+  // decompressed straight into this memory.
+  MemoryAllocator* block_allocator = nullptr;
+
+  // If non-null, blocks are also cached in the specified persistent
+  // cache (see leveldb/persistent_cache.h), typically on a local device
+  // that is faster than the one holding the database.  It is consulted
+  // after misses in block_cache and compressed_block_cache, and blocks
+  // read from table files are added to it.  Blocks of mmap-ed table
+  // files are not added, since reading them again is cheap.
+  PersistentCache* persistent_cache = nullptr;
+
+  // If true, the index and filter blocks of open tables are stored in
+  // block_cache, where they are charged against its capacity and may be
+  // evicted when the table is cold, instead of being held in memory for
+  // as long as the table is open.  They are inserted with high priority,
+  // so they are evicted only after data blocks.  Blocks that are read
+  // from mmap-ed files do not use heap memory and are not cached.
+  bool cache_index_and_filter_blocks = false;
+
+  // If true, and cache_index_and_filter_blocks is true, the index and
+  // filter blocks of level-0 tables are never evicted from block_cache
+  // while the table is open.  Every read consults all level-0 tables, so
+  // their metadata is always hot.  A table that moves out of level-0 is
+  // unpinned the next time it is read in its new level.
+  bool pin_l0_index_and_filter_blocks = false;
+
+  // If non-null, use the specified cache for the results of point
+  // lookups in individual table files.  A Get() that finds its answer in
+  // this cache does not seek in or decode any block of that table.  The
+  // cache is charged with the size of each cached key and value.
+  Cache* row_cache = nullptr;
+
+  // If true, compactions read their input tables and write their output
+  // tables through Env::NewDirectRandomAccessFile() and
+  // Env::NewDirectWritableFile(), which bypass the operating system's
+  // page cache, so that a large compaction does not evict the pages that
+  // foreground reads rely on.
+  bool use_direct_io_for_compaction = false;
+
+  // If true, all reads of table files bypass the operating system's page
+  // cache, which leaves block_cache as the only cache of table data.  Size
+  // block_cache accordingly.
+  bool use_direct_reads = false;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -130,6 +226,69 @@ struct LEVELDB_EXPORT Options {
   // efficiently detect that and will switch to uncompressed mode.
   CompressionType compression = kSnappyCompression;
 
+  // If greater than 1, each table is built with this many threads that
+  // compress and checksum its data blocks while more entries are added,
+  // which speeds up flushes and compactions with slow compressors such
+  // as zstd or LZ4HC.  The tables are the same as when compressing inline.
+  // The threads are shared by all tables being built in the process.
+  //
+  // Default: 1 (compress on the thread that builds the table)
+  int compression_threads = 1;
+
+  // If non-empty, overrides "compression" for the tables of each level:
+  // tables of level L use compression_per_level[L], or the last entry if
+  // L is past the end.  Data in the lower levels is rewritten soon, so
+  // compressing it lightly or not at all saves CPU, while data in the
+  // last level is read for a long time and is worth compressing hard.
+  //
+  // Default: empty (use "compression" for every level)
+  std::vector<CompressionType> compression_per_level;
+
+  // If non-empty, overrides "block_size" for the tables of each level,
+  // in the same way as compression_per_level.
+  //
+  // Default: empty (use "block_size" for every level)
+  std::vector<size_t> block_size_per_level;
+
+  // Compression level for kZstdCompression.  Higher levels compress
+  // better but more slowly; decompression speed hardly depends on it.
+  // Negative levels trade ratio for speed.  Valid levels are [-5, 22].
+  int zstd_compression_level = 1;
+
+  // Compression level for kLZ4HCCompression, from 1 to 12.  LZ4HC
+  // compresses better than kLZ4Compression and much more slowly, but its
+  // output decompresses just as fast, which suits data that is written
+  // once and read often.
+  int lz4hc_compression_level = 9;
+
+  // If non-zero and "compression" is kZstdCompression, every table
+  // written by a compaction trains a zstd dictionary of at most this many
+  // bytes on its first data blocks and compresses its data blocks with
+  // it.  The dictionary is stored in the table.  A dictionary lets zstd
+  // find redundancy across blocks, which improves the ratio a lot for
+  // small blocks.  Tables written by memtable flushes never train a
+  // dictionary, so flushes do not stall on buffering and training.
+  // Typical values are 16KB to 64KB.
+  //
+  // Default: 0 (no dictionary)
+  size_t zstd_max_dictionary_size = 0;
+
+  // The amount of data, in bytes of key/value pairs, that a table
+  // buffers in memory to train its dictionary on.  Nothing is written to
+  // the table until that much data has been added or the table is
+  // finished.  Should be about 100 times zstd_max_dictionary_size.
+  size_t zstd_max_train_bytes = 1024 * 1024;
+
+  // Checksum the blocks of new table files using the specified algorithm.
+  // Tables record the algorithm they use, so this parameter can be
+  // changed at any time; existing tables keep being read correctly.
+  //
+  // Default: kCRC32cChecksum, which uses the crc32c instruction where the
+  // CPU has one.  kXXH3Checksum is much faster where it does not, but
+  // its tables cannot be read by versions of leveldb without support
+  // for it.
+  ChecksumType checksum = kCRC32cChecksum;
+
   // EXPERIMENTAL: If true, append to existing MANIFEST and log files
   // when a database is opened.  This can significantly speed up open.
   //
@@ -159,6 +318,47 @@ struct LEVELDB_EXPORT ReadOptions {
   // not have been released).  If "snapshot" is null, use an implicit
   // snapshot of the state at the beginning of this read operation.
   const Snapshot* snapshot = nullptr;
+
+  // Iterators detect sequential scans over a table file and then read
+  // ahead of the scan, fetching several upcoming blocks with a single
+  // file read.  If "readahead_size" is zero the readahead window starts
+  // small and grows as the scan continues; otherwise every read issued
+  // by an iterator is extended to "readahead_size" bytes.  Has no
+  // effect on mmap-backed files or on Get().
+  size_t readahead_size = 0;
+
+  // If true, an iterator that is scanning forward through a table reads
+  // the next data block on a background thread while the caller is still
+  // consuming the current one, overlapping I/O with key processing.
+  // Mostly useful for long scans over data that is not in the cache.
+  bool async_prefetch = false;
+
+  // If true, the Slices returned by an iterator's key() and value() stay
+  // valid until the iterator is deleted, not just until it is next
+  // moved.  The iterator keeps every block and memtable it has visited
+  // alive for its whole lifetime and returns values without copying
+  // them, so memory use grows with the amount of data scanned.  Useful
+  // for callers that hold on to many entries at once, e.g. merge joins.
+  bool pin_data = false;
+
+  // If non-null, iterators created with these options only yield user
+  // keys >= *iterate_lower_bound.  Table files that lie entirely below
+  // the bound are not opened, and SeekToFirst() positions the iterator
+  // at the bound.  Ignored by Get().
+  //
+  // The pointed-to key is copied when the iterator is created, so it
+  // only needs to remain live for the duration of NewIterator().
+  const Slice* iterate_lower_bound = nullptr;
+
+  // If non-null, iterators created with these options only yield user
+  // keys < *iterate_upper_bound (the bound itself is excluded).  Table
+  // files that lie entirely at or above the bound are not opened, and
+  // iteration stops at the bound without reading further blocks.
+  // Ignored by Get().
+  //
+  // The pointed-to key is copied when the iterator is created, so it
+  // only needs to remain live for the duration of NewIterator().
+  const Slice* iterate_upper_bound = nullptr;
 };
 
 // Options that control write operations
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PersistentCache stores blocks of table files on a storage device
+// that is faster than the one holding the database, e.g. a local SSD in
+// front of network-attached storage.  It sits below the in-memory block
+// cache: blocks that miss in memory are looked up here before they are
+// read from the table file, and blocks read from the table file are
+// added here.  Blocks are stored as they appear in the table file, i.e.
+// compressed if compression is enabled.
+//
+// A PersistentCache has internal synchronization and may be safely
+// accessed concurrently from multiple threads.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+#define STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+class PersistentCache;
+class Slice;
+
+// Create a persistent cache that keeps up to about "capacity" bytes of
+// blocks in files under the directory "dir", which it creates if needed
+// and which must not be used for anything else.  Blocks are appended to
+// a sequence of files, and the oldest file is deleted when the capacity
+// is exceeded.  An index of the cached blocks is kept in memory, so the
+// files left behind by a previous process are deleted on creation.
+// Files are written by a thread owned by the cache; until then, their
+// blocks are served from memory.
+//
+// On success, stores a pointer to the new cache in *result and returns
+// OK.  The caller should delete the cache when it is no longer needed,
+// after every DB using it has been closed.
+LEVELDB_EXPORT Status NewFilePersistentCache(Env* env, const std::string& dir,
+                                             size_t capacity,
+                                             PersistentCache** result);
+
+class LEVELDB_EXPORT PersistentCache {
+ public:
+  PersistentCache() = default;
+
+  PersistentCache(const PersistentCache&) = delete;
+  PersistentCache& operator=(const PersistentCache&) = delete;
+
+  virtual ~PersistentCache();
+
+  // Store "data" under "key".  The cache may decline to store it, and
+  // may drop it at any time later.  Does nothing if "key" is present.
+  virtual Status Insert(const Slice& key, const Slice& data) = 0;
+
+  // If the cache holds data for "key", store it in *data and return OK.
+  // Returns NotFound if it does not, and another error if the data
+  // could not be read back intact.
+  virtual Status Lookup(const Slice& key, std::string* data) = 0;
+
+  // Remove the data stored under "key", if any.  Called when data that
+  // was returned by Lookup() turns out to be unusable.  The default
+  // implementation does nothing.
+  virtual void Erase(const Slice& key);
+
+  // Return a new numeric id, to be used like Cache::NewId().
+  virtual uint64_t NewId() = 0;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
@@ -6,7 +6,10 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
+#include "leveldb/cache.h"
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 
@@ -14,6 +17,8 @@ namespace leveldb {
 
 class Block;
 class BlockHandle;
+struct BlockContents;
+class FilterBlockReader;
 class Footer;
 struct Options;
 class RandomAccessFile;
@@ -48,6 +53,10 @@ class LEVELDB_EXPORT Table {
   // Returns a new iterator over the table contents.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
+  //
+  // Unlike a DB iterator, a table iterator does not stop at
+  // options.iterate_upper_bound; it only uses the bound, a key in the
+  // table's own format, to avoid prefetching blocks past it.
   Iterator* NewIterator(const ReadOptions&) const;
 
   // Given a key, return an approximate byte offset in the file where
@@ -58,11 +67,46 @@ class LEVELDB_EXPORT Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const Slice& key) const;
 
+  // Appends to "*keys" the index key of every data block in the table, in
+  // order.  Each index key is >= every key in its block and < every key in
+  // the following block, so the keys partition the table into pieces of
+  // roughly block_size bytes each.
+  void AppendIndexKeys(std::vector<std::string>* keys) const;
+
  private:
   friend class TableCache;
   struct Rep;
 
+  // Like the public Open(), but if "pin_meta_blocks" is true and the
+  // index and filter blocks are stored in the block cache, they are kept
+  // there for as long as the table is open.
+  static Status Open(const Options& options, RandomAccessFile* file,
+                     uint64_t file_size, bool pin_meta_blocks, Table** table);
+
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* ReadaheadBlockReader(void*, const ReadOptions&,
+                                        const Slice&);
+
+  // Returns an iterator over the block whose encoded BlockHandle is
+  // "index_value", reading it from "file" if it is not in the cache.
+  Iterator* NewBlockIterator(RandomAccessFile* file, const ReadOptions&,
+                             const Slice& index_value) const;
+
+  // Reads the block at "handle" from the compressed block cache, or from
+  // "file" on a miss there.
+  Status ReadBlockContents(RandomAccessFile* file, const ReadOptions&,
+                           const BlockHandle& handle,
+                           BlockContents* contents) const;
+
+  // Returns an iterator over the index block, reading it into the block
+  // cache if it was evicted from there.
+  Iterator* NewIndexIterator(const ReadOptions&) const;
+
+  // Returns the filter of the table, or nullptr if there is none.  If the
+  // filter came from the block cache, sets "*cache_handle" to the handle
+  // that the caller must release, otherwise sets it to nullptr.
+  FilterBlockReader* GetFilter(const ReadOptions&,
+                               Cache::Handle** cache_handle) const;
 
   explicit Table(Rep* rep) : rep_(rep) {}
 
@@ -75,6 +119,7 @@ class LEVELDB_EXPORT Table {
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadDictionary(const Slice& dictionary_handle_value);
 
   Rep* const rep_;
 };
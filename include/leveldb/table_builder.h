@@ -75,14 +75,20 @@ class LEVELDB_EXPORT TableBuilder {
   // Number of calls to Add() so far.
   uint64_t NumEntries() const;
 
-  // Size of the file generated so far.  If invoked after a successful
+  // Size of the file generated so far, counting the data blocks not yet
+  // written at their uncompressed size.  If invoked after a successful
   // Finish() call, returns the size of the final generated file.
   uint64_t FileSize() const;
 
  private:
   bool ok() const { return status().ok(); }
+  void AddToDataBlock(const Slice& key, const Slice& value);
+  void WriteBuffered();
+  void WriteCompressedBlocks(size_t max_queued);
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
+  void WriteChecksummedBlock(const Slice& data, CompressionType,
+                             uint32_t checksum, BlockHandle* handle);
 
   struct Rep;
   Rep* rep_;
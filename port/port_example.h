@@ -81,6 +81,90 @@ bool Snappy_GetUncompressedLength(const char* input, size_t length,
 bool Snappy_Uncompress(const char* input_data, size_t input_length,
                        char* output);
 
+// A zstd dictionary prepared for compressing or uncompressing.
+// Preparing a dictionary costs far more than compressing a block with
+// it, so a table prepares its dictionary once for all its blocks.
+struct ZstdCompressionDictionary;
+struct ZstdUncompressionDictionary;
+
+// Prepare "dictionary[0,dictionary_length-1]" for Zstd_Compress at the
+// given compression level.  Returns nullptr if zstd is not supported by
+// this port or the dictionary cannot be used.  The result must be freed
+// with Zstd_DeleteCompressionDictionary and may be shared by threads.
+ZstdCompressionDictionary* Zstd_NewCompressionDictionary(
+    int level, const char* dictionary, size_t dictionary_length);
+void Zstd_DeleteCompressionDictionary(ZstdCompressionDictionary* dictionary);
+
+// Prepare "dictionary[0,dictionary_length-1]" for Zstd_Uncompress.
+// Returns nullptr if zstd is not supported by this port or the
+// dictionary cannot be used.  The result must be freed with
+// Zstd_DeleteUncompressionDictionary and may be shared by threads.
+ZstdUncompressionDictionary* Zstd_NewUncompressionDictionary(
+    const char* dictionary, size_t dictionary_length);
+void Zstd_DeleteUncompressionDictionary(
+    ZstdUncompressionDictionary* dictionary);
+
+// Store the zstd compression of "input[0,input_length-1]" at the given
+// compression level in *output.  If "dictionary" is non-null, the
+// compression uses it, at the level it was prepared for, and the same
+// dictionary must be used by Zstd_Uncompress.  Returns false if zstd is
+// not supported by this port.
+bool Zstd_Compress(int level, const char* input, size_t input_length,
+                   const ZstdCompressionDictionary* dictionary,
+                   std::string* output);
+
+// If input[0,input_length-1] looks like a valid zstd compressed
+// buffer, store the size of the uncompressed data in *result and
+// return true.  Else return false.
+bool Zstd_GetUncompressedLength(const char* input, size_t input_length,
+                                size_t* result);
+
+// Attempt to zstd uncompress input[0,input_length-1] into *output, using
+// "dictionary" if it is non-null.  Returns true if successful, false if
+// the input is invalid zstd compressed data.
+//
+// REQUIRES: at least the first "n" bytes of output[] must be writable
+// where "n" is the result of a successful call to
+// Zstd_GetUncompressedLength.
+bool Zstd_Uncompress(const char* input_data, size_t input_length,
+                     const ZstdUncompressionDictionary* dictionary,
+                     char* output);
+
+// Store the LZ4 compression of "input[0,input_length-1]" in *output.
+// Returns false if LZ4 is not supported by this port.
+bool Lz4_Compress(const char* input, size_t input_length, std::string* output);
+
+// Like Lz4_Compress(), but uses the slower LZ4HC compressor at the given
+// level, which compresses better.  Its output is read by Lz4_Uncompress()
+// just as fast.
+bool Lz4HC_Compress(int level, const char* input, size_t input_length,
+                    std::string* output);
+
+// If input[0,input_length-1] looks like a valid LZ4 compressed buffer
+// produced by Lz4_Compress() or Lz4HC_Compress(), store the size of the
+// uncompressed data in *result and return true.  Else return false.
+bool Lz4_GetUncompressedLength(const char* input, size_t input_length,
+                               size_t* result);
+
+// Attempt to LZ4 uncompress input[0,input_length-1] into *output.
+// Returns true if successful, false if the input is invalid LZ4
+// compressed data.
+//
+// REQUIRES: at least the first "n" bytes of output[] must be writable
+// where "n" is the result of a successful call to
+// Lz4_GetUncompressedLength.
+bool Lz4_Uncompress(const char* input_data, size_t input_length,
+                    char* output);
+
+// Train a zstd dictionary of at most "max_size" bytes on the
+// "num_samples" samples stored back to back in "samples", where sample
+// i is sample_sizes[i] bytes long, and store it in *dictionary.  Returns
+// false if zstd is not supported by this port or no dictionary could be
+// trained, e.g. because the samples are too few.
+bool Zstd_TrainDictionary(const char* samples, const size_t* sample_sizes,
+                          size_t num_samples, size_t max_size,
+                          std::string* dictionary);
+
 // ------------------ Miscellaneous -------------------
 
 // If heap profiling is not supported, returns false.
@@ -28,6 +28,14 @@
 #if HAVE_SNAPPY
 #include <snappy.h>
 #endif  // HAVE_SNAPPY
+#if HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif  // HAVE_ZSTD
+#if HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif  // HAVE_LZ4
 
 #include <cassert>
 #include <condition_variable>  // NOLINT
@@ -126,6 +134,309 @@ inline bool Snappy_Uncompress(const char* input, size_t length, char* output) {
 #endif  // HAVE_SNAPPY
 }
 
+#if HAVE_ZSTD
+// zstd contexts are costly to create, so each thread keeps one of each
+// kind for all its calls.
+struct ZstdThreadContexts {
+  ZstdThreadContexts() : cctx(nullptr), dctx(nullptr) {}
+  ~ZstdThreadContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+};
+
+inline ZstdThreadContexts* Zstd_GetThreadContexts() {
+  thread_local ZstdThreadContexts contexts;
+  return &contexts;
+}
+
+struct ZstdCompressionDictionary {
+  ZSTD_CDict* cdict;
+};
+
+struct ZstdUncompressionDictionary {
+  ZSTD_DDict* ddict;
+};
+#else
+struct ZstdCompressionDictionary {};
+struct ZstdUncompressionDictionary {};
+#endif  // HAVE_ZSTD
+
+inline ZstdCompressionDictionary* Zstd_NewCompressionDictionary(
+    int level, const char* dictionary, size_t dictionary_length) {
+#if HAVE_ZSTD
+  ZSTD_CDict* cdict = ZSTD_createCDict(dictionary, dictionary_length, level);
+  if (cdict == nullptr) {
+    return nullptr;
+  }
+  return new ZstdCompressionDictionary{cdict};
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)level;
+  (void)dictionary;
+  (void)dictionary_length;
+  return nullptr;
+#endif  // HAVE_ZSTD
+}
+
+inline void Zstd_DeleteCompressionDictionary(
+    ZstdCompressionDictionary* dictionary) {
+#if HAVE_ZSTD
+  if (dictionary != nullptr) {
+    ZSTD_freeCDict(dictionary->cdict);
+  }
+#endif  // HAVE_ZSTD
+  delete dictionary;
+}
+
+inline ZstdUncompressionDictionary* Zstd_NewUncompressionDictionary(
+    const char* dictionary, size_t dictionary_length) {
+#if HAVE_ZSTD
+  ZSTD_DDict* ddict = ZSTD_createDDict(dictionary, dictionary_length);
+  if (ddict == nullptr) {
+    return nullptr;
+  }
+  return new ZstdUncompressionDictionary{ddict};
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)dictionary;
+  (void)dictionary_length;
+  return nullptr;
+#endif  // HAVE_ZSTD
+}
+
+inline void Zstd_DeleteUncompressionDictionary(
+    ZstdUncompressionDictionary* dictionary) {
+#if HAVE_ZSTD
+  if (dictionary != nullptr) {
+    ZSTD_freeDDict(dictionary->ddict);
+  }
+#endif  // HAVE_ZSTD
+  delete dictionary;
+}
+
+inline bool Zstd_Compress(int level, const char* input, size_t length,
+                          const ZstdCompressionDictionary* dictionary,
+                          std::string* output) {
+#if HAVE_ZSTD
+  ZstdThreadContexts* contexts = Zstd_GetThreadContexts();
+  if (contexts->cctx == nullptr) {
+    contexts->cctx = ZSTD_createCCtx();
+    if (contexts->cctx == nullptr) {
+      return false;
+    }
+  }
+  output->resize(ZSTD_compressBound(length));
+  size_t outlen;
+  if (dictionary != nullptr) {
+    outlen = ZSTD_compress_usingCDict(contexts->cctx, &(*output)[0],
+                                      output->size(), input, length,
+                                      dictionary->cdict);
+  } else {
+    outlen = ZSTD_compressCCtx(contexts->cctx, &(*output)[0], output->size(),
+                               input, length, level);
+  }
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)level;
+  (void)input;
+  (void)length;
+  (void)dictionary;
+  (void)output;
+  return false;
+#endif  // HAVE_ZSTD
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#if HAVE_ZSTD
+  const unsigned long long size = ZSTD_getFrameContentSize(input, length);
+  if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return false;
+  }
+  *result = static_cast<size_t>(size);
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)length;
+  (void)result;
+  return false;
+#endif  // HAVE_ZSTD
+}
+
+inline bool Zstd_Uncompress(const char* input, size_t length,
+                            const ZstdUncompressionDictionary* dictionary,
+                            char* output) {
+#if HAVE_ZSTD
+  size_t outlen;
+  if (!Zstd_GetUncompressedLength(input, length, &outlen)) {
+    return false;
+  }
+  ZstdThreadContexts* contexts = Zstd_GetThreadContexts();
+  if (contexts->dctx == nullptr) {
+    contexts->dctx = ZSTD_createDCtx();
+    if (contexts->dctx == nullptr) {
+      return false;
+    }
+  }
+  size_t result;
+  if (dictionary != nullptr) {
+    result = ZSTD_decompress_usingDDict(contexts->dctx, output, outlen, input,
+                                        length, dictionary->ddict);
+  } else {
+    result =
+        ZSTD_decompressDCtx(contexts->dctx, output, outlen, input, length);
+  }
+  return !ZSTD_isError(result) && result == outlen;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)length;
+  (void)dictionary;
+  (void)output;
+  return false;
+#endif  // HAVE_ZSTD
+}
+
+inline bool Zstd_TrainDictionary(const char* samples,
+                                 const size_t* sample_sizes,
+                                 size_t num_samples, size_t max_size,
+                                 std::string* dictionary) {
+#if HAVE_ZSTD
+  dictionary->resize(max_size);
+  const size_t size = ZDICT_trainFromBuffer(
+      &(*dictionary)[0], max_size, samples, sample_sizes,
+      static_cast<unsigned>(num_samples));
+  if (ZDICT_isError(size)) {
+    dictionary->clear();
+    return false;
+  }
+  dictionary->resize(size);
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)samples;
+  (void)sample_sizes;
+  (void)num_samples;
+  (void)max_size;
+  (void)dictionary;
+  return false;
+#endif  // HAVE_ZSTD
+}
+
+#if HAVE_LZ4
+// LZ4 does not record the uncompressed length, so the compressed data is
+// prefixed with it as 4 little-endian bytes.
+static const size_t kLz4LengthPrefixSize = 4;
+
+// Helper for Lz4_Compress() and Lz4HC_Compress().  A "level" of zero
+// selects the fast compressor, others LZ4HC at that level.
+inline bool Lz4_CompressAtLevel(int level, const char* input, size_t length,
+                                std::string* output) {
+  if (length > LZ4_MAX_INPUT_SIZE) {
+    return false;
+  }
+  const int n = static_cast<int>(length);
+  const int bound = LZ4_compressBound(n);
+  output->resize(kLz4LengthPrefixSize + bound);
+  char* dst = &(*output)[0];
+  for (size_t i = 0; i < kLz4LengthPrefixSize; i++) {
+    dst[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+  }
+  dst += kLz4LengthPrefixSize;
+  const int outlen = (level == 0)
+                         ? LZ4_compress_default(input, dst, n, bound)
+                         : LZ4_compress_HC(input, dst, n, bound, level);
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(kLz4LengthPrefixSize + outlen);
+  return true;
+}
+#endif  // HAVE_LZ4
+
+inline bool Lz4_Compress(const char* input, size_t length,
+                         std::string* output) {
+#if HAVE_LZ4
+  return Lz4_CompressAtLevel(0, input, length, output);
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)length;
+  (void)output;
+  return false;
+#endif  // HAVE_LZ4
+}
+
+inline bool Lz4HC_Compress(int level, const char* input, size_t length,
+                           std::string* output) {
+#if HAVE_LZ4
+  return Lz4_CompressAtLevel(level < 1 ? 1 : level, input, length, output);
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)level;
+  (void)input;
+  (void)length;
+  (void)output;
+  return false;
+#endif  // HAVE_LZ4
+}
+
+inline bool Lz4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result) {
+#if HAVE_LZ4
+  if (length < kLz4LengthPrefixSize) {
+    return false;
+  }
+  size_t size = 0;
+  for (size_t i = 0; i < kLz4LengthPrefixSize; i++) {
+    size |= static_cast<size_t>(static_cast<unsigned char>(input[i]))
+            << (8 * i);
+  }
+  if (size > LZ4_MAX_INPUT_SIZE) {
+    return false;
+  }
+  *result = size;
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)length;
+  (void)result;
+  return false;
+#endif  // HAVE_LZ4
+}
+
+inline bool Lz4_Uncompress(const char* input, size_t length, char* output) {
+#if HAVE_LZ4
+  size_t outlen;
+  if (!Lz4_GetUncompressedLength(input, length, &outlen) ||
+      length - kLz4LengthPrefixSize > LZ4_MAX_INPUT_SIZE) {
+    return false;
+  }
+  const int result = LZ4_decompress_safe(
+      input + kLz4LengthPrefixSize, output,
+      static_cast<int>(length - kLz4LengthPrefixSize),
+      static_cast<int>(outlen));
+  return result >= 0 && static_cast<size_t>(result) == outlen;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)input;
+  (void)length;
+  (void)output;
+  return false;
+#endif  // HAVE_LZ4
+}
+
 inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg) {
   // Silence compiler warnings about unused arguments.
   (void)func;
@@ -25,7 +25,8 @@ inline uint32_t Block::NumRestarts() const {
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+      owned_(contents.heap_allocated),
+      allocator_(contents.allocator) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
   } else {
@@ -41,7 +42,7 @@ Block::Block(const BlockContents& contents)
 
 Block::~Block() {
   if (owned_) {
-    delete[] data_;
+    FreeBlock(allocator_, data_);
   }
 }
 
@@ -88,6 +89,20 @@ class Block::Iter : public Iterator {
   Slice value_;
   Status status_;
 
+  // Entries of the restart interval that Prev() last decoded, in order.
+  // Prev() decodes a whole interval to find the entry before current_;
+  // while the iterator keeps moving backwards through that interval,
+  // later Prev() calls are served from here instead of decoding again.
+  struct PrevEntry {
+    uint32_t offset;      // Offset in data_ of the entry
+    uint32_t key_offset;  // Offset in prev_keys_ of the entry's full key
+    uint32_t key_size;
+    Slice value;
+  };
+  std::vector<PrevEntry> prev_entries_;
+  std::string prev_keys_;  // Backing store for the keys in prev_entries_
+  int prev_index_;  // Index in prev_entries_ of the current entry, or -1
+
   inline int Compare(const Slice& a, const Slice& b) const {
     return comparator_->Compare(a, b);
   }
@@ -120,7 +135,8 @@ class Block::Iter : public Iterator {
         restarts_(restarts),
         num_restarts_(num_restarts),
         current_(restarts_),
-        restart_index_(num_restarts_) {
+        restart_index_(num_restarts_),
+        prev_index_(-1) {
     assert(num_restarts_ > 0);
   }
 
@@ -143,6 +159,17 @@ class Block::Iter : public Iterator {
   void Prev() override {
     assert(Valid());
 
+    // Serve the previous entry from the last decoded interval if we are
+    // still positioned inside it.
+    if (prev_index_ > 0 && prev_entries_[prev_index_].offset == current_) {
+      prev_index_--;
+      const PrevEntry& entry = prev_entries_[prev_index_];
+      current_ = entry.offset;
+      key_.assign(prev_keys_.data() + entry.key_offset, entry.key_size);
+      value_ = entry.value;
+      return;
+    }
+
     // Scan backwards to a restart point before current_
     const uint32_t original = current_;
     while (GetRestartPoint(restart_index_) >= original) {
@@ -150,15 +177,32 @@ class Block::Iter : public Iterator {
         // No more entries
         current_ = restarts_;
         restart_index_ = num_restarts_;
+        prev_index_ = -1;
         return;
       }
       restart_index_--;
     }
 
+    // Decode the interval up to the original entry, remembering each
+    // entry along the way.
     SeekToRestartPoint(restart_index_);
-    do {
-      // Loop until end of current entry hits the start of original entry
-    } while (ParseNextKey() && NextEntryOffset() < original);
+    prev_entries_.clear();
+    prev_keys_.clear();
+    prev_index_ = -1;
+    while (ParseNextKey()) {
+      PrevEntry entry;
+      entry.offset = current_;
+      entry.key_offset = static_cast<uint32_t>(prev_keys_.size());
+      entry.key_size = static_cast<uint32_t>(key_.size());
+      entry.value = value_;
+      prev_entries_.push_back(entry);
+      prev_keys_.append(key_);
+      if (NextEntryOffset() >= original) {
+        // End of current entry hits the start of original entry
+        prev_index_ = static_cast<int>(prev_entries_.size()) - 1;
+        break;
+      }
+    }
   }
 
   void Seek(const Slice& target) override {
@@ -14,6 +14,7 @@ namespace leveldb {
 
 struct BlockContents;
 class Comparator;
+class MemoryAllocator;
 
 class Block {
  public:
@@ -35,8 +36,9 @@ class Block {
 
   const char* data_;
   size_t size_;
-  uint32_t restart_offset_;  // Offset in data_ of restart array
-  bool owned_;               // Block owns data_[]
+  uint32_t restart_offset_;     // Offset in data_ of restart array
+  bool owned_;                  // Block owns data_[]
+  MemoryAllocator* allocator_;  // Allocated data_[], if owned_
 };
 
 }  // namespace leveldb
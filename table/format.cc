@@ -4,11 +4,15 @@
 
 #include "table/format.h"
 
+#include <cstring>
+
 #include "leveldb/env.h"
+#include "leveldb/memory_allocator.h"
 #include "port/port.h"
 #include "table/block.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/xxh3.h"
 
 namespace leveldb {
 
@@ -32,9 +36,18 @@ void Footer::EncodeTo(std::string* dst) const {
   const size_t original_size = dst->size();
   metaindex_handle_.EncodeTo(dst);
   index_handle_.EncodeTo(dst);
+  uint64_t magic = kTableMagicNumber;
+  if (checksum_type_ != kCRC32cChecksum) {
+    // The handles of any file smaller than 2^63 bytes leave the last
+    // byte of padding free.
+    assert(dst->size() < original_size + 2 * BlockHandle::kMaxEncodedLength);
+    dst->resize(2 * BlockHandle::kMaxEncodedLength - 1);  // Padding
+    dst->push_back(static_cast<char>(checksum_type_));
+    magic = kTableMagicNumberV2;
+  }
   dst->resize(2 * BlockHandle::kMaxEncodedLength);  // Padding
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber & 0xffffffffu));
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber >> 32));
+  PutFixed32(dst, static_cast<uint32_t>(magic & 0xffffffffu));
+  PutFixed32(dst, static_cast<uint32_t>(magic >> 32));
   assert(dst->size() == original_size + kEncodedLength);
   (void)original_size;  // Disable unused variable warning.
 }
@@ -45,7 +58,19 @@ Status Footer::DecodeFrom(Slice* input) {
   const uint32_t magic_hi = DecodeFixed32(magic_ptr + 4);
   const uint64_t magic = ((static_cast<uint64_t>(magic_hi) << 32) |
                           (static_cast<uint64_t>(magic_lo)));
-  if (magic != kTableMagicNumber) {
+  if (magic == kTableMagicNumber) {
+    checksum_type_ = kCRC32cChecksum;
+  } else if (magic == kTableMagicNumberV2) {
+    const char type = input->data()[2 * BlockHandle::kMaxEncodedLength - 1];
+    switch (type) {
+      case kCRC32cChecksum:
+      case kXXH3Checksum:
+        checksum_type_ = static_cast<ChecksumType>(type);
+        break;
+      default:
+        return Status::Corruption("unknown checksum type");
+    }
+  } else {
     return Status::Corruption("not an sstable (bad magic number)");
   }
 
@@ -61,81 +86,218 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
+char* AllocateBlock(MemoryAllocator* allocator, size_t n) {
+  if (allocator == nullptr) {
+    return new char[n];
+  }
+  return reinterpret_cast<char*>(allocator->Allocate(n));
+}
+
+void FreeBlock(MemoryAllocator* allocator, const char* data) {
+  if (allocator == nullptr) {
+    delete[] data;
+  } else if (data != nullptr) {
+    allocator->Deallocate(const_cast<char*>(data));
+  }
+}
+
+// Uncompresses the snappy-compressed block "data[0,n-1]" into memory
+// from "allocator" owned by *result.
+static Status SnappyUncompressBlock(const char* data, size_t n,
+                                    MemoryAllocator* allocator,
+                                    BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = AllocateBlock(allocator, ulength);
+  if (!port::Snappy_Uncompress(data, n, ubuf)) {
+    FreeBlock(allocator, ubuf);
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
+  return Status::OK();
+}
+
+// Uncompresses the zstd-compressed block "data[0,n-1]" into memory from
+// "allocator" owned by *result.
+static Status ZstdUncompressBlock(
+    const char* data, size_t n,
+    const port::ZstdUncompressionDictionary* dictionary,
+    MemoryAllocator* allocator, BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Zstd_GetUncompressedLength(data, n, &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = AllocateBlock(allocator, ulength);
+  if (!port::Zstd_Uncompress(data, n, dictionary, ubuf)) {
+    FreeBlock(allocator, ubuf);
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
+  return Status::OK();
+}
+
+// Uncompresses the LZ4-compressed block "data[0,n-1]" into memory from
+// "allocator" owned by *result.
+static Status Lz4UncompressBlock(const char* data, size_t n,
+                                 MemoryAllocator* allocator,
+                                 BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Lz4_GetUncompressedLength(data, n, &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = AllocateBlock(allocator, ulength);
+  if (!port::Lz4_Uncompress(data, n, ubuf)) {
+    FreeBlock(allocator, ubuf);
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
+  return Status::OK();
+}
+
+// Uncompresses the block "data[0,n-1]", whose compression type is
+// "type", into memory from context.allocator owned by *result.
+static Status UncompressBlockContents(const char* data, size_t n, char type,
+                                      const BlockReadContext& context,
+                                      BlockContents* result) {
+  switch (type) {
+    case kSnappyCompression:
+      return SnappyUncompressBlock(data, n, context.allocator, result);
+    case kZstdCompression:
+      return ZstdUncompressBlock(data, n, context.dictionary,
+                                 context.allocator, result);
+    case kLZ4Compression:
+    case kLZ4HCCompression:
+      return Lz4UncompressBlock(data, n, context.allocator, result);
+    default:
+      return Status::Corruption("bad block type");
+  }
+}
+
+uint32_t BlockChecksum(ChecksumType checksum_type, const char* data, size_t n,
+                       char type) {
+  if (checksum_type == kXXH3Checksum) {
+    // XXH3 cannot be extended like a crc, so the type is mixed into the
+    // hash of the contents instead.
+    const uint32_t hash = static_cast<uint32_t>(xxh3::Hash64(data, n));
+    return hash ^ (static_cast<uint8_t>(type) * 0x6b9083d9u);
+  }
+  uint32_t crc = crc32c::Value(data, n);
+  crc = crc32c::Extend(crc, &type, 1);  // Extend crc to cover block type
+  return crc32c::Mask(crc);
+}
+
+// Compressed blocks up to this size (with their trailer) are read into
+// a buffer on the stack.  Enough for the default Options::block_size.
+static const size_t kStackBlockSize = 8192;
+
 Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result) {
+                 const BlockReadContext& context, const BlockHandle& handle,
+                 BlockContents* result, std::string* raw_block) {
   result->data = Slice();
   result->cachable = false;
   result->heap_allocated = false;
+  result->allocator = context.allocator;
 
   // Read the block contents as well as the type/crc footer.
   // See table_builder.cc for the code that built this structure.
   size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
+  char stack_buf[kStackBlockSize];
+  char* heap_buf = nullptr;
+  char* buf = stack_buf;
+  if (!context.likely_compressed || n + kBlockTrailerSize > kStackBlockSize) {
+    // An uncompressed block is used where it is read.
+    heap_buf = AllocateBlock(context.allocator, n + kBlockTrailerSize);
+    buf = heap_buf;
+  }
   Slice contents;
   Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
   if (!s.ok()) {
-    delete[] buf;
+    FreeBlock(context.allocator, heap_buf);
     return s;
   }
   if (contents.size() != n + kBlockTrailerSize) {
-    delete[] buf;
+    FreeBlock(context.allocator, heap_buf);
     return Status::Corruption("truncated block read");
   }
 
-  // Check the crc of the type and the block contents
+  // Check the checksum of the type and the block contents
   const char* data = contents.data();  // Pointer to where Read put the data
   if (options.verify_checksums) {
-    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
-    const uint32_t actual = crc32c::Value(data, n + 1);
-    if (actual != crc) {
-      delete[] buf;
+    const uint32_t expected = DecodeFixed32(data + n + 1);
+    const uint32_t actual =
+        BlockChecksum(context.checksum_type, data, n, data[n]);
+    if (actual != expected) {
+      FreeBlock(context.allocator, heap_buf);
       s = Status::Corruption("block checksum mismatch");
       return s;
     }
   }
 
-  switch (data[n]) {
-    case kNoCompression:
-      if (data != buf) {
-        // File implementation gave us pointer to some other data.
-        // Use it directly under the assumption that it will be live
-        // while the file is open.
-        delete[] buf;
-        result->data = Slice(data, n);
-        result->heap_allocated = false;
-        result->cachable = false;  // Do not double-cache
-      } else {
-        result->data = Slice(buf, n);
-        result->heap_allocated = true;
-        result->cachable = true;
-      }
+  if (raw_block != nullptr) {
+    if (data == buf) {
+      raw_block->assign(data, n + 1);
+    } else {
+      raw_block->clear();
+    }
+  }
 
-      // Ok
-      break;
-    case kSnappyCompression: {
-      size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
-      char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
-        return Status::Corruption("corrupted compressed block contents");
+  if (data[n] == kNoCompression) {
+    if (data != buf) {
+      // File implementation gave us pointer to some other data.
+      // Use it directly under the assumption that it will be live
+      // while the file is open.
+      FreeBlock(context.allocator, heap_buf);
+      result->data = Slice(data, n);
+      result->heap_allocated = false;
+      result->cachable = false;  // Do not double-cache
+    } else {
+      if (heap_buf == nullptr) {
+        // The block was expected to be compressed.
+        heap_buf = AllocateBlock(context.allocator, n);
+        std::memcpy(heap_buf, data, n);
       }
-      delete[] buf;
-      result->data = Slice(ubuf, ulength);
+      result->data = Slice(heap_buf, n);
       result->heap_allocated = true;
       result->cachable = true;
-      break;
     }
-    default:
-      delete[] buf;
-      return Status::Corruption("bad block type");
+    return Status::OK();
   }
 
-  return Status::OK();
+  // Decompress straight from wherever Read put the data, which also
+  // avoids copying blocks that "file" serves from its own memory.
+  s = UncompressBlockContents(data, n, data[n], context, result);
+  FreeBlock(context.allocator, heap_buf);
+  return s;
+}
+
+Status UncompressBlock(const Slice& raw_block, const BlockReadContext& context,
+                       BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  result->allocator = context.allocator;
+  if (raw_block.empty()) {
+    return Status::Corruption("empty raw block");
+  }
+  const char* data = raw_block.data();
+  const size_t n = raw_block.size() - 1;
+  if (data[n] == kNoCompression) {
+    char* buf = AllocateBlock(context.allocator, n);
+    std::memcpy(buf, data, n);
+    result->data = Slice(buf, n);
+    result->heap_allocated = true;
+    result->cachable = true;
+    return Status::OK();
+  }
+  return UncompressBlockContents(data, n, data[n], context, result);
 }
 
 }  // namespace leveldb
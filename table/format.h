@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <string>
 
+#include "leveldb/options.h"
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 #include "leveldb/table_builder.h"
@@ -15,9 +16,14 @@
 namespace leveldb {
 
 class Block;
+class MemoryAllocator;
 class RandomAccessFile;
 struct ReadOptions;
 
+namespace port {
+struct ZstdUncompressionDictionary;
+}  // namespace port
+
 // BlockHandle is a pointer to the extent of a file that stores a data
 // block or a meta block.
 class BlockHandle {
@@ -52,7 +58,13 @@ class Footer {
   // of two block handles and a magic number.
   enum { kEncodedLength = 2 * BlockHandle::kMaxEncodedLength + 8 };
 
-  Footer() = default;
+  Footer() : checksum_type_(kCRC32cChecksum) {}
+
+  // The algorithm used for the block checksums of the table.  Footers
+  // of tables that do not use kCRC32cChecksum carry kTableMagicNumberV2
+  // so that readers that do not know about checksum types reject them.
+  ChecksumType checksum_type() const { return checksum_type_; }
+  void set_checksum_type(ChecksumType t) { checksum_type_ = t; }
 
   // The block handle for the metaindex block of the table
   const BlockHandle& metaindex_handle() const { return metaindex_handle_; }
@@ -68,6 +80,7 @@ class Footer {
  private:
   BlockHandle metaindex_handle_;
   BlockHandle index_handle_;
+  ChecksumType checksum_type_;
 };
 
 // kTableMagicNumber was picked by running
@@ -75,19 +88,78 @@ class Footer {
 // and taking the leading 64 bits.
 static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 
-// 1-byte type + 32-bit crc
+// kTableMagicNumberV2 marks footers that record a checksum type in the
+// last byte of their padding.  It is kTableMagicNumber + 1.
+static const uint64_t kTableMagicNumberV2 = 0xdb4775248b80fb58ull;
+
+// 1-byte type + 32-bit checksum
 static const size_t kBlockTrailerSize = 5;
 
+// Returns the checksum stored in the trailer of a block whose contents
+// are data[0,n-1] and whose compression type is "type".
+uint32_t BlockChecksum(ChecksumType checksum_type, const char* data, size_t n,
+                       char type);
+
+// Allocate "n" bytes for the contents of a block with "allocator", or
+// with new[] if "allocator" is null.
+char* AllocateBlock(MemoryAllocator* allocator, size_t n);
+
+// Free "data", which AllocateBlock(allocator, ...) returned.
+void FreeBlock(MemoryAllocator* allocator, const char* data);
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
-  bool heap_allocated;  // True iff caller should delete[] data.data()
+  bool heap_allocated;  // True iff caller should FreeBlock() data.data()
+
+  // The allocator of data, if heap_allocated.
+  MemoryAllocator* allocator = nullptr;
 };
 
-// Read the block identified by "handle" from "file".  On failure
-// return non-OK.  On success fill *result and return OK.
+// How the blocks of a table are read.  A Table keeps one for its data
+// blocks and one, without the dictionary, for its other blocks.
+struct BlockReadContext {
+  ChecksumType checksum_type = kCRC32cChecksum;  // Saved from the footer
+
+  // The zstd dictionary the blocks were compressed with, if any (see
+  // kZstdDictionaryKey), prepared once when the table is opened.
+  const port::ZstdUncompressionDictionary* dictionary = nullptr;
+
+  // Allocates the contents of heap allocated results; see AllocateBlock().
+  MemoryAllocator* allocator = nullptr;
+
+  // Whether the blocks are likely to be compressed.  If so, small blocks
+  // are read into a buffer on the stack, from which they are decompressed
+  // into their final memory.  A block that turns out to be uncompressed
+  // then costs one copy out of that buffer.
+  bool likely_compressed = false;
+};
+
+// Read the block identified by "handle" from "file".  On failure return
+// non-OK.  On success fill *result and return OK.
+//
+// The contents of *result are written once, into memory from
+// context.allocator, unless "file" serves the block from its own memory
+// (e.g. mmap) and it is not compressed.  Such blocks are used in place
+// and are not cachable.
+//
+// If "raw_block" is non-null, it is set to the block as stored in the
+// file (possibly compressed) followed by its one-byte compression type,
+// suitable for UncompressBlock().  It is left empty when "file" serves
+// the block from its own memory, since such blocks are cheap to read
+// again.
 Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result);
+                 const BlockReadContext& context, const BlockHandle& handle,
+                 BlockContents* result, std::string* raw_block = nullptr);
+
+// Fill *result from a "raw_block" previously produced by ReadBlock().
+// The result is always heap allocated and cachable.
+Status UncompressBlock(const Slice& raw_block, const BlockReadContext& context,
+                       BlockContents* result);
+
+// The metaindex key of the zstd dictionary that the data blocks of a
+// table are compressed with.  Other blocks never use the dictionary.
+static const char kZstdDictionaryKey[] = "zstd.dictionary";
 
 // Implementation details follow.  Clients should ignore,
 
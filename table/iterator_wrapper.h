@@ -33,6 +33,15 @@ class IteratorWrapper {
     }
   }
 
+  // Returns the wrapped iterator and leaves the wrapper empty.  The
+  // caller takes ownership of the result.
+  Iterator* Release() {
+    Iterator* iter = iter_;
+    iter_ = nullptr;
+    valid_ = false;
+    return iter;
+  }
+
   // Iterator interface methods
   bool Valid() const { return valid_; }
   Slice key() const {
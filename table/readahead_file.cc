@@ -0,0 +1,104 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/readahead_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+const size_t ReadaheadFile::kInitialReadaheadSize;
+const size_t ReadaheadFile::kMaxReadaheadSize;
+const int ReadaheadFile::kSequentialReadsBeforeReadahead;
+
+ReadaheadFile::ReadaheadFile(RandomAccessFile* base, size_t readahead_size)
+    : base_(base),
+      fixed_readahead_size_(readahead_size),
+      buf_(nullptr),
+      buf_capacity_(0),
+      buf_offset_(0),
+      buf_len_(0),
+      next_offset_(0),
+      sequential_reads_(0),
+      readahead_size_(readahead_size != 0 ? readahead_size
+                                          : kInitialReadaheadSize),
+      passthrough_(false) {}
+
+ReadaheadFile::~ReadaheadFile() { delete[] buf_; }
+
+bool ReadaheadFile::ReadFromBuffer(uint64_t offset, size_t n, Slice* result,
+                                   char* scratch) const {
+  if (offset < buf_offset_ || offset + n > buf_offset_ + buf_len_) {
+    return false;
+  }
+  std::memcpy(scratch, buf_ + (offset - buf_offset_), n);
+  *result = Slice(scratch, n);
+  return true;
+}
+
+Status ReadaheadFile::Read(uint64_t offset, size_t n, Slice* result,
+                           char* scratch) const {
+  if (passthrough_) {
+    return base_->Read(offset, n, result, scratch);
+  }
+
+  const bool sequential = (offset == next_offset_);
+  next_offset_ = offset + n;
+  if (ReadFromBuffer(offset, n, result, scratch)) {
+    return Status::OK();
+  }
+
+  if (fixed_readahead_size_ == 0) {
+    if (!sequential) {
+      sequential_reads_ = 0;
+      readahead_size_ = kInitialReadaheadSize;
+    } else if (sequential_reads_ < kSequentialReadsBeforeReadahead) {
+      sequential_reads_++;
+    }
+  }
+  if (readahead_size_ <= n ||
+      (fixed_readahead_size_ == 0 &&
+       sequential_reads_ < kSequentialReadsBeforeReadahead)) {
+    Status s = base_->Read(offset, n, result, scratch);
+    if (s.ok() && result->data() != scratch) {
+      passthrough_ = true;
+    }
+    return s;
+  }
+
+  const size_t window = readahead_size_;
+  if (buf_capacity_ < window) {
+    delete[] buf_;
+    buf_ = new char[window];
+    buf_capacity_ = window;
+  }
+  buf_len_ = 0;
+  Slice chunk;
+  Status s = base_->Read(offset, window, &chunk, buf_);
+  if (!s.ok() || chunk.data() != buf_) {
+    // Either the window runs past what the file can serve (some files
+    // reject reads past their end) or the file hands out its own
+    // memory; retry as a plain read and let the caller see its result.
+    s = base_->Read(offset, n, result, scratch);
+    if (s.ok() && result->data() != scratch) {
+      passthrough_ = true;
+    }
+    return s;
+  }
+  buf_offset_ = offset;
+  buf_len_ = chunk.size();
+  if (fixed_readahead_size_ == 0) {
+    readahead_size_ = std::min(2 * readahead_size_, kMaxReadaheadSize);
+  }
+
+  const size_t available = std::min(n, buf_len_);
+  std::memcpy(scratch, buf_, available);
+  *result = Slice(scratch, available);
+  return Status::OK();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,75 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
+#define STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+// A RandomAccessFile wrapper used by table iterators to turn a
+// sequential scan's many small block reads into a few large ones.
+//
+// Reads are passed through to the wrapped file until a run of
+// sequential reads is observed.  From then on each read that misses
+// the internal buffer fetches a readahead window starting at the
+// requested offset; the window starts at kInitialReadaheadSize and
+// doubles on every buffer refill up to kMaxReadaheadSize.  A
+// non-sequential read resets the window.  If a fixed readahead size
+// is supplied, every read that misses the buffer is extended to that
+// size instead.
+//
+// Files that return pointers to their own memory (e.g. mmap-backed
+// files) gain nothing from readahead, so once such a file is detected
+// all reads are passed straight through.
+//
+// Unlike most RandomAccessFile implementations, instances are NOT
+// thread-safe: each one is meant to be owned by a single iterator.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  static const size_t kInitialReadaheadSize = 8 * 1024;
+  static const size_t kMaxReadaheadSize = 256 * 1024;
+
+  // Number of back-to-back sequential reads before readahead kicks in.
+  static const int kSequentialReadsBeforeReadahead = 2;
+
+  // Does not take ownership of "base", which must outlive this object.
+  // If "readahead_size" is zero the readahead window adapts as described
+  // above, otherwise it is fixed to "readahead_size" bytes.
+  ReadaheadFile(RandomAccessFile* base, size_t readahead_size);
+
+  ReadaheadFile(const ReadaheadFile&) = delete;
+  ReadaheadFile& operator=(const ReadaheadFile&) = delete;
+
+  ~ReadaheadFile() override;
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override;
+
+ private:
+  // Copies [offset, offset + n) into scratch if it is in the buffer.
+  bool ReadFromBuffer(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const;
+
+  RandomAccessFile* const base_;
+  const size_t fixed_readahead_size_;  // 0 if the window adapts
+
+  // Read() is logically const; the members below only cache file data.
+  mutable char* buf_;
+  mutable size_t buf_capacity_;
+  mutable uint64_t buf_offset_;  // File offset of buf_[0]
+  mutable size_t buf_len_;       // Number of valid bytes in buf_
+  mutable uint64_t next_offset_;  // Offset just past the previous read
+  mutable int sequential_reads_;
+  mutable size_t readahead_size_;
+  mutable bool passthrough_;  // base_ hands out its own memory
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_READAHEAD_FILE_H_
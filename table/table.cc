@@ -9,34 +9,114 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/persistent_cache.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/readahead_file.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 
 namespace leveldb {
 
+// The index and filter blocks are either owned by the Rep (index_block,
+// filter) or, if options.cache_index_and_filter_blocks is set and they
+// were read into heap memory, stored in the block cache under the offsets
+// of index_handle and filter_handle.  Cached blocks are evicted like data
+// blocks unless the table pins them by holding on to their cache handles.
 struct Table::Rep {
   ~Rep() {
     delete filter;
-    delete[] filter_data;
+    FreeBlock(meta_context.allocator, filter_data);
     delete index_block;
+    port::Zstd_DeleteUncompressionDictionary(dictionary);
+    if (pinned_index != nullptr) {
+      options.block_cache->Release(pinned_index);
+    }
+    if (pinned_filter != nullptr) {
+      options.block_cache->Release(pinned_filter);
+    }
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
+  uint64_t compressed_cache_id;
+  uint64_t persistent_cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  bool pin_meta_blocks;
+  BlockReadContext meta_context;  // For the index, filter and meta blocks
+  BlockReadContext data_context;  // Adds the dictionary for data blocks
+  // The zstd dictionary of the data blocks, if any.
+  port::ZstdUncompressionDictionary* dictionary;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  BlockHandle index_handle;
+  BlockHandle filter_handle;
+  bool cached_filter;  // Whether the filter is stored in the block cache
+  Cache::Handle* pinned_index;
+  Cache::Handle* pinned_filter;
+};
+
+namespace {
+
+// A filter stored in the block cache, together with the block it reads.
+struct CachedFilter {
+  CachedFilter(const FilterPolicy* policy, const BlockContents& contents)
+      : data(contents.data.data()),
+        allocator(contents.allocator),
+        reader(policy, contents.data) {}
+  ~CachedFilter() { FreeBlock(allocator, data); }
+
+  const char* const data;
+  MemoryAllocator* const allocator;
+  FilterBlockReader reader;
 };
 
+}  // namespace
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  delete reinterpret_cast<CachedFilter*>(value);
+}
+
+// Key of the block at "offset" of the table with the given cache id.
+static Slice BlockCacheKey(uint64_t cache_id, uint64_t offset, char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf + 8, offset);
+  return Slice(buf, 16);
+}
+
 Status Table::Open(const Options& options, RandomAccessFile* file,
                    uint64_t size, Table** table) {
+  return Open(options, file, size, false, table);
+}
+
+// Whether the blocks of tables read with "options" are likely to be
+// compressed.  The options a table is read with are normally those it
+// was written with.
+static bool LikelyCompressed(const Options& options) {
+  if (options.compression != kNoCompression) {
+    return true;
+  }
+  for (CompressionType type : options.compression_per_level) {
+    if (type != kNoCompression) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status Table::Open(const Options& options, RandomAccessFile* file,
+                   uint64_t size, bool pin_meta_blocks, Table** table) {
   *table = nullptr;
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
@@ -52,13 +132,19 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
   s = footer.DecodeFrom(&footer_input);
   if (!s.ok()) return s;
 
+  BlockReadContext context;
+  context.checksum_type = footer.checksum_type();
+  context.allocator = options.block_allocator;
+  context.likely_compressed = LikelyCompressed(options);
+
   // Read the index block
   BlockContents index_block_contents;
   ReadOptions opt;
   if (options.paranoid_checks) {
     opt.verify_checksums = true;
   }
-  s = ReadBlock(file, opt, footer.index_handle(), &index_block_contents);
+  s = ReadBlock(file, opt, context, footer.index_handle(),
+                &index_block_contents);
 
   if (s.ok()) {
     // We've successfully read the footer and the index block: we're
@@ -70,8 +156,35 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->compressed_cache_id = (options.compressed_block_cache
+                                    ? options.compressed_block_cache->NewId()
+                                    : 0);
+    rep->persistent_cache_id =
+        (options.persistent_cache ? options.persistent_cache->NewId() : 0);
     rep->filter_data = nullptr;
     rep->filter = nullptr;
+    rep->dictionary = nullptr;
+    rep->pin_meta_blocks = pin_meta_blocks;
+    rep->meta_context = context;
+    rep->data_context = context;
+    rep->index_handle = footer.index_handle();
+    rep->cached_filter = false;
+    rep->pinned_index = nullptr;
+    rep->pinned_filter = nullptr;
+    if (options.cache_index_and_filter_blocks &&
+        options.block_cache != nullptr && index_block_contents.cachable) {
+      // Hand the index block over to the block cache.
+      char buf[16];
+      Cache::Handle* h = options.block_cache->InsertHighPriority(
+          BlockCacheKey(rep->cache_id, rep->index_handle.offset(), buf),
+          index_block, index_block->size(), &DeleteCachedBlock);
+      if (pin_meta_blocks) {
+        rep->pinned_index = h;
+      } else {
+        options.block_cache->Release(h);
+      }
+      rep->index_block = nullptr;
+    }
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   }
@@ -80,34 +193,69 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
 }
 
 void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == nullptr) {
-    return;  // Do not need any metadata
+  // The metaindex block is read even without a filter policy, since it
+  // locates the zstd dictionary, unless it is empty: an empty block holds
+  // just its restart array of one offset and the array length.
+  if (footer.metaindex_handle().size() <= 2 * sizeof(uint32_t)) {
+    return;
   }
-
-  // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
-  // it is an empty block.
   ReadOptions opt;
   if (rep_->options.paranoid_checks) {
     opt.verify_checksums = true;
   }
   BlockContents contents;
-  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents).ok()) {
+  if (!ReadBlock(rep_->file, opt, rep_->meta_context,
+                 footer.metaindex_handle(), &contents)
+           .ok()) {
     // Do not propagate errors since meta info is not needed for operation
     return;
   }
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  if (rep_->options.filter_policy != nullptr) {
+    std::string key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value());
+    }
+  }
+  iter->Seek(kZstdDictionaryKey);
+  if (iter->Valid() && iter->key() == Slice(kZstdDictionaryKey)) {
+    ReadDictionary(iter->value());
   }
   delete iter;
   delete meta;
 }
 
+void Table::ReadDictionary(const Slice& dictionary_handle_value) {
+  Slice v = dictionary_handle_value;
+  BlockHandle dictionary_handle;
+  if (!dictionary_handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  // Without the dictionary, reads of the data blocks fail as corrupted,
+  // so there is no need to propagate errors here.
+  ReadOptions opt;
+  if (rep_->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, rep_->meta_context, dictionary_handle,
+                 &block)
+           .ok()) {
+    return;
+  }
+  rep_->dictionary = port::Zstd_NewUncompressionDictionary(
+      block.data.data(), block.data.size());
+  rep_->data_context.dictionary = rep_->dictionary;
+  if (block.heap_allocated) {
+    FreeBlock(block.allocator, block.data.data());
+  }
+}
+
 void Table::ReadFilter(const Slice& filter_handle_value) {
   Slice v = filter_handle_value;
   BlockHandle filter_handle;
@@ -122,7 +270,25 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
     opt.verify_checksums = true;
   }
   BlockContents block;
-  if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
+  if (!ReadBlock(rep_->file, opt, rep_->meta_context, filter_handle, &block)
+           .ok()) {
+    return;
+  }
+  Cache* block_cache = rep_->options.block_cache;
+  if (rep_->options.cache_index_and_filter_blocks && block_cache != nullptr &&
+      block.cachable) {
+    char buf[16];
+    Cache::Handle* h = block_cache->InsertHighPriority(
+        BlockCacheKey(rep_->cache_id, filter_handle.offset(), buf),
+        new CachedFilter(rep_->options.filter_policy, block),
+        block.data.size(), &DeleteCachedFilter);
+    if (rep_->pin_meta_blocks) {
+      rep_->pinned_filter = h;
+    } else {
+      block_cache->Release(h);
+    }
+    rep_->filter_handle = filter_handle;
+    rep_->cached_filter = true;
     return;
   }
   if (block.heap_allocated) {
@@ -137,9 +303,9 @@ static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
 
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
+static void DeleteCachedRawBlock(const Slice& key, void* value) {
+  std::string* raw_block = reinterpret_cast<std::string*>(value);
+  delete raw_block;
 }
 
 static void ReleaseBlock(void* arg, void* h) {
@@ -148,12 +314,43 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+// Per-iterator state for iterators returned by NewIterator().  Each
+// iterator reads through its own ReadaheadFile so that sequential
+// scans can be detected without sharing state between iterators.
+namespace {
+struct TableIteratorState {
+  TableIteratorState(const Table* t, RandomAccessFile* f, size_t readahead_size)
+      : table(t), file(f, readahead_size) {}
+
+  const Table* const table;
+  ReadaheadFile file;
+};
+}  // namespace
+
+static void DeleteIteratorState(void* arg, void* ignored) {
+  delete reinterpret_cast<TableIteratorState*>(arg);
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Cache* block_cache = table->rep_->options.block_cache;
+  return table->NewBlockIterator(table->rep_->file, options, index_value);
+}
+
+// Like BlockReader(), but "arg" is the TableIteratorState of a table
+// iterator and reads go through its readahead buffer.
+Iterator* Table::ReadaheadBlockReader(void* arg, const ReadOptions& options,
+                                      const Slice& index_value) {
+  TableIteratorState* state = reinterpret_cast<TableIteratorState*>(arg);
+  return state->table->NewBlockIterator(&state->file, options, index_value);
+}
+
+Iterator* Table::NewBlockIterator(RandomAccessFile* file,
+                                  const ReadOptions& options,
+                                  const Slice& index_value) const {
+  Cache* block_cache = rep_->options.block_cache;
   Block* block = nullptr;
   Cache::Handle* cache_handle = nullptr;
 
@@ -167,14 +364,13 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
     BlockContents contents;
     if (block_cache != nullptr) {
       char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
-      EncodeFixed64(cache_key_buffer + 8, handle.offset());
-      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+      Slice key =
+          BlockCacheKey(rep_->cache_id, handle.offset(), cache_key_buffer);
       cache_handle = block_cache->Lookup(key);
       if (cache_handle != nullptr) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = ReadBlockContents(file, options, handle, &contents);
         if (s.ok()) {
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
@@ -184,7 +380,7 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = ReadBlockContents(file, options, handle, &contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -193,7 +389,7 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 
   Iterator* iter;
   if (block != nullptr) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    iter = block->NewIterator(rep_->options.comparator);
     if (cache_handle == nullptr) {
       iter->RegisterCleanup(&DeleteBlock, block, nullptr);
     } else {
@@ -205,21 +401,157 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+Status Table::ReadBlockContents(RandomAccessFile* file,
+                                const ReadOptions& options,
+                                const BlockHandle& handle,
+                                BlockContents* contents) const {
+  Cache* compressed_cache = rep_->options.compressed_block_cache;
+  PersistentCache* persistent_cache = rep_->options.persistent_cache;
+  if (compressed_cache == nullptr && persistent_cache == nullptr) {
+    return ReadBlock(file, options, rep_->data_context, handle, contents);
+  }
+
+  char cache_key_buffer[16];
+  Slice key;
+  if (compressed_cache != nullptr) {
+    key = BlockCacheKey(rep_->compressed_cache_id, handle.offset(),
+                        cache_key_buffer);
+    Cache::Handle* cache_handle = compressed_cache->Lookup(key);
+    if (cache_handle != nullptr) {
+      const std::string* raw_block = reinterpret_cast<std::string*>(
+          compressed_cache->Value(cache_handle));
+      Status s = UncompressBlock(*raw_block, rep_->data_context, contents);
+      compressed_cache->Release(cache_handle);
+      return s;
+    }
+  }
+
+  std::string* raw_block = new std::string;
+  Status s;
+  if (persistent_cache != nullptr) {
+    char persistent_key_buffer[16];
+    Slice persistent_key = BlockCacheKey(
+        rep_->persistent_cache_id, handle.offset(), persistent_key_buffer);
+    bool hit = persistent_cache->Lookup(persistent_key, raw_block).ok();
+    if (hit) {
+      s = UncompressBlock(*raw_block, rep_->data_context, contents);
+      if (!s.ok()) {
+        // The cached copy is unusable, but the table file may be fine.
+        persistent_cache->Erase(persistent_key);
+        hit = false;
+      }
+    }
+    if (!hit) {
+      s = ReadBlock(file, options, rep_->data_context, handle, contents,
+                    raw_block);
+      if (s.ok() && !raw_block->empty() && options.fill_cache) {
+        persistent_cache->Insert(persistent_key, *raw_block);
+      }
+    }
+  } else {
+    s = ReadBlock(file, options, rep_->data_context, handle, contents,
+                  raw_block);
+  }
+
+  // Uncompressed blocks would only be copied again on a hit, so they go
+  // to the block cache alone.
+  if (s.ok() && compressed_cache != nullptr && !raw_block->empty() &&
+      raw_block->back() != kNoCompression && options.fill_cache) {
+    compressed_cache->Release(compressed_cache->Insert(
+        key, raw_block, raw_block->size(), &DeleteCachedRawBlock));
+  } else {
+    delete raw_block;
+  }
+  return s;
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  if (rep_->index_block != nullptr) {
+    return rep_->index_block->NewIterator(rep_->options.comparator);
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  char buf[16];
+  Slice key = BlockCacheKey(rep_->cache_id, rep_->index_handle.offset(), buf);
+  Cache::Handle* cache_handle = block_cache->Lookup(key);
+  if (cache_handle == nullptr) {
+    BlockContents contents;
+    Status s = ReadBlock(rep_->file, options, rep_->meta_context,
+                         rep_->index_handle, &contents);
+    if (!s.ok()) {
+      return NewErrorIterator(s);
+    }
+    Block* block = new Block(contents);
+    if (!contents.cachable) {
+      Iterator* iter = block->NewIterator(rep_->options.comparator);
+      iter->RegisterCleanup(&DeleteBlock, block, nullptr);
+      return iter;
+    }
+    cache_handle = block_cache->InsertHighPriority(key, block, block->size(),
+                                                   &DeleteCachedBlock);
+  }
+  Block* block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
+  Iterator* iter = block->NewIterator(rep_->options.comparator);
+  iter->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
+  return iter;
+}
+
+FilterBlockReader* Table::GetFilter(const ReadOptions& options,
+                                    Cache::Handle** cache_handle) const {
+  *cache_handle = nullptr;
+  if (!rep_->cached_filter) {
+    return rep_->filter;
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  char buf[16];
+  Slice key = BlockCacheKey(rep_->cache_id, rep_->filter_handle.offset(), buf);
+  Cache::Handle* h = block_cache->Lookup(key);
+  if (h == nullptr) {
+    BlockContents contents;
+    if (!ReadBlock(rep_->file, options, rep_->meta_context,
+                   rep_->filter_handle, &contents)
+             .ok()) {
+      // Like at open, a missing filter only costs extra block reads.
+      return nullptr;
+    }
+    if (!contents.cachable) {
+      // The filter was read into the heap at open, so this should not
+      // happen; skip filtering rather than track another owner.
+      if (contents.heap_allocated) {
+        FreeBlock(contents.allocator, contents.data.data());
+      }
+      return nullptr;
+    }
+    h = block_cache->InsertHighPriority(
+        key, new CachedFilter(rep_->options.filter_policy, contents),
+        contents.data.size(), &DeleteCachedFilter);
+  }
+  *cache_handle = h;
+  return &reinterpret_cast<CachedFilter*>(block_cache->Value(h))->reader;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  TableIteratorState* state =
+      new TableIteratorState(this, rep_->file, options.readahead_size);
+  Iterator* iter =
+      NewTwoLevelIterator(NewIndexIterator(options),
+                          &Table::ReadaheadBlockReader, state,
+                          rep_->options.comparator, options);
+  iter->RegisterCleanup(&DeleteIteratorState, state, nullptr);
+  return iter;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
                           void (*handle_result)(void*, const Slice&,
                                                 const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* iiter = NewIndexIterator(options);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
+    Cache::Handle* filter_handle;
+    FilterBlockReader* filter = GetFilter(options, &filter_handle);
     BlockHandle handle;
     if (filter != nullptr && handle.DecodeFrom(&handle_value).ok() &&
         !filter->KeyMayMatch(handle.offset(), k)) {
@@ -233,6 +565,9 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
       s = block_iter->status();
       delete block_iter;
     }
+    if (filter_handle != nullptr) {
+      rep_->options.block_cache->Release(filter_handle);
+    }
   }
   if (s.ok()) {
     s = iiter->status();
@@ -242,8 +577,7 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
 }
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -268,4 +602,12 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   return result;
 }
 
+void Table::AppendIndexKeys(std::vector<std::string>* keys) const {
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
+  for (index_iter->SeekToFirst(); index_iter->Valid(); index_iter->Next()) {
+    keys->push_back(index_iter->key().ToString());
+  }
+  delete index_iter;
+}
+
 }  // namespace leveldb
@@ -5,6 +5,8 @@
 #include "leveldb/table_builder.h"
 
 #include <cassert>
+#include <deque>
+#include <vector>
 
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -14,10 +16,204 @@
 #include "table/filter_block.h"
 #include "table/format.h"
 #include "util/coding.h"
-#include "util/crc32c.h"
+#include "util/mutexlock.h"
+#include "util/no_destructor.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
+// Compresses "raw" with options.compression, using "dictionary" if it is
+// non-null and the compression is zstd.  Returns the contents to store,
+// which are either "raw" or *compressed, and sets *type to the
+// compression they use.
+static Slice CompressBlock(const Options& options,
+                           const port::ZstdCompressionDictionary* dictionary,
+                           const Slice& raw, std::string* compressed,
+                           CompressionType* type) {
+  bool ok = false;
+  switch (options.compression) {
+    case kNoCompression:
+      break;
+    case kSnappyCompression:
+      ok = port::Snappy_Compress(raw.data(), raw.size(), compressed);
+      break;
+    case kZstdCompression:
+      ok = port::Zstd_Compress(options.zstd_compression_level, raw.data(),
+                               raw.size(), dictionary, compressed);
+      break;
+    case kLZ4Compression:
+      ok = port::Lz4_Compress(raw.data(), raw.size(), compressed);
+      break;
+    case kLZ4HCCompression:
+      ok = port::Lz4HC_Compress(options.lz4hc_compression_level, raw.data(),
+                                raw.size(), compressed);
+      break;
+  }
+  if (ok && compressed->size() < raw.size() - (raw.size() / 8u)) {
+    *type = options.compression;
+    return *compressed;
+  }
+  // Not compressed, compression not supported, or compressed less than
+  // 12.5%, so just store uncompressed form
+  *type = kNoCompression;
+  return raw;
+}
+
+namespace {
+
+// Threads shared by all table builders for compressing data blocks.  The
+// pool grows to the largest options.compression_threads asked for, so
+// that concurrent flushes and compactions share those threads instead of
+// each starting its own.
+ThreadPool* CompressionPool(int num_threads) {
+  static NoDestructor<ThreadPool> pool(num_threads);
+  pool.get()->EnsureThreads(num_threads);
+  return pool.get();
+}
+
+// A data block being compressed by a BlockCompressor.
+struct ParallelBlock {
+  std::string raw;  // Uncompressed contents
+
+  // Set by the compressing thread before "done".
+  std::string compressed;
+  Slice contents;  // Contents to store: "raw" or "compressed"
+  CompressionType type;
+  uint32_t checksum;
+  bool done;
+
+  // Owned by the building thread.
+  std::string filter_keys;  // Length-prefixed keys of the block
+  std::string index_key;    // Key of the block in the index block
+  bool has_index_key;
+};
+
+// Compresses and checksums data blocks on CompressionPool(), so that
+// building a table with a slow compressor is not limited to one core.
+// Blocks are handed back in the order they were added.
+class BlockCompressor {
+ public:
+  // "options" must stay unchanged while blocks are being compressed.
+  BlockCompressor(const Options* options, int num_threads)
+      : options_(options),
+        dictionary_(nullptr),
+        num_threads_(num_threads),
+        queued_bytes_(0),
+        cv_(&mu_),
+        in_flight_(0),
+        pool_(CompressionPool(num_threads)) {}
+
+  ~BlockCompressor() {
+    WaitForAll();
+    for (ParallelBlock* block : blocks_) {
+      delete block;
+    }
+  }
+
+  int num_threads() const { return num_threads_; }
+
+  // Number of blocks added and not yet returned by Next().
+  size_t size() const { return blocks_.size(); }
+
+  // Total uncompressed size of those blocks.
+  uint64_t queued_bytes() const { return queued_bytes_; }
+
+  // Compress the blocks added from now on with "dictionary", which must
+  // outlive them.  REQUIRES: No blocks are being compressed.
+  void SetDictionary(const port::ZstdCompressionDictionary* dictionary) {
+    dictionary_ = dictionary;
+  }
+
+  // The block added last.  REQUIRES: size() > 0.
+  ParallelBlock* newest() const { return blocks_.back(); }
+
+  // Take ownership of "block", whose "raw" contents are set, and start
+  // compressing it.
+  void Add(ParallelBlock* block) {
+    block->done = false;
+    block->has_index_key = false;
+    blocks_.push_back(block);
+    queued_bytes_ += block->raw.size();
+    {
+      MutexLock l(&mu_);
+      in_flight_++;
+    }
+    pool_->Schedule(&BlockCompressor::CompressWork, new Work{this, block});
+  }
+
+  // If the oldest block has been compressed and its index key is set,
+  // remove it and return it; the caller takes ownership.  If only its
+  // compression is missing and "wait" is true, wait for it.  Else
+  // return null.
+  ParallelBlock* Next(bool wait) {
+    if (blocks_.empty() || !blocks_.front()->has_index_key) {
+      return nullptr;
+    }
+    ParallelBlock* block = blocks_.front();
+    {
+      MutexLock l(&mu_);
+      while (!block->done) {
+        if (!wait) {
+          return nullptr;
+        }
+        cv_.Wait();
+      }
+    }
+    blocks_.pop_front();
+    queued_bytes_ -= block->raw.size();
+    return block;
+  }
+
+  // Wait until every added block has been compressed.
+  void WaitForAll() {
+    MutexLock l(&mu_);
+    while (in_flight_ > 0) {
+      cv_.Wait();
+    }
+  }
+
+ private:
+  struct Work {
+    BlockCompressor* compressor;
+    ParallelBlock* block;
+  };
+
+  static void CompressWork(void* arg) {
+    Work* work = reinterpret_cast<Work*>(arg);
+    BlockCompressor* compressor = work->compressor;
+    ParallelBlock* block = work->block;
+    delete work;
+
+    block->contents =
+        CompressBlock(*compressor->options_, compressor->dictionary_,
+                      block->raw, &block->compressed, &block->type);
+    block->checksum =
+        BlockChecksum(compressor->options_->checksum, block->contents.data(),
+                      block->contents.size(), block->type);
+
+    MutexLock l(&compressor->mu_);
+    block->done = true;
+    compressor->in_flight_--;
+    compressor->cv_.SignalAll();
+  }
+
+  const Options* const options_;
+  const port::ZstdCompressionDictionary* dictionary_;
+  const int num_threads_;
+
+  // Only used by the building thread.
+  std::deque<ParallelBlock*> blocks_;
+  uint64_t queued_bytes_;
+
+  port::Mutex mu_;
+  port::CondVar cv_ GUARDED_BY(mu_);
+  int in_flight_ GUARDED_BY(mu_);
+
+  ThreadPool* const pool_;
+};
+
+}  // namespace
+
 struct TableBuilder::Rep {
   Rep(const Options& opt, WritableFile* f)
       : options(opt),
@@ -31,7 +227,11 @@ struct TableBuilder::Rep {
         filter_block(opt.filter_policy == nullptr
                          ? nullptr
                          : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        buffering(opt.compression == kZstdCompression &&
+                  opt.zstd_max_dictionary_size > 0),
+        compression_dictionary(nullptr),
+        compressor(nullptr) {
     index_block_options.block_restart_interval = 1;
   }
 
@@ -60,6 +260,27 @@ struct TableBuilder::Rep {
   BlockHandle pending_handle;  // Handle to add to index block
 
   std::string compressed_output;
+
+  // While "buffering" is true, the table collects data to train its zstd
+  // dictionary on.  Added entries and Flush() calls are recorded in
+  // "buffered" instead of being applied, and are replayed once the
+  // dictionary has been trained.  Each record is a tag followed, for
+  // kBufferedEntry, by the length-prefixed key and value.
+  enum BufferedTag { kBufferedEntry = 1, kBufferedFlush = 2 };
+  bool buffering;
+  std::string buffered;
+
+  // Used for data blocks; empty if none.  "compression_dictionary" is
+  // "dictionary" prepared once for compressing all the blocks.
+  std::string dictionary;
+  port::ZstdCompressionDictionary* compression_dictionary;
+
+  // If options.compression_threads > 1, data blocks are compressed by
+  // "compressor" and written once they come back from it.  Their index
+  // entries and filter keys are held back until then, since their
+  // offsets are not known before.
+  BlockCompressor* compressor;
+  std::string filter_keys;  // Keys of data_block, for the filter block
 };
 
 TableBuilder::TableBuilder(const Options& options, WritableFile* file)
@@ -67,10 +288,16 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
   if (rep_->filter_block != nullptr) {
     rep_->filter_block->StartBlock(0);
   }
+  if (options.compression_threads > 1) {
+    rep_->compressor =
+        new BlockCompressor(&rep_->options, options.compression_threads);
+  }
 }
 
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
+  delete rep_->compressor;
+  port::Zstd_DeleteCompressionDictionary(rep_->compression_dictionary);
   delete rep_->filter_block;
   delete rep_;
 }
@@ -82,6 +309,9 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (rep_->compressor != nullptr) {
+    rep_->compressor->WaitForAll();
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -99,21 +329,48 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     assert(r->options.comparator->Compare(key, Slice(r->last_key)) > 0);
   }
 
+  if (r->buffering) {
+    r->buffered.push_back(Rep::kBufferedEntry);
+    PutLengthPrefixedSlice(&r->buffered, key);
+    PutLengthPrefixedSlice(&r->buffered, value);
+    r->last_key.assign(key.data(), key.size());
+    r->num_entries++;
+    if (r->buffered.size() >= r->options.zstd_max_train_bytes) {
+      WriteBuffered();
+    }
+    return;
+  }
+
+  AddToDataBlock(key, value);
+  r->num_entries++;
+}
+
+void TableBuilder::AddToDataBlock(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
     r->options.comparator->FindShortestSeparator(&r->last_key, key);
-    std::string handle_encoding;
-    r->pending_handle.EncodeTo(&handle_encoding);
-    r->index_block.Add(r->last_key, Slice(handle_encoding));
+    if (r->compressor != nullptr) {
+      ParallelBlock* block = r->compressor->newest();
+      block->index_key = r->last_key;
+      block->has_index_key = true;
+    } else {
+      std::string handle_encoding;
+      r->pending_handle.EncodeTo(&handle_encoding);
+      r->index_block.Add(r->last_key, Slice(handle_encoding));
+    }
     r->pending_index_entry = false;
   }
 
   if (r->filter_block != nullptr) {
-    r->filter_block->AddKey(key);
+    if (r->compressor != nullptr) {
+      PutLengthPrefixedSlice(&r->filter_keys, key);
+    } else {
+      r->filter_block->AddKey(key);
+    }
   }
 
   r->last_key.assign(key.data(), key.size());
-  r->num_entries++;
   r->data_block.Add(key, value);
 
   const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
@@ -126,8 +383,23 @@ void TableBuilder::Flush() {
   Rep* r = rep_;
   assert(!r->closed);
   if (!ok()) return;
+  if (r->buffering) {
+    r->buffered.push_back(Rep::kBufferedFlush);
+    return;
+  }
   if (r->data_block.empty()) return;
   assert(!r->pending_index_entry);
+  if (r->compressor != nullptr) {
+    ParallelBlock* block = new ParallelBlock;
+    block->raw = r->data_block.Finish().ToString();
+    block->filter_keys.swap(r->filter_keys);
+    r->data_block.Reset();
+    r->compressor->Add(block);
+    r->pending_index_entry = true;
+    // Keep a few blocks per thread queued, to bound the memory used.
+    WriteCompressedBlocks(2 * r->compressor->num_threads());
+    return;
+  }
   WriteBlock(&r->data_block, &r->pending_handle);
   if (ok()) {
     r->pending_index_entry = true;
@@ -138,6 +410,97 @@ void TableBuilder::Flush() {
   }
 }
 
+void TableBuilder::WriteBuffered() {
+  Rep* r = rep_;
+  r->buffering = false;
+
+  // Train the dictionary on the data blocks the buffered entries make up.
+  std::string samples;
+  std::vector<size_t> sample_sizes;
+  BlockBuilder block(&r->options);
+  Slice input = r->buffered;
+  while (!input.empty()) {
+    const char tag = input[0];
+    input.remove_prefix(1);
+    if (tag == Rep::kBufferedEntry) {
+      Slice key, value;
+      GetLengthPrefixedSlice(&input, &key);
+      GetLengthPrefixedSlice(&input, &value);
+      block.Add(key, value);
+    }
+    if (!block.empty() && (tag == Rep::kBufferedFlush || input.empty() ||
+                           block.CurrentSizeEstimate() >=
+                               r->options.block_size)) {
+      Slice raw = block.Finish();
+      samples.append(raw.data(), raw.size());
+      sample_sizes.push_back(raw.size());
+      block.Reset();
+    }
+  }
+  if (!port::Zstd_TrainDictionary(samples.data(), sample_sizes.data(),
+                                  sample_sizes.size(),
+                                  r->options.zstd_max_dictionary_size,
+                                  &r->dictionary)) {
+    // Too little data, most likely; compress without a dictionary.
+    r->dictionary.clear();
+  } else {
+    // Data blocks compressed with the dictionary use the level it is
+    // prepared for here, even if ChangeOptions() changes it later.
+    r->compression_dictionary = port::Zstd_NewCompressionDictionary(
+        r->options.zstd_compression_level, r->dictionary.data(),
+        r->dictionary.size());
+    if (r->compression_dictionary == nullptr) {
+      r->dictionary.clear();
+    } else if (r->compressor != nullptr) {
+      r->compressor->SetDictionary(r->compression_dictionary);
+    }
+  }
+
+  // Replay the buffered entries.
+  input = r->buffered;
+  while (!input.empty() && ok()) {
+    const char tag = input[0];
+    input.remove_prefix(1);
+    if (tag == Rep::kBufferedEntry) {
+      Slice key, value;
+      GetLengthPrefixedSlice(&input, &key);
+      GetLengthPrefixedSlice(&input, &value);
+      AddToDataBlock(key, value);
+    } else {
+      Flush();
+    }
+  }
+  std::string().swap(r->buffered);
+}
+
+void TableBuilder::WriteCompressedBlocks(size_t max_queued) {
+  Rep* r = rep_;
+  ParallelBlock* block;
+  while ((block = r->compressor->Next(r->compressor->size() > max_queued)) !=
+         nullptr) {
+    if (ok()) {
+      BlockHandle handle;
+      WriteChecksummedBlock(block->contents, block->type, block->checksum,
+                            &handle);
+      if (ok()) {
+        std::string handle_encoding;
+        handle.EncodeTo(&handle_encoding);
+        r->index_block.Add(block->index_key, Slice(handle_encoding));
+        r->status = r->file->Flush();
+      }
+      if (r->filter_block != nullptr) {
+        Slice input = block->filter_keys;
+        Slice key;
+        while (GetLengthPrefixedSlice(&input, &key)) {
+          r->filter_block->AddKey(key);
+        }
+        r->filter_block->StartBlock(r->offset);
+      }
+    }
+    delete block;
+  }
+}
+
 void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
@@ -147,28 +510,13 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   Rep* r = rep_;
   Slice raw = block->Finish();
 
-  Slice block_contents;
-  CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
-  switch (type) {
-    case kNoCompression:
-      block_contents = raw;
-      break;
-
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
-          compressed->size() < raw.size() - (raw.size() / 8u)) {
-        block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        block_contents = raw;
-        type = kNoCompression;
-      }
-      break;
-    }
-  }
+  // Only data blocks use the dictionary, so that it is not needed to
+  // read the index and meta blocks.
+  const port::ZstdCompressionDictionary* dictionary =
+      (block == &r->data_block) ? r->compression_dictionary : nullptr;
+  CompressionType type;
+  Slice block_contents =
+      CompressBlock(r->options, dictionary, raw, &r->compressed_output, &type);
   WriteRawBlock(block_contents, type, handle);
   r->compressed_output.clear();
   block->Reset();
@@ -176,6 +524,17 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
 
 void TableBuilder::WriteRawBlock(const Slice& block_contents,
                                  CompressionType type, BlockHandle* handle) {
+  WriteChecksummedBlock(
+      block_contents, type,
+      BlockChecksum(rep_->options.checksum, block_contents.data(),
+                    block_contents.size(), type),
+      handle);
+}
+
+void TableBuilder::WriteChecksummedBlock(const Slice& block_contents,
+                                         CompressionType type,
+                                         uint32_t checksum,
+                                         BlockHandle* handle) {
   Rep* r = rep_;
   handle->set_offset(r->offset);
   handle->set_size(block_contents.size());
@@ -183,9 +542,7 @@ void TableBuilder::WriteRawBlock(const Slice& block_contents,
   if (r->status.ok()) {
     char trailer[kBlockTrailerSize];
     trailer[0] = type;
-    uint32_t crc = crc32c::Value(block_contents.data(), block_contents.size());
-    crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
-    EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+    EncodeFixed32(trailer + 1, checksum);
     r->status = r->file->Append(Slice(trailer, kBlockTrailerSize));
     if (r->status.ok()) {
       r->offset += block_contents.size() + kBlockTrailerSize;
@@ -197,11 +554,25 @@ Status TableBuilder::status() const { return rep_->status; }
 
 Status TableBuilder::Finish() {
   Rep* r = rep_;
+  if (r->buffering && ok()) {
+    WriteBuffered();
+  }
   Flush();
+  if (r->compressor != nullptr && ok()) {
+    if (r->pending_index_entry) {
+      r->options.comparator->FindShortSuccessor(&r->last_key);
+      ParallelBlock* block = r->compressor->newest();
+      block->index_key = r->last_key;
+      block->has_index_key = true;
+      r->pending_index_entry = false;
+    }
+    WriteCompressedBlocks(0);
+  }
   assert(!r->closed);
   r->closed = true;
 
-  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle,
+      dictionary_handle;
 
   // Write filter block
   if (ok() && r->filter_block != nullptr) {
@@ -209,6 +580,11 @@ Status TableBuilder::Finish() {
                   &filter_block_handle);
   }
 
+  // Write dictionary block
+  if (ok() && !r->dictionary.empty()) {
+    WriteRawBlock(r->dictionary, kNoCompression, &dictionary_handle);
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
@@ -220,6 +596,12 @@ Status TableBuilder::Finish() {
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    if (!r->dictionary.empty()) {
+      // Keys must be added in order, and "zstd." sorts after "filter.".
+      std::string handle_encoding;
+      dictionary_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(kZstdDictionaryKey, handle_encoding);
+    }
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -242,6 +624,7 @@ Status TableBuilder::Finish() {
     Footer footer;
     footer.set_metaindex_handle(metaindex_block_handle);
     footer.set_index_handle(index_block_handle);
+    footer.set_checksum_type(r->options.checksum);
     std::string footer_encoding;
     footer.EncodeTo(&footer_encoding);
     r->status = r->file->Append(footer_encoding);
@@ -260,6 +643,15 @@ void TableBuilder::Abandon() {
 
 uint64_t TableBuilder::NumEntries() const { return rep_->num_entries; }
 
-uint64_t TableBuilder::FileSize() const { return rep_->offset; }
+uint64_t TableBuilder::FileSize() const {
+  // Count the blocks that are still being compressed, and the entries
+  // held back to train the dictionary on, at their uncompressed size, so
+  // that callers cutting tables at a size do not overshoot it.
+  uint64_t size = rep_->offset + rep_->buffered.size();
+  if (rep_->compressor != nullptr) {
+    size += rep_->compressor->queued_bytes();
+  }
+  return size;
+}
 
 }  // namespace leveldb
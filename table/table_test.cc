@@ -4,6 +4,7 @@
 
 #include "leveldb/table.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 
@@ -11,13 +12,17 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
 #include "leveldb/iterator.h"
+#include "leveldb/memory_allocator.h"
 #include "leveldb/table_builder.h"
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
+#include "util/coding.h"
 #include "util/random.h"
 #include "util/testutil.h"
 
@@ -109,14 +114,18 @@ class StringSink : public WritableFile {
 class StringSource : public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {}
+      : contents_(contents.data(), contents.size()), num_reads_(0) {}
 
   ~StringSource() override = default;
 
   uint64_t Size() const { return contents_.size(); }
 
+  // Number of Read() calls made so far.
+  int num_reads() const { return num_reads_.load(std::memory_order_relaxed); }
+
   Status Read(uint64_t offset, size_t n, Slice* result,
               char* scratch) const override {
+    num_reads_.fetch_add(1, std::memory_order_relaxed);
     if (offset >= contents_.size()) {
       return Status::InvalidArgument("invalid Read offset");
     }
@@ -130,6 +139,8 @@ class StringSource : public RandomAccessFile {
 
  private:
   std::string contents_;
+  // Read() may be called on the prefetch thread.
+  mutable std::atomic<int> num_reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -721,6 +732,46 @@ TEST_F(Harness, RandomizedLongDB) {
   ASSERT_GT(files, 0);
 }
 
+TEST(BlockTest, PrevMixedWithNext) {
+  Options options;
+  options.block_restart_interval = 16;
+  BlockBuilder builder(&options);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 100; i++) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "key%04d", i);
+    keys.push_back(buf);
+    builder.Add(keys.back(), "v" + keys.back());
+  }
+  BlockContents contents;
+  contents.data = builder.Finish();
+  contents.cachable = false;
+  contents.heap_allocated = false;
+  Block block(contents);
+  Iterator* iter = block.NewIterator(BytewiseComparator());
+
+  // Walk backwards, stepping forward now and then, across several
+  // restart intervals.
+  iter->SeekToLast();
+  int pos = 99;
+  for (int step = 0; pos > 0; step++) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(keys[pos], iter->key().ToString());
+    ASSERT_EQ("v" + keys[pos], iter->value().ToString());
+    if (step % 5 == 4) {
+      iter->Next();
+      pos++;
+      ASSERT_EQ(keys[pos], iter->key().ToString());
+    }
+    iter->Prev();
+    pos--;
+  }
+  ASSERT_EQ(keys[0], iter->key().ToString());
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
 TEST(MemTableTest, Simple) {
   InternalKeyComparator cmp(BytewiseComparator());
   MemTable* memtable = new MemTable(cmp);
@@ -826,6 +877,689 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
 }
 
+// Returns the number of file reads made by a full scan of "table".
+static int CountScanReads(const Table* table, const StringSource& source,
+                          const ReadOptions& options, int* num_keys) {
+  const int reads_before = source.num_reads();
+  Iterator* iter = table->NewIterator(options);
+  *num_keys = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ++*num_keys;
+  }
+  EXPECT_LEVELDB_OK(iter->status());
+  delete iter;
+  return source.num_reads() - reads_before;
+}
+
+TEST(TableTest, SequentialScanReadsAhead) {
+  const int kNumKeys = 2000;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < kNumKeys; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(100, 'v'));
+  }
+  ASSERT_LEVELDB_OK(builder.Finish());
+
+  StringSource source(sink.contents());
+  Options table_options;  // No block cache, so every block is read
+  Table* table = nullptr;
+  ASSERT_LEVELDB_OK(
+      Table::Open(table_options, &source, sink.contents().size(), &table));
+
+  // Roughly one block per 1024 bytes of data.
+  const int num_blocks = kNumKeys * 110 / 1024;
+  int num_keys;
+  const int adaptive_reads =
+      CountScanReads(table, source, ReadOptions(), &num_keys);
+  ASSERT_EQ(kNumKeys, num_keys);
+  ASSERT_LT(adaptive_reads, num_blocks / 4);
+
+  ReadOptions fixed;
+  fixed.readahead_size = 64 * 1024;
+  const int fixed_reads = CountScanReads(table, source, fixed, &num_keys);
+  ASSERT_EQ(kNumKeys, num_keys);
+  ASSERT_LE(fixed_reads, static_cast<int>(sink.contents().size() / 65536 + 1));
+
+  // Point lookups through seeks do not read ahead.
+  const int reads_before = source.num_reads();
+  Iterator* iter = table->NewIterator(ReadOptions());
+  iter->Seek("k001000");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("k001000", iter->key().ToString());
+  iter->Seek("k000010");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("k000010", iter->key().ToString());
+  delete iter;
+  ASSERT_EQ(2, source.num_reads() - reads_before);
+
+  delete table;
+}
+
+// Build a table of "num_keys" keys with the given checksum type.
+static std::string BuildChecksummedTable(ChecksumType checksum,
+                                         int num_keys) {
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  options.checksum = checksum;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < num_keys; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  EXPECT_LEVELDB_OK(builder.Finish());
+  return sink.contents();
+}
+
+// Scan "contents" as a table, verifying checksums, and return the status
+// of the scan.
+static Status ScanTable(const std::string& contents, int* num_keys) {
+  StringSource source(contents);
+  Options options;
+  options.paranoid_checks = true;
+  Table* table = nullptr;
+  Status s = Table::Open(options, &source, contents.size(), &table);
+  if (!s.ok()) {
+    return s;
+  }
+  ReadOptions read_options;
+  read_options.verify_checksums = true;
+  Iterator* iter = table->NewIterator(read_options);
+  *num_keys = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    (*num_keys)++;
+  }
+  s = iter->status();
+  delete iter;
+  delete table;
+  return s;
+}
+
+static uint64_t FooterMagic(const std::string& contents) {
+  return DecodeFixed64(contents.data() + contents.size() - 8);
+}
+
+TEST(TableTest, ChecksumTypes) {
+  const int kNumKeys = 500;
+  const ChecksumType kTypes[] = {kCRC32cChecksum, kXXH3Checksum};
+  for (ChecksumType type : kTypes) {
+    std::string contents = BuildChecksummedTable(type, kNumKeys);
+    // Tables using the original checksum keep the original footer, so
+    // that older versions can still read them.
+    ASSERT_EQ(type == kCRC32cChecksum ? kTableMagicNumber : kTableMagicNumberV2,
+              FooterMagic(contents));
+
+    int num_keys;
+    ASSERT_LEVELDB_OK(ScanTable(contents, &num_keys));
+    ASSERT_EQ(kNumKeys, num_keys);
+
+    // A flipped bit in a data block is detected.
+    contents[10] ^= 0x1;
+    ASSERT_TRUE(ScanTable(contents, &num_keys).IsCorruption()) << type;
+  }
+}
+
+TEST(TableTest, UnknownChecksumType) {
+  std::string contents = BuildChecksummedTable(kXXH3Checksum, 10);
+  const size_t type_offset = contents.size() - Footer::kEncodedLength +
+                             2 * BlockHandle::kMaxEncodedLength - 1;
+  ASSERT_EQ(kXXH3Checksum, contents[type_offset]);
+  contents[type_offset] = 0x7f;
+  int num_keys;
+  ASSERT_TRUE(ScanTable(contents, &num_keys).IsCorruption());
+}
+
+static bool ZstdCompressionSupported() {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  return port::Zstd_Compress(1, in.data(), in.size(), nullptr, &out);
+}
+
+// A small record that resembles its neighbours, like rows of a table.
+static std::string RecordTestValue(int i) {
+  char buf[200];
+  std::snprintf(buf, sizeof(buf),
+                "{\"id\": %d, \"name\": \"user%d\", \"email\": "
+                "\"user%d@example.com\", \"active\": %s, \"score\": %d}",
+                i, i * 7919 % 10007, i * 104729 % 100003,
+                (i % 3 == 0) ? "true" : "false", i * 31 % 977);
+  return buf;
+}
+
+// Build a table of "num_keys" RecordTestValue() entries with "options",
+// calling Flush() after every "flush_every" entries if non-zero.
+static std::string BuildCompressedTable(const Options& options,
+                                        int num_keys, int flush_every) {
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < num_keys; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, RecordTestValue(i));
+    if (flush_every != 0 && i % flush_every == flush_every - 1) {
+      builder.Flush();
+    }
+  }
+  EXPECT_LEVELDB_OK(builder.Finish());
+  EXPECT_EQ(num_keys, builder.NumEntries());
+  EXPECT_EQ(sink.contents().size(), builder.FileSize());
+  return sink.contents();
+}
+
+// Check that "contents" holds the table built by BuildCompressedTable(),
+// with and without a compressed block cache.
+static void CheckCompressedTable(const std::string& contents, int num_keys) {
+  for (int use_cache = 0; use_cache < 2; use_cache++) {
+    StringSource source(contents);
+    Options options;
+    options.compressed_block_cache = use_cache ? NewLRUCache(1 << 20) : nullptr;
+    Table* table = nullptr;
+    ASSERT_LEVELDB_OK(Table::Open(options, &source, contents.size(), &table));
+    for (int pass = 0; pass < 2; pass++) {
+      ReadOptions read_options;
+      read_options.verify_checksums = true;
+      Iterator* iter = table->NewIterator(read_options);
+      char key[20];
+      int i = 0;
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+        std::snprintf(key, sizeof(key), "k%06d", i);
+        ASSERT_EQ(key, iter->key().ToString());
+        ASSERT_EQ(RecordTestValue(i), iter->value().ToString());
+      }
+      ASSERT_LEVELDB_OK(iter->status());
+      ASSERT_EQ(num_keys, i);
+      delete iter;
+    }
+    delete table;
+    delete options.compressed_block_cache;
+  }
+}
+
+TEST(TableTest, ZstdCompression) {
+  if (!ZstdCompressionSupported()) {
+    std::fprintf(stderr, "skipping zstd tests\n");
+    return;
+  }
+
+  const int kNumKeys = 2000;
+  Options options;
+  options.compression = kNoCompression;
+  const std::string plain = BuildCompressedTable(options, kNumKeys, 0);
+  options.compression = kZstdCompression;
+  const std::string compressed = BuildCompressedTable(options, kNumKeys, 0);
+  CheckCompressedTable(compressed, kNumKeys);
+  ASSERT_LT(compressed.size(), plain.size() / 2);
+
+  options.zstd_compression_level = 19;
+  const std::string high = BuildCompressedTable(options, kNumKeys, 0);
+  CheckCompressedTable(high, kNumKeys);
+  ASSERT_LE(high.size(), compressed.size());
+}
+
+TEST(TableTest, ZstdDictionary) {
+  if (!ZstdCompressionSupported()) {
+    std::fprintf(stderr, "skipping zstd tests\n");
+    return;
+  }
+
+  const int kNumKeys = 20000;
+  Options options;
+  options.compression = kZstdCompression;
+  const std::string plain = BuildCompressedTable(options, kNumKeys, 0);
+
+  options.zstd_max_dictionary_size = 16 * 1024;
+  options.zstd_max_train_bytes = 1 << 20;  // More than the table holds
+  const std::string trained_at_finish =
+      BuildCompressedTable(options, kNumKeys, 0);
+  ASSERT_NE(std::string::npos, trained_at_finish.find(kZstdDictionaryKey));
+  CheckCompressedTable(trained_at_finish, kNumKeys);
+  ASSERT_LT(trained_at_finish.size(), plain.size());
+
+  // Training halfway through, with explicit block boundaries.
+  options.zstd_max_train_bytes = 512 * 1024;
+  const std::string trained_early = BuildCompressedTable(options, kNumKeys, 50);
+  ASSERT_NE(std::string::npos, trained_early.find(kZstdDictionaryKey));
+  CheckCompressedTable(trained_early, kNumKeys);
+
+  // Too little data to train on; the table is written without one.
+  const std::string untrained = BuildCompressedTable(options, 5, 0);
+  ASSERT_EQ(std::string::npos, untrained.find(kZstdDictionaryKey));
+  CheckCompressedTable(untrained, 5);
+}
+
+static bool Lz4CompressionSupported() {
+  std::string out;
+  Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+  return port::Lz4_Compress(in.data(), in.size(), &out);
+}
+
+TEST(TableTest, Lz4Compression) {
+  if (!Lz4CompressionSupported()) {
+    std::fprintf(stderr, "skipping lz4 tests\n");
+    return;
+  }
+
+  const int kNumKeys = 2000;
+  Options options;
+  options.compression = kNoCompression;
+  const std::string plain = BuildCompressedTable(options, kNumKeys, 0);
+  options.compression = kLZ4Compression;
+  const std::string compressed = BuildCompressedTable(options, kNumKeys, 0);
+  CheckCompressedTable(compressed, kNumKeys);
+  ASSERT_LT(compressed.size(), plain.size() / 2);
+
+  options.compression = kLZ4HCCompression;
+  const std::string high = BuildCompressedTable(options, kNumKeys, 0);
+  CheckCompressedTable(high, kNumKeys);
+  ASSERT_LE(high.size(), compressed.size());
+}
+
+TEST(TableTest, Lz4CorruptLength) {
+  std::string out;
+  if (!port::Lz4_Compress("hello hello hello", 17, &out)) {
+    std::fprintf(stderr, "skipping lz4 tests\n");
+    return;
+  }
+  size_t length;
+  ASSERT_TRUE(port::Lz4_GetUncompressedLength(out.data(), out.size(), &length));
+  ASSERT_EQ(17u, length);
+  char buf[17];
+  ASSERT_TRUE(port::Lz4_Uncompress(out.data(), out.size(), buf));
+  ASSERT_EQ("hello hello hello", std::string(buf, 17));
+
+  // A shorter length than the data decompresses to is rejected.
+  out[0] = 16;
+  ASSERT_FALSE(port::Lz4_Uncompress(out.data(), out.size(), buf));
+  ASSERT_FALSE(port::Lz4_GetUncompressedLength(out.data(), 3, &length));
+}
+
+// Scan a table compressed with "type" twice through a compressed block
+// cache and a zero-capacity block cache, which misses every time.
+static void CheckCompressedBlockCache(CompressionType type) {
+  const int kNumKeys = 2000;
+  Options options;
+  options.block_size = 1024;
+  options.compression = type;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < kNumKeys; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  ASSERT_LEVELDB_OK(builder.Finish());
+
+  StringSource source(sink.contents());
+  Options table_options;
+  table_options.block_cache = NewLRUCache(0);
+  table_options.compressed_block_cache = NewLRUCache(1 << 20);
+  Table* table = nullptr;
+  ASSERT_LEVELDB_OK(
+      Table::Open(table_options, &source, sink.contents().size(), &table));
+
+  int num_keys;
+  ASSERT_GT(CountScanReads(table, source, ReadOptions(), &num_keys), 0);
+  ASSERT_EQ(kNumKeys, num_keys);
+  if (type == kNoCompression) {
+    // Uncompressed blocks are not worth caching twice, so every scan
+    // goes back to the file.
+    ASSERT_EQ(0, table_options.compressed_block_cache->TotalCharge());
+    ASSERT_GT(CountScanReads(table, source, ReadOptions(), &num_keys), 0);
+  } else {
+    // Once filled, the compressed cache serves all blocks.
+    ASSERT_GT(table_options.compressed_block_cache->TotalCharge(), 0);
+    ASSERT_EQ(0, CountScanReads(table, source, ReadOptions(), &num_keys));
+  }
+  ASSERT_EQ(kNumKeys, num_keys);
+
+  // Contents served from the compressed cache are intact.
+  Iterator* iter = table->NewIterator(ReadOptions());
+  int i = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    ASSERT_EQ(key, iter->key().ToString());
+    ASSERT_EQ(std::string(100, 'a' + (i % 26)), iter->value().ToString());
+  }
+  ASSERT_EQ(kNumKeys, i);
+  delete iter;
+
+  delete table;
+  delete table_options.block_cache;
+  delete table_options.compressed_block_cache;
+}
+
+TEST(TableTest, CompressedBlockCache) {
+  std::vector<CompressionType> types;
+  if (SnappyCompressionSupported()) types.push_back(kSnappyCompression);
+  if (ZstdCompressionSupported()) types.push_back(kZstdCompression);
+  if (Lz4CompressionSupported()) types.push_back(kLZ4Compression);
+  if (types.empty()) {
+    std::fprintf(stderr, "skipping compression tests\n");
+    return;
+  }
+  for (CompressionType type : types) {
+    CheckCompressedBlockCache(type);
+  }
+}
+
+TEST(TableTest, CompressedBlockCacheSkipsUncompressedBlocks) {
+  CheckCompressedBlockCache(kNoCompression);
+}
+
+TEST(TableTest, ParallelCompression) {
+  const int kNumKeys = 5000;
+  std::vector<CompressionType> types = {kNoCompression};
+  if (SnappyCompressionSupported()) types.push_back(kSnappyCompression);
+  if (ZstdCompressionSupported()) types.push_back(kZstdCompression);
+  if (Lz4CompressionSupported()) types.push_back(kLZ4Compression);
+
+  const FilterPolicy* filter_policy = NewBloomFilterPolicy(10);
+  for (CompressionType type : types) {
+    for (int use_filter = 0; use_filter < 2; use_filter++) {
+      Options options;
+      options.compression = type;
+      options.filter_policy = use_filter ? filter_policy : nullptr;
+      if (type == kZstdCompression) {
+        options.zstd_max_dictionary_size = 16 * 1024;
+        options.zstd_max_train_bytes = 256 * 1024;
+      }
+      const std::string inline_table =
+          BuildCompressedTable(options, kNumKeys, 0);
+
+      // Tables built in parallel are identical, whatever the number of
+      // threads and wherever the block boundaries fall.
+      for (int threads : {2, 4}) {
+        options.compression_threads = threads;
+        ASSERT_EQ(inline_table, BuildCompressedTable(options, kNumKeys, 0))
+            << type << " " << threads;
+      }
+      options.compression_threads = 1;
+      const std::string flushed = BuildCompressedTable(options, kNumKeys, 7);
+      options.compression_threads = 3;
+      ASSERT_EQ(flushed, BuildCompressedTable(options, kNumKeys, 7));
+      CheckCompressedTable(flushed, kNumKeys);
+    }
+  }
+  delete filter_policy;
+}
+
+TEST(TableTest, ParallelCompressionFileSize) {
+  Options options;
+  options.compression = kNoCompression;
+  StringSink inline_sink, parallel_sink;
+  TableBuilder inline_builder(options, &inline_sink);
+  options.compression_threads = 4;
+  TableBuilder parallel_builder(options, &parallel_sink);
+
+  // Blocks still queued for compression count towards the size, so it
+  // never lags the inline builder by whole blocks.
+  char key[20];
+  for (int i = 0; i < 5000; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    inline_builder.Add(key, RecordTestValue(i));
+    parallel_builder.Add(key, RecordTestValue(i));
+    ASSERT_GE(parallel_builder.FileSize() + options.block_size,
+              inline_builder.FileSize())
+        << i;
+  }
+  ASSERT_LEVELDB_OK(inline_builder.Finish());
+  ASSERT_LEVELDB_OK(parallel_builder.Finish());
+  ASSERT_EQ(inline_builder.FileSize(), parallel_builder.FileSize());
+}
+
+TEST(TableTest, AsyncPrefetchScan) {
+  const int kNumKeys = 2000;
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < kNumKeys; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(100, 'a' + (i % 26)));
+  }
+  ASSERT_LEVELDB_OK(builder.Finish());
+
+  StringSource source(sink.contents());
+  Options table_options;
+  table_options.block_cache = NewLRUCache(1 << 20);
+  Table* table = nullptr;
+  ASSERT_LEVELDB_OK(
+      Table::Open(table_options, &source, sink.contents().size(), &table));
+
+  ReadOptions read_options;
+  read_options.async_prefetch = true;
+  Iterator* iter = table->NewIterator(read_options);
+  int i = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    ASSERT_EQ(key, iter->key().ToString());
+    ASSERT_EQ(std::string(100, 'a' + (i % 26)), iter->value().ToString());
+  }
+  ASSERT_EQ(kNumKeys, i);
+  ASSERT_LEVELDB_OK(iter->status());
+
+  // Seeks and reverse steps discard or consume any in-flight prefetch.
+  iter->Seek("k000500");
+  for (int j = 500; j < 1500; j++) {
+    ASSERT_TRUE(iter->Valid());
+    iter->Next();
+  }
+  iter->Seek("k000100");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("k000100", iter->key().ToString());
+  iter->Next();
+  iter->Prev();
+  iter->Prev();
+  ASSERT_EQ("k000099", iter->key().ToString());
+  delete iter;
+
+  // Destroying an iterator with a prefetch in flight is safe.
+  iter = table->NewIterator(read_options);
+  iter->SeekToFirst();
+  for (int j = 0; j < 50; j++) {
+    iter->Next();
+  }
+  delete iter;
+
+  delete table;
+  delete table_options.block_cache;
+}
+
+TEST(TableTest, AsyncPrefetchAfterSeek) {
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char key[20];
+  for (int i = 0; i < 1000; i++) {
+    std::snprintf(key, sizeof(key), "k%06d", i);
+    builder.Add(key, std::string(100, 'x'));
+  }
+  ASSERT_LEVELDB_OK(builder.Finish());
+
+  StringSource source(sink.contents());
+  Table* table = nullptr;
+  ASSERT_LEVELDB_OK(
+      Table::Open(Options(), &source, sink.contents().size(), &table));
+
+  // Returns the number of blocks read by a Seek() to "target".  Deleting
+  // the iterator waits for any prefetch it started.
+  auto blocks_read = [&](const ReadOptions& read_options,
+                         const char* target) {
+    const int before = source.num_reads();
+    Iterator* iter = table->NewIterator(read_options);
+    iter->Seek(target);
+    EXPECT_TRUE(iter->Valid());
+    delete iter;
+    return source.num_reads() - before;
+  };
+
+  ReadOptions read_options;
+  read_options.async_prefetch = true;
+  ASSERT_EQ(2, blocks_read(read_options, "k000000"));
+  ASSERT_EQ(2, blocks_read(read_options, "k000500"));
+
+  // The block after the one found is not read if it lies past the
+  // upper bound.
+  Slice upper("k000001");
+  read_options.iterate_upper_bound = &upper;
+  ASSERT_EQ(1, blocks_read(read_options, "k000000"));
+  upper = "k000500";
+  ASSERT_EQ(2, blocks_read(read_options, "k000000"));
+
+  delete table;
+}
+
+TEST(TableTest, OpenSkipsEmptyMetaindex) {
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  for (bool with_filter : {false, true}) {
+    Options options;
+    options.compression = kNoCompression;
+    if (with_filter) options.filter_policy = policy;
+    StringSink sink;
+    TableBuilder builder(options, &sink);
+    builder.Add("k1", "v1");
+    builder.Add("k2", "v2");
+    ASSERT_LEVELDB_OK(builder.Finish());
+
+    // The footer and index block are always read.  The metaindex block,
+    // and then the filter, only if the table has one.
+    StringSource source(sink.contents());
+    Table* table = nullptr;
+    ASSERT_LEVELDB_OK(
+        Table::Open(options, &source, sink.contents().size(), &table));
+    ASSERT_EQ(with_filter ? 4 : 2, source.num_reads()) << with_filter;
+    delete table;
+  }
+  delete policy;
+}
+
+// A MemoryAllocator that counts its calls.
+class CountingAllocator : public MemoryAllocator {
+ public:
+  CountingAllocator() : allocations(0), deallocations(0) {}
+
+  const char* Name() const override { return "CountingAllocator"; }
+
+  void* Allocate(size_t size) override {
+    allocations++;
+    return new char[size];
+  }
+
+  void Deallocate(void* p) override {
+    deallocations++;
+    delete[] reinterpret_cast<char*>(p);
+  }
+
+  int allocations;
+  int deallocations;
+};
+
+TEST(TableTest, BlockAllocator) {
+  const int kNumKeys = 2000;
+  std::vector<CompressionType> types = {kNoCompression, kSnappyCompression};
+  if (ZstdCompressionSupported()) types.push_back(kZstdCompression);
+  if (Lz4CompressionSupported()) types.push_back(kLZ4Compression);
+
+  const FilterPolicy* filter_policy = NewBloomFilterPolicy(10);
+  for (CompressionType type : types) {
+    Options options;
+    options.compression = type;
+    options.filter_policy = filter_policy;
+    const std::string contents = BuildCompressedTable(options, kNumKeys, 0);
+
+    CountingAllocator allocator;
+    StringSource source(contents);
+    options.block_cache = NewLRUCache(8 << 20);
+    options.block_allocator = &allocator;
+    Table* table = nullptr;
+    ASSERT_LEVELDB_OK(Table::Open(options, &source, contents.size(), &table));
+    const int open_allocations = allocator.allocations;
+    const int open_deallocations = allocator.deallocations;
+    ASSERT_GT(open_allocations, 0);
+
+    Iterator* iter = table->NewIterator(ReadOptions());
+    int i = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+      ASSERT_EQ(RecordTestValue(i), iter->value().ToString());
+    }
+    ASSERT_LEVELDB_OK(iter->status());
+    ASSERT_EQ(kNumKeys, i);
+    delete iter;
+
+    // Every block was read or decompressed straight into the memory that
+    // the block cache now holds, without temporary buffers.
+    ASSERT_GT(allocator.allocations, open_allocations) << type;
+    ASSERT_EQ(open_deallocations, allocator.deallocations) << type;
+
+    delete table;
+    delete options.block_cache;
+    ASSERT_EQ(allocator.allocations, allocator.deallocations) << type;
+  }
+  delete filter_policy;
+}
+
+// A file that serves reads from its own memory, like an mmap-ed file.
+class MemorySource : public RandomAccessFile {
+ public:
+  MemorySource(const Slice& contents) : contents_(contents) {}
+
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              char* scratch) const override {
+    if (offset + n > contents_.size()) {
+      return Status::InvalidArgument("invalid Read offset");
+    }
+    *result = Slice(contents_.data() + offset, n);
+    return Status::OK();
+  }
+
+ private:
+  const Slice contents_;
+};
+
+TEST(TableTest, MemoryBackedBlocksAreNotCopied) {
+  const int kNumKeys = 2000;
+  Options options;
+  options.compression = kNoCompression;
+  const std::string contents = BuildCompressedTable(options, kNumKeys, 0);
+
+  CountingAllocator allocator;
+  MemorySource source(contents);
+  options.block_cache = NewLRUCache(8 << 20);
+  options.block_allocator = &allocator;
+  Table* table = nullptr;
+  ASSERT_LEVELDB_OK(Table::Open(options, &source, contents.size(), &table));
+
+  Iterator* iter = table->NewIterator(ReadOptions());
+  int i = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+    ASSERT_EQ(RecordTestValue(i), iter->value().ToString());
+    ASSERT_GE(iter->value().data(), contents.data());
+    ASSERT_LT(iter->value().data(), contents.data() + contents.size());
+  }
+  ASSERT_LEVELDB_OK(iter->status());
+  ASSERT_EQ(kNumKeys, i);
+  delete iter;
+
+  // The blocks are used in place, so they are neither held in allocated
+  // memory nor cached.
+  ASSERT_EQ(allocator.allocations, allocator.deallocations);
+  ASSERT_EQ(0, options.block_cache->TotalCharge());
+
+  delete table;
+  delete options.block_cache;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
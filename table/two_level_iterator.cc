@@ -4,10 +4,16 @@
 
 #include "table/two_level_iterator.h"
 
+#include <vector>
+
+#include "leveldb/comparator.h"
 #include "leveldb/table.h"
 #include "table/block.h"
 #include "table/format.h"
 #include "table/iterator_wrapper.h"
+#include "util/mutexlock.h"
+#include "util/no_destructor.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
@@ -15,10 +21,61 @@ namespace {
 
 typedef Iterator* (*BlockFunction)(void*, const ReadOptions&, const Slice&);
 
+// Threads shared by all iterators for asynchronous block prefetches.
+// Prefetches are I/O bound, so a few threads go a long way.
+static const int kNumPrefetchThreads = 4;
+
+ThreadPool* PrefetchPool() {
+  static NoDestructor<ThreadPool> pool(kNumPrefetchThreads);
+  return pool.get();
+}
+
+// A block_function call running on the prefetch pool.
+struct Prefetch {
+  Prefetch(BlockFunction block_function, void* arg, const ReadOptions& options,
+           const Slice& handle)
+      : block_function(block_function),
+        arg(arg),
+        options(options),
+        handle(handle.data(), handle.size()),
+        cv(&mu),
+        done(false),
+        result(nullptr) {}
+
+  static void Run(void* arg) {
+    Prefetch* prefetch = reinterpret_cast<Prefetch*>(arg);
+    Iterator* result = (*prefetch->block_function)(
+        prefetch->arg, prefetch->options, prefetch->handle);
+    MutexLock l(&prefetch->mu);
+    prefetch->result = result;
+    prefetch->done = true;
+    prefetch->cv.Signal();
+  }
+
+  // Blocks until Run() has finished.
+  void Wait() {
+    MutexLock l(&mu);
+    while (!done) {
+      cv.Wait();
+    }
+  }
+
+  const BlockFunction block_function;
+  void* const arg;
+  const ReadOptions options;
+  const std::string handle;
+
+  port::Mutex mu;
+  port::CondVar cv;
+  bool done GUARDED_BY(mu);
+  Iterator* result;  // Written by Run() before "done" is set
+};
+
 class TwoLevelIterator : public Iterator {
  public:
   TwoLevelIterator(Iterator* index_iter, BlockFunction block_function,
-                   void* arg, const ReadOptions& options);
+                   void* arg, const Comparator* comparator,
+                   const ReadOptions& options);
 
   ~TwoLevelIterator() override;
 
@@ -56,33 +113,69 @@ class TwoLevelIterator : public Iterator {
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
+  void MaybePrefetchNextBlock();
+  Iterator* TakePrefetchedBlock(const Slice& handle);
 
   BlockFunction block_function_;
   void* arg_;
-  const ReadOptions options_;
+  const Comparator* const comparator_;
+  // Copy of *options.iterate_upper_bound, which options_ points at.
+  const std::string upper_bound_;
+  const Slice upper_bound_slice_;
+  ReadOptions options_;
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_;  // May be nullptr
   // If data_iter_ is non-null, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+  // In-flight or completed read of the block after data_iter_'s, or
+  // nullptr.  At most one block_function_ call is outstanding at a
+  // time, so block_function_ never runs concurrently for one iterator.
+  Prefetch* prefetch_;
+  // Data iterators that were moved past while options_.pin_data is set.
+  // They keep their blocks alive until this iterator is deleted.
+  std::vector<Iterator*> pinned_iters_;
 };
 
 TwoLevelIterator::TwoLevelIterator(Iterator* index_iter,
                                    BlockFunction block_function, void* arg,
+                                   const Comparator* comparator,
                                    const ReadOptions& options)
     : block_function_(block_function),
       arg_(arg),
+      comparator_(comparator),
+      upper_bound_(options.iterate_upper_bound != nullptr
+                       ? options.iterate_upper_bound->ToString()
+                       : std::string()),
+      upper_bound_slice_(upper_bound_),
       options_(options),
       index_iter_(index_iter),
-      data_iter_(nullptr) {}
+      data_iter_(nullptr),
+      prefetch_(nullptr) {
+  // The caller's bounds need not outlive this iterator, but options_ is
+  // handed to block_function_ long after construction.  The lower bound
+  // is not used below this level.
+  options_.iterate_lower_bound = nullptr;
+  if (options.iterate_upper_bound != nullptr) {
+    options_.iterate_upper_bound = &upper_bound_slice_;
+  }
+}
 
-TwoLevelIterator::~TwoLevelIterator() = default;
+TwoLevelIterator::~TwoLevelIterator() {
+  // The prefetch may be using state that is cleaned up with this
+  // iterator, so let it finish first.
+  delete TakePrefetchedBlock(Slice());
+  for (size_t i = 0; i < pinned_iters_.size(); i++) {
+    delete pinned_iters_[i];
+  }
+}
 
 void TwoLevelIterator::Seek(const Slice& target) {
   index_iter_.Seek(target);
   InitDataBlock();
   if (data_iter_.iter() != nullptr) data_iter_.Seek(target);
+  MaybePrefetchNextBlock();
   SkipEmptyDataBlocksForward();
 }
 
@@ -90,6 +183,7 @@ void TwoLevelIterator::SeekToFirst() {
   index_iter_.SeekToFirst();
   InitDataBlock();
   if (data_iter_.iter() != nullptr) data_iter_.SeekToFirst();
+  MaybePrefetchNextBlock();
   SkipEmptyDataBlocksForward();
 }
 
@@ -122,6 +216,7 @@ void TwoLevelIterator::SkipEmptyDataBlocksForward() {
     index_iter_.Next();
     InitDataBlock();
     if (data_iter_.iter() != nullptr) data_iter_.SeekToFirst();
+    MaybePrefetchNextBlock();
   }
 }
 
@@ -139,7 +234,12 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
 }
 
 void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
-  if (data_iter_.iter() != nullptr) SaveError(data_iter_.status());
+  if (data_iter_.iter() != nullptr) {
+    SaveError(data_iter_.status());
+    if (options_.pin_data) {
+      pinned_iters_.push_back(data_iter_.Release());
+    }
+  }
   data_iter_.Set(data_iter);
 }
 
@@ -153,19 +253,70 @@ void TwoLevelIterator::InitDataBlock() {
       // data_iter_ is already constructed with this iterator, so
       // no need to change anything
     } else {
-      Iterator* iter = (*block_function_)(arg_, options_, handle);
+      Iterator* iter = TakePrefetchedBlock(handle);
+      if (iter == nullptr) {
+        iter = (*block_function_)(arg_, options_, handle);
+      }
       data_block_handle_.assign(handle.data(), handle.size());
       SetDataIterator(iter);
     }
   }
 }
 
+// Called after a forward seek or scan has moved into a new block: start
+// reading the block after it so that the read overlaps with the
+// processing of the current block.
+void TwoLevelIterator::MaybePrefetchNextBlock() {
+  if (!options_.async_prefetch || prefetch_ != nullptr ||
+      !index_iter_.Valid()) {
+    return;
+  }
+  // Every key of the next block is greater than the current index key,
+  // so if that key is at or past the upper bound the next block is not
+  // needed.
+  if (options_.iterate_upper_bound != nullptr &&
+      comparator_->Compare(index_iter_.key(), upper_bound_slice_) >= 0) {
+    return;
+  }
+  index_iter_.Next();
+  if (index_iter_.Valid()) {
+    prefetch_ = new Prefetch(block_function_, arg_, options_,
+                             index_iter_.value());
+    PrefetchPool()->Schedule(&Prefetch::Run, prefetch_);
+  }
+  // Return to the current block's index entry.
+  if (index_iter_.Valid()) {
+    index_iter_.Prev();
+  } else {
+    index_iter_.SeekToLast();
+  }
+}
+
+// Waits for any outstanding prefetch.  Returns its iterator if it read
+// the block for "handle", and nullptr otherwise.
+Iterator* TwoLevelIterator::TakePrefetchedBlock(const Slice& handle) {
+  if (prefetch_ == nullptr) {
+    return nullptr;
+  }
+  prefetch_->Wait();
+  Iterator* result = prefetch_->result;
+  if (handle.compare(prefetch_->handle) != 0) {
+    delete result;
+    result = nullptr;
+  }
+  delete prefetch_;
+  prefetch_ = nullptr;
+  return result;
+}
+
 }  // namespace
 
 Iterator* NewTwoLevelIterator(Iterator* index_iter,
                               BlockFunction block_function, void* arg,
+                              const Comparator* comparator,
                               const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+  return new TwoLevelIterator(index_iter, block_function, arg, comparator,
+                              options);
 }
 
 }  // namespace leveldb
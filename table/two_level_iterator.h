@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Comparator;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,11 +21,17 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// "comparator" orders the keys of index_iter.  If
+// options.iterate_upper_bound is set, it is compared with the index
+// keys using "comparator", and blocks that lie entirely at or past it
+// are not prefetched.  The bound is copied, so it only needs to remain
+// live for the duration of this call.
 Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(void* arg, const ReadOptions& options,
                                 const Slice& index_value),
-    void* arg, const ReadOptions& options);
+    void* arg, const Comparator* comparator, const ReadOptions& options);
 
 }  // namespace leveldb
 
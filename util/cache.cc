@@ -34,9 +34,21 @@ namespace {
 //   removed the check, elements that would otherwise be on this list could be
 //   left as disconnected singleton lists.)
 // - LRU:  contains the items not currently referenced by clients, in LRU order
+// - protected:  like LRU, but for items that have been looked up at least
+//   once since they were inserted (scan-resistant caches only) and for
+//   items inserted with high priority.  Eviction only takes items from
+//   this list once the LRU list is empty.
 // Elements are moved between these lists by the Ref() and Unref() methods,
 // when they detect an element in the cache acquiring or losing its only
 // external reference.
+//
+// A scan-resistant cache is a segmented LRU.  New entries start out on
+// probation (the LRU list) and are promoted when they are looked up again.
+// Promoted entries may use at most protected_capacity_ of the cache; when
+// they exceed it the oldest unreferenced ones are demoted to the newest
+// end of the LRU list.  Eviction drains the LRU list before touching
+// protected entries, so a scan that touches every block once only
+// displaces other blocks on probation.
 
 // An entry is a variable length heap-allocated structure.  Entries
 // are kept in a circular doubly linked list ordered by access time.
@@ -48,10 +60,11 @@ struct LRUHandle {
   LRUHandle* prev;
   size_t charge;  // TODO(opt): Only allow uint32_t?
   size_t key_length;
-  bool in_cache;     // Whether entry is in the cache.
-  uint32_t refs;     // References, including cache reference, if present.
-  uint32_t hash;     // Hash of key(); used for fast sharding and comparisons
-  char key_data[1];  // Beginning of key
+  bool in_cache;      // Whether entry is in the cache.
+  bool in_protected;  // Whether entry counts against protected_usage_.
+  uint32_t refs;      // References, including cache reference, if present.
+  uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  char key_data[1];   // Beginning of key
 
   Slice key() const {
     // next_ is only equal to this if the LRU handle is the list head of an
@@ -155,10 +168,14 @@ class LRUCache {
 
   // Separate from constructor so caller can easily make an array of LRUCache
   void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetProtectedCapacity(size_t capacity) { protected_capacity_ = capacity; }
+  void SetScanResistant(bool scan_resistant) {
+    scan_resistant_ = scan_resistant;
+  }
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash, void* value,
-                        size_t charge,
+                        size_t charge, bool high_priority,
                         void (*deleter)(const Slice& key, void* value));
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
@@ -174,20 +191,31 @@ class LRUCache {
   void LRU_Append(LRUHandle* list, LRUHandle* e);
   void Ref(LRUHandle* e);
   void Unref(LRUHandle* e);
+  void Promote(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void DemoteOverflow() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   bool FinishErase(LRUHandle* e) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Initialized before use.
   size_t capacity_;
+  // Bounds the protected list, which holds high-priority entries and, if
+  // the cache is scan-resistant, entries that were looked up again.
+  size_t protected_capacity_;
+  bool scan_resistant_;
 
   // mutex_ protects the following state.
   mutable port::Mutex mutex_;
   size_t usage_ GUARDED_BY(mutex_);
+  size_t protected_usage_ GUARDED_BY(mutex_);
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
   // Entries have refs==1 and in_cache==true.
   LRUHandle lru_ GUARDED_BY(mutex_);
 
+  // Dummy head of protected list.
+  // Entries have refs==1, in_cache==true and in_protected==true.
+  LRUHandle protected_ GUARDED_BY(mutex_);
+
   // Dummy head of in-use list.
   // Entries are in use by clients, and have refs >= 2 and in_cache==true.
   LRUHandle in_use_ GUARDED_BY(mutex_);
@@ -195,10 +223,17 @@ class LRUCache {
   HandleTable table_ GUARDED_BY(mutex_);
 };
 
-LRUCache::LRUCache() : capacity_(0), usage_(0) {
+LRUCache::LRUCache()
+    : capacity_(0),
+      protected_capacity_(0),
+      scan_resistant_(false),
+      usage_(0),
+      protected_usage_(0) {
   // Make empty circular linked lists.
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  protected_.next = &protected_;
+  protected_.prev = &protected_;
   in_use_.next = &in_use_;
   in_use_.prev = &in_use_;
 }
@@ -213,10 +248,18 @@ LRUCache::~LRUCache() {
     Unref(e);
     e = next;
   }
+  for (LRUHandle* e = protected_.next; e != &protected_;) {
+    LRUHandle* next = e->next;
+    assert(e->in_cache);
+    e->in_cache = false;
+    assert(e->refs == 1);  // Invariant of protected_ list.
+    Unref(e);
+    e = next;
+  }
 }
 
 void LRUCache::Ref(LRUHandle* e) {
-  if (e->refs == 1 && e->in_cache) {  // If on lru_ list, move to in_use_ list.
+  if (e->refs == 1 && e->in_cache) {  // If on an LRU list, move to in_use_.
     LRU_Remove(e);
     LRU_Append(&in_use_, e);
   }
@@ -231,9 +274,35 @@ void LRUCache::Unref(LRUHandle* e) {
     (*e->deleter)(e->key(), e->value);
     free(e);
   } else if (e->in_cache && e->refs == 1) {
-    // No longer in use; move to lru_ list.
+    // No longer in use; move to lru_ or protected_ list.
     LRU_Remove(e);
-    LRU_Append(&lru_, e);
+    LRU_Append(e->in_protected ? &protected_ : &lru_, e);
+  }
+}
+
+// Move a cached entry that has just been looked up out of probation.
+// Only used by a scan-resistant cache.
+void LRUCache::Promote(LRUHandle* e) {
+  assert(e->in_cache && e->refs >= 2);
+  if (e->in_protected) {
+    return;
+  }
+  e->in_protected = true;
+  protected_usage_ += e->charge;
+  DemoteOverflow();
+}
+
+// Move the oldest unreferenced protected entries back on probation until
+// the protected segment fits in protected_capacity_.
+void LRUCache::DemoteOverflow() {
+  while (protected_usage_ > protected_capacity_ &&
+         protected_.next != &protected_) {
+    LRUHandle* old = protected_.next;
+    assert(old->refs == 1);
+    old->in_protected = false;
+    protected_usage_ -= old->charge;
+    LRU_Remove(old);
+    LRU_Append(&lru_, old);
   }
 }
 
@@ -255,6 +324,9 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
     Ref(e);
+    if (scan_resistant_) {
+      Promote(e);
+    }
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -265,7 +337,7 @@ void LRUCache::Release(Cache::Handle* handle) {
 }
 
 Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
-                                size_t charge,
+                                size_t charge, bool high_priority,
                                 void (*deleter)(const Slice& key,
                                                 void* value)) {
   MutexLock l(&mutex_);
@@ -278,6 +350,7 @@ Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
   e->key_length = key.size();
   e->hash = hash;
   e->in_cache = false;
+  e->in_protected = false;
   e->refs = 1;  // for the returned handle.
   std::memcpy(e->key_data, key.data(), key.size());
 
@@ -287,12 +360,24 @@ Cache::Handle* LRUCache::Insert(const Slice& key, uint32_t hash, void* value,
     LRU_Append(&in_use_, e);
     usage_ += charge;
     FinishErase(table_.Insert(e));
+    if (high_priority) {
+      e->in_protected = true;
+      protected_usage_ += charge;
+      DemoteOverflow();
+    }
   } else {  // don't cache. (capacity_==0 is supported and turns off caching.)
     // next is read by key() in an assert, so it must be initialized
     e->next = nullptr;
   }
-  while (usage_ > capacity_ && lru_.next != &lru_) {
+  while (usage_ > capacity_) {
+    // Evict entries on probation first.
     LRUHandle* old = lru_.next;
+    if (old == &lru_) {
+      old = protected_.next;
+      if (old == &protected_) {
+        break;
+      }
+    }
     assert(old->refs == 1);
     bool erased = FinishErase(table_.Remove(old->key(), old->hash));
     if (!erased) {  // to avoid unused variable when compiled NDEBUG
@@ -311,6 +396,10 @@ bool LRUCache::FinishErase(LRUHandle* e) {
     LRU_Remove(e);
     e->in_cache = false;
     usage_ -= e->charge;
+    if (e->in_protected) {
+      e->in_protected = false;
+      protected_usage_ -= e->charge;
+    }
     Unref(e);
   }
   return e != nullptr;
@@ -323,12 +412,14 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
 
 void LRUCache::Prune() {
   MutexLock l(&mutex_);
-  while (lru_.next != &lru_) {
-    LRUHandle* e = lru_.next;
-    assert(e->refs == 1);
-    bool erased = FinishErase(table_.Remove(e->key(), e->hash));
-    if (!erased) {  // to avoid unused variable when compiled NDEBUG
-      assert(erased);
+  for (LRUHandle* list : {&lru_, &protected_}) {
+    while (list->next != list) {
+      LRUHandle* e = list->next;
+      assert(e->refs == 1);
+      bool erased = FinishErase(table_.Remove(e->key(), e->hash));
+      if (!erased) {  // to avoid unused variable when compiled NDEBUG
+        assert(erased);
+      }
     }
   }
 }
@@ -336,6 +427,10 @@ void LRUCache::Prune() {
 static const int kNumShardBits = 4;
 static const int kNumShards = 1 << kNumShardBits;
 
+// Share of the capacity of a cache that is not scan-resistant that
+// high-priority entries may use.  The oldest ones beyond it are evicted
+// like other entries, so that they cannot push all of those out.
+static const double kHighPriorityFraction = 0.5;
 class ShardedLRUCache : public Cache {
  private:
   LRUCache shard_[kNumShards];
@@ -349,17 +444,29 @@ class ShardedLRUCache : public Cache {
   static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
 
  public:
-  explicit ShardedLRUCache(size_t capacity) : last_id_(0) {
+  ShardedLRUCache(size_t capacity, double protected_fraction)
+      : last_id_(0) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
       shard_[s].SetCapacity(per_shard);
+      shard_[s].SetScanResistant(protected_fraction > 0.0);
+      shard_[s].SetProtectedCapacity(static_cast<size_t>(
+          per_shard * (protected_fraction > 0.0 ? protected_fraction
+                                                : kHighPriorityFraction)));
     }
   }
   ~ShardedLRUCache() override {}
   Handle* Insert(const Slice& key, void* value, size_t charge,
                  void (*deleter)(const Slice& key, void* value)) override {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, false,
+                                      deleter);
+  }
+  Handle* InsertHighPriority(const Slice& key, void* value, size_t charge,
+                             void (*deleter)(const Slice& key,
+                                             void* value)) override {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, true, deleter);
   }
   Handle* Lookup(const Slice& key) override {
     const uint32_t hash = HashSlice(key);
@@ -396,6 +503,14 @@ class ShardedLRUCache : public Cache {
 
 }  // end anonymous namespace
 
-Cache* NewLRUCache(size_t capacity) { return new ShardedLRUCache(capacity); }
+Cache* NewLRUCache(size_t capacity) {
+  return new ShardedLRUCache(capacity, 0.0);
+}
+
+Cache* NewScanResistantLRUCache(size_t capacity, double protected_fraction) {
+  if (protected_fraction < 0.0) protected_fraction = 0.0;
+  if (protected_fraction > 1.0) protected_fraction = 1.0;
+  return new ShardedLRUCache(capacity, protected_fraction);
+}
 
 }  // namespace leveldb
@@ -4,10 +4,13 @@
 
 #include "leveldb/cache.h"
 
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
 #include "util/coding.h"
+#include "util/random.h"
 
 namespace leveldb {
 
@@ -24,7 +27,10 @@ static int DecodeKey(const Slice& k) {
 static void* EncodeValue(uintptr_t v) { return reinterpret_cast<void*>(v); }
 static int DecodeValue(void* v) { return reinterpret_cast<uintptr_t>(v); }
 
-class CacheTest : public testing::Test {
+enum CacheType { kLRUCache, kScanResistantLRUCache, kClockCache };
+
+// Runs every test against each Cache implementation.
+class CacheTest : public testing::TestWithParam<CacheType> {
  public:
   static void Deleter(const Slice& key, void* v) {
     current_->deleted_keys_.push_back(DecodeKey(key));
@@ -36,7 +42,7 @@ class CacheTest : public testing::Test {
   std::vector<int> deleted_values_;
   Cache* cache_;
 
-  CacheTest() : cache_(NewLRUCache(kCacheSize)) { current_ = this; }
+  CacheTest() : cache_(NewCache(kCacheSize)) { current_ = this; }
 
   ~CacheTest() { delete cache_; }
 
@@ -59,12 +65,24 @@ class CacheTest : public testing::Test {
                           &CacheTest::Deleter);
   }
 
+  // The tests use a charge of 1 per entry.
+  Cache* NewCache(size_t capacity) {
+    switch (GetParam()) {
+      case kScanResistantLRUCache:
+        return NewScanResistantLRUCache(capacity);
+      case kClockCache:
+        return NewClockCache(capacity, 1);
+      default:
+        return NewLRUCache(capacity);
+    }
+  }
+
   void Erase(int key) { cache_->Erase(EncodeKey(key)); }
   static CacheTest* current_;
 };
 CacheTest* CacheTest::current_;
 
-TEST_F(CacheTest, HitAndMiss) {
+TEST_P(CacheTest, HitAndMiss) {
   ASSERT_EQ(-1, Lookup(100));
 
   Insert(100, 101);
@@ -87,7 +105,7 @@ TEST_F(CacheTest, HitAndMiss) {
   ASSERT_EQ(101, deleted_values_[0]);
 }
 
-TEST_F(CacheTest, Erase) {
+TEST_P(CacheTest, Erase) {
   Erase(200);
   ASSERT_EQ(0, deleted_keys_.size());
 
@@ -106,7 +124,7 @@ TEST_F(CacheTest, Erase) {
   ASSERT_EQ(1, deleted_keys_.size());
 }
 
-TEST_F(CacheTest, EntriesArePinned) {
+TEST_P(CacheTest, EntriesArePinned) {
   Insert(100, 101);
   Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
   ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
@@ -131,7 +149,7 @@ TEST_F(CacheTest, EntriesArePinned) {
   ASSERT_EQ(102, deleted_values_[1]);
 }
 
-TEST_F(CacheTest, EvictionPolicy) {
+TEST_P(CacheTest, EvictionPolicy) {
   Insert(100, 101);
   Insert(200, 201);
   Insert(300, 301);
@@ -150,7 +168,7 @@ TEST_F(CacheTest, EvictionPolicy) {
   cache_->Release(h);
 }
 
-TEST_F(CacheTest, UseExceedsCacheSize) {
+TEST_P(CacheTest, UseExceedsCacheSize) {
   // Overfill the cache, keeping handles on all inserted entries.
   std::vector<Cache::Handle*> h;
   for (int i = 0; i < kCacheSize + 100; i++) {
@@ -167,7 +185,7 @@ TEST_F(CacheTest, UseExceedsCacheSize) {
   }
 }
 
-TEST_F(CacheTest, HeavyEntries) {
+TEST_P(CacheTest, HeavyEntries) {
   // Add a bunch of light and heavy entries and then count the combined
   // size of items still in the cache, which must be approximately the
   // same as the total capacity.
@@ -194,13 +212,13 @@ TEST_F(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
 }
 
-TEST_F(CacheTest, NewId) {
+TEST_P(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
   ASSERT_NE(a, b);
 }
 
-TEST_F(CacheTest, Prune) {
+TEST_P(CacheTest, Prune) {
   Insert(1, 100);
   Insert(2, 200);
 
@@ -213,14 +231,130 @@ TEST_F(CacheTest, Prune) {
   ASSERT_EQ(-1, Lookup(2));
 }
 
-TEST_F(CacheTest, ZeroSizeCache) {
+TEST_P(CacheTest, HighPriorityEntriesLeaveRoomForOthers) {
+  // Fill the cache with high-priority entries, then add others.
+  for (int i = 0; i < kCacheSize; i++) {
+    cache_->Release(cache_->InsertHighPriority(
+        EncodeKey(i), EncodeValue(i), 1, &CacheTest::Deleter));
+  }
+  for (int i = kCacheSize; i < kCacheSize + kCacheSize / 2; i++) {
+    Insert(i, i);
+  }
+
+  // Many of the new entries are kept, as are many high-priority ones.
+  // A scan-resistant cache gives high-priority entries the largest share.
+  int normal = 0;
+  for (int i = kCacheSize; i < kCacheSize + kCacheSize / 2; i++) {
+    normal += (Lookup(i) == i);
+  }
+  int high = 0;
+  for (int i = 0; i < kCacheSize; i++) {
+    high += (Lookup(i) == i);
+  }
+  ASSERT_GT(normal, kCacheSize / 8);
+  ASSERT_GT(high, kCacheSize / 4);
+}
+
+TEST_P(CacheTest, ZeroSizeCache) {
   delete cache_;
-  cache_ = NewLRUCache(0);
+  cache_ = NewCache(0);
 
   Insert(1, 100);
   ASSERT_EQ(-1, Lookup(1));
 }
 
+static std::atomic<int> concurrent_deletions(0);
+
+static void CountingDeleter(const Slice& key, void* v) {
+  // Values are always derived from keys, so a mismatch means a lookup
+  // returned the wrong entry or an entry was freed twice.
+  EXPECT_EQ(DecodeKey(key) * 2, DecodeValue(v));
+  concurrent_deletions.fetch_add(1);
+}
+
+TEST_P(CacheTest, ConcurrentAccess) {
+  const int kNumThreads = 4;
+  const int kOpsPerThread = 20000;
+  const int kNumKeys = 2 * kCacheSize;
+  delete cache_;
+  cache_ = NewCache(kCacheSize);
+  concurrent_deletions = 0;
+  std::atomic<int> insertions(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([this, t, &insertions]() {
+      Random rnd(301 + t);
+      for (int i = 0; i < kOpsPerThread; i++) {
+        const int key = rnd.Uniform(kNumKeys);
+        const int op = rnd.Uniform(10);
+        if (op < 7) {
+          Cache::Handle* h = cache_->Lookup(EncodeKey(key));
+          if (h != nullptr) {
+            ASSERT_EQ(key * 2, DecodeValue(cache_->Value(h)));
+            cache_->Release(h);
+          }
+        } else if (op < 9) {
+          cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(key * 2),
+                                         1, &CountingDeleter));
+          insertions.fetch_add(1);
+        } else {
+          cache_->Erase(EncodeKey(key));
+        }
+      }
+    });
+  }
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  // Capacity is split evenly between shards, so allow for rounding.
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize + kCacheSize / 10);
+
+  // Every inserted entry is deleted exactly once.
+  delete cache_;
+  cache_ = nullptr;
+  ASSERT_EQ(insertions.load(), concurrent_deletions.load());
+}
+
+TEST(ScanResistantCacheTest, ScanDoesNotEvictWorkingSet) {
+  const int kCacheSize = 1000;
+  const int kNumHot = 100;
+  Cache* cache = NewScanResistantLRUCache(kCacheSize);
+  auto insert = [cache](int key) {
+    cache->Release(cache->Insert(EncodeKey(key), EncodeValue(key), 1,
+                                 [](const Slice& key, void* value) {}));
+  };
+  auto contains = [cache](int key) {
+    Cache::Handle* h = cache->Lookup(EncodeKey(key));
+    if (h != nullptr) {
+      cache->Release(h);
+    }
+    return h != nullptr;
+  };
+
+  // Build a working set that has been hit at least twice.
+  for (int i = 0; i < kNumHot; i++) {
+    insert(i);
+    ASSERT_TRUE(contains(i));
+  }
+
+  // Scan many more keys than fit in the cache, touching each once.
+  for (int i = kNumHot; i < kNumHot + 10 * kCacheSize; i++) {
+    ASSERT_FALSE(contains(i));
+    insert(i);
+  }
+
+  for (int i = 0; i < kNumHot; i++) {
+    ASSERT_TRUE(contains(i)) << i;
+  }
+  delete cache;
+}
+
+INSTANTIATE_TEST_SUITE_P(LRU, CacheTest, testing::Values(kLRUCache));
+INSTANTIATE_TEST_SUITE_P(ScanResistantLRU, CacheTest,
+                         testing::Values(kScanResistantLRUCache));
+INSTANTIATE_TEST_SUITE_P(Clock, CacheTest, testing::Values(kClockCache));
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
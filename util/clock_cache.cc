@@ -0,0 +1,460 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "leveldb/cache.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// CLOCK cache implementation
+//
+// Each shard keeps its entries in a fixed-size open-addressed hash table.
+// Slots are never freed, only reused, so Lookup() and Release() can work
+// on them without taking the shard mutex.  Every slot has a 64-bit "meta"
+// word that packs the slot's state, the number of references held by
+// clients, and a CLOCK countdown.  State transitions are:
+//
+//   kEmpty --Insert()--> kConstruction --> kVisible
+//   kVisible --Erase() or replaced by Insert()--> kInvisible
+//   kInvisible --last Release()--> kEmpty
+//   kVisible, unreferenced, countdown 0 --eviction--> kConstruction --> kEmpty
+//
+// Lookup() takes a reference with a compare-and-swap that only succeeds
+// while the slot is kVisible, and every transition out of kVisible that
+// reuses the slot requires the reference count to be zero, so a slot's
+// contents cannot change under a client holding a reference.  Insert(),
+// Erase(), eviction and the freeing of entries are serialized by the
+// shard mutex.
+//
+// The table uses linear probing.  Each slot counts the entries whose probe
+// sequence passes over it ("displacements"), which lets Lookup() stop at
+// the first slot no entry has been displaced past, and lets removal work
+// without tombstones.
+//
+// Eviction sweeps a clock hand over the table.  A lookup sets the entry's
+// countdown to kMaxCountdown; the hand decrements the countdown of each
+// unreferenced entry it passes and evicts entries whose countdown is zero.
+
+enum SlotState : uint64_t {
+  kEmpty = 0,
+  kConstruction = 1,
+  kVisible = 2,
+  kInvisible = 3,
+};
+
+static const int kCountdownShift = 32;
+static const int kStateShift = 34;
+static const uint64_t kRefMask = (uint64_t{1} << kCountdownShift) - 1;
+static const uint64_t kInitialCountdown = 1;
+static const uint64_t kMaxCountdown = 3;
+
+static inline uint64_t Refs(uint64_t meta) { return meta & kRefMask; }
+static inline uint64_t Countdown(uint64_t meta) {
+  return (meta >> kCountdownShift) & 3;
+}
+static inline uint64_t State(uint64_t meta) { return meta >> kStateShift; }
+static inline uint64_t MakeMeta(uint64_t state, uint64_t countdown,
+                                uint64_t refs) {
+  return (state << kStateShift) | (countdown << kCountdownShift) | refs;
+}
+
+struct ClockHandle {
+  std::atomic<uint64_t> meta;
+  std::atomic<uint32_t> hash;  // Only a hint unless a reference is held
+  std::atomic<uint32_t> displacements;
+
+  // Written while the slot is kConstruction.  Read by clients holding a
+  // reference, or by threads holding the shard mutex.
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  char* key_data;
+  size_t key_length;
+  size_t charge;
+  bool detached;  // Not in any table; deleted by its last Release()
+
+  ClockHandle()
+      : meta(MakeMeta(kEmpty, 0, 0)),
+        hash(0),
+        displacements(0),
+        value(nullptr),
+        deleter(nullptr),
+        key_data(nullptr),
+        key_length(0),
+        charge(0),
+        detached(false) {}
+
+  Slice key() const { return Slice(key_data, key_length); }
+
+  // Passes the key and value to the deleter and frees the key copy.
+  void FreeData() {
+    (*deleter)(key(), value);
+    delete[] key_data;
+    key_data = nullptr;
+  }
+};
+
+// Takes a reference on "h" if it is visible.
+static bool TryRef(ClockHandle* h) {
+  uint64_t meta = h->meta.load(std::memory_order_acquire);
+  while (State(meta) == kVisible) {
+    if (h->meta.compare_exchange_weak(meta, meta + 1,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A single shard of sharded cache.
+class ClockCache {
+ public:
+  ClockCache();
+  ~ClockCache();
+
+  // Separate from constructor so caller can easily make an array of
+  // ClockCache.  "length" must be a power of two.
+  void Init(size_t capacity, uint32_t length);
+
+  // Like Cache methods, but with an extra "hash" parameter.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash, void* value,
+                        size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  void Prune();
+  size_t TotalCharge() const {
+    MutexLock l(&mutex_);
+    return usage_;
+  }
+
+ private:
+  uint32_t HomeIndex(uint32_t hash) const { return hash & (length_ - 1); }
+
+  // Marks the visible entry for "key" (if any) invisible, freeing it if
+  // it is not referenced.
+  void EraseLocked(const Slice& key, uint32_t hash)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Sweeps the clock hand until "charge" more bytes fit in the capacity
+  // and the table has room for another entry, or until nothing more can
+  // be evicted.
+  void EvictLocked(size_t charge) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Frees the entry in "h" and returns the slot to kEmpty.
+  // REQUIRES: the caller owns "h" exclusively (kConstruction, or
+  // kInvisible with no references).
+  void Remove(ClockHandle* h) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  ClockHandle* slots_;
+  uint32_t length_;
+  size_t capacity_;
+  size_t max_occupancy_;
+
+  mutable port::Mutex mutex_;
+  size_t usage_ GUARDED_BY(mutex_);
+  size_t occupancy_ GUARDED_BY(mutex_);
+  uint32_t clock_hand_ GUARDED_BY(mutex_);
+};
+
+ClockCache::ClockCache()
+    : slots_(nullptr),
+      length_(0),
+      capacity_(0),
+      max_occupancy_(0),
+      usage_(0),
+      occupancy_(0),
+      clock_hand_(0) {}
+
+ClockCache::~ClockCache() {
+  for (uint32_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    const uint64_t meta = h->meta.load(std::memory_order_acquire);
+    if (State(meta) != kEmpty) {
+      assert(State(meta) == kVisible);  // Error if caller has an unreleased
+      assert(Refs(meta) == 0);          // handle
+      h->FreeData();
+    }
+  }
+  delete[] slots_;
+}
+
+void ClockCache::Init(size_t capacity, uint32_t length) {
+  assert((length & (length - 1)) == 0);
+  capacity_ = capacity;
+  length_ = length;
+  // Keep probe sequences short.
+  max_occupancy_ = length - length / 4;
+  slots_ = new ClockHandle[length];
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key, uint32_t hash) {
+  const uint32_t home = HomeIndex(hash);
+  for (uint32_t probes = 0; probes < length_; probes++) {
+    ClockHandle* h = &slots_[(home + probes) & (length_ - 1)];
+    if (h->hash.load(std::memory_order_relaxed) == hash && TryRef(h)) {
+      if (h->key() == key) {
+        uint64_t meta = h->meta.load(std::memory_order_relaxed);
+        while (Countdown(meta) < kMaxCountdown &&
+               !h->meta.compare_exchange_weak(
+                   meta,
+                   (meta & ~(uint64_t{3} << kCountdownShift)) |
+                       (kMaxCountdown << kCountdownShift),
+                   std::memory_order_relaxed)) {
+        }
+        return reinterpret_cast<Cache::Handle*>(h);
+      }
+      Release(reinterpret_cast<Cache::Handle*>(h));
+    }
+    if (h->displacements.load(std::memory_order_acquire) == 0) {
+      break;
+    }
+  }
+  return nullptr;
+}
+
+void ClockCache::Release(Cache::Handle* handle) {
+  ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+  const uint64_t old_meta = h->meta.fetch_sub(1, std::memory_order_acq_rel);
+  assert(Refs(old_meta) > 0);
+  if (Refs(old_meta) == 1 && State(old_meta) == kInvisible) {
+    // Invisible entries cannot gain references, so this thread is the
+    // only one that can free it.
+    if (h->detached) {
+      h->FreeData();
+      delete h;
+    } else {
+      MutexLock l(&mutex_);
+      Remove(h);
+    }
+  }
+}
+
+Cache::Handle* ClockCache::Insert(const Slice& key, uint32_t hash,
+                                  void* value, size_t charge,
+                                  void (*deleter)(const Slice& key,
+                                                  void* value)) {
+  MutexLock l(&mutex_);
+  EraseLocked(key, hash);
+
+  ClockHandle* h = nullptr;
+  if (capacity_ > 0) {
+    EvictLocked(charge);
+    // Only Insert() fills empty slots, so under mutex_ a slot seen as
+    // kEmpty stays that way until we claim it.
+    const uint32_t home = HomeIndex(hash);
+    uint32_t probes = 0;
+    for (; probes < length_; probes++) {
+      ClockHandle* slot = &slots_[(home + probes) & (length_ - 1)];
+      if (State(slot->meta.load(std::memory_order_acquire)) == kEmpty) {
+        slot->meta.store(MakeMeta(kConstruction, 0, 0),
+                         std::memory_order_relaxed);
+        h = slot;
+        break;
+      }
+    }
+    if (h != nullptr) {
+      for (uint32_t i = 0; i < probes; i++) {
+        slots_[(home + i) & (length_ - 1)].displacements.fetch_add(
+            1, std::memory_order_relaxed);
+      }
+      usage_ += charge;
+      occupancy_++;
+    }
+  }
+
+  uint64_t meta;
+  if (h != nullptr) {
+    meta = MakeMeta(kVisible, kInitialCountdown, 1);
+  } else {
+    // Either caching is turned off or every slot is in use: hand out an
+    // entry that is not in the cache and goes away with its last
+    // reference.
+    h = new ClockHandle;
+    h->detached = true;
+    meta = MakeMeta(kInvisible, 0, 1);
+  }
+  h->value = value;
+  h->deleter = deleter;
+  h->key_data = new char[key.size() > 0 ? key.size() : 1];
+  std::memcpy(h->key_data, key.data(), key.size());
+  h->key_length = key.size();
+  h->charge = charge;
+  h->hash.store(hash, std::memory_order_relaxed);
+  h->meta.store(meta, std::memory_order_release);
+  return reinterpret_cast<Cache::Handle*>(h);
+}
+
+void ClockCache::Erase(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  EraseLocked(key, hash);
+}
+
+void ClockCache::EraseLocked(const Slice& key, uint32_t hash) {
+  const uint32_t home = HomeIndex(hash);
+  for (uint32_t probes = 0; probes < length_; probes++) {
+    ClockHandle* h = &slots_[(home + probes) & (length_ - 1)];
+    uint64_t meta = h->meta.load(std::memory_order_acquire);
+    // Visible entries only change hands under mutex_, so their keys
+    // are stable here.
+    if (State(meta) == kVisible &&
+        h->hash.load(std::memory_order_relaxed) == hash && h->key() == key) {
+      while (!h->meta.compare_exchange_weak(
+          meta, MakeMeta(kInvisible, Countdown(meta), Refs(meta)),
+          std::memory_order_acq_rel, std::memory_order_acquire)) {
+      }
+      if (Refs(meta) == 0) {
+        Remove(h);
+      }
+      return;
+    }
+    if (h->displacements.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+  }
+}
+
+void ClockCache::EvictLocked(size_t charge) {
+  // Each pass over the table lowers every countdown by one, so a few
+  // passes are enough to find any evictable entry.
+  const size_t max_steps = static_cast<size_t>(length_) * (kMaxCountdown + 1);
+  for (size_t step = 0; step < max_steps; step++) {
+    if (usage_ + charge <= capacity_ && occupancy_ < max_occupancy_) {
+      return;
+    }
+    ClockHandle* h = &slots_[clock_hand_];
+    clock_hand_ = (clock_hand_ + 1) & (length_ - 1);
+    uint64_t meta = h->meta.load(std::memory_order_acquire);
+    if (State(meta) != kVisible || Refs(meta) != 0) {
+      continue;
+    }
+    if (Countdown(meta) > 0) {
+      // If a reader takes a reference meanwhile the entry is skipped.
+      h->meta.compare_exchange_strong(
+          meta, meta - (uint64_t{1} << kCountdownShift),
+          std::memory_order_relaxed);
+    } else if (h->meta.compare_exchange_strong(
+                   meta, MakeMeta(kConstruction, 0, 0),
+                   std::memory_order_acq_rel)) {
+      Remove(h);
+    }
+  }
+}
+
+void ClockCache::Remove(ClockHandle* h) {
+  usage_ -= h->charge;
+  occupancy_--;
+  h->FreeData();
+  const uint32_t pos = static_cast<uint32_t>(h - slots_);
+  for (uint32_t i = HomeIndex(h->hash.load(std::memory_order_relaxed));
+       i != pos; i = (i + 1) & (length_ - 1)) {
+    slots_[i].displacements.fetch_sub(1, std::memory_order_relaxed);
+  }
+  h->meta.store(MakeMeta(kEmpty, 0, 0), std::memory_order_release);
+}
+
+void ClockCache::Prune() {
+  MutexLock l(&mutex_);
+  for (uint32_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    uint64_t meta = h->meta.load(std::memory_order_acquire);
+    if (State(meta) == kVisible && Refs(meta) == 0 &&
+        h->meta.compare_exchange_strong(meta, MakeMeta(kConstruction, 0, 0),
+                                        std::memory_order_acq_rel)) {
+      Remove(h);
+    }
+  }
+}
+
+static const int kNumShardBits = 4;
+static const int kNumShards = 1 << kNumShardBits;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCache shard_[kNumShards];
+  port::Mutex id_mutex_;
+  uint64_t last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+
+ public:
+  ShardedClockCache(size_t capacity, size_t estimated_entry_charge)
+      : last_id_(0) {
+    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+    if (estimated_entry_charge == 0) {
+      estimated_entry_charge = 1;
+    }
+    // Leave room for about twice the expected number of entries so that
+    // pinned entries can push usage past the capacity, as they can in
+    // the LRU cache.
+    const size_t entries = per_shard / estimated_entry_charge;
+    uint32_t length = 16;
+    while (length < 2 * entries && length < (uint32_t{1} << 30)) {
+      length *= 2;
+    }
+    for (int s = 0; s < kNumShards; s++) {
+      shard_[s].Init(per_shard, length);
+    }
+  }
+  ~ShardedClockCache() override {}
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 void (*deleter)(const Slice& key, void* value)) override {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+  }
+  Handle* Lookup(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Lookup(key, hash);
+  }
+  void Release(Handle* handle) override {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shard_[Shard(h->hash.load(std::memory_order_relaxed))].Release(handle);
+  }
+  void Erase(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    shard_[Shard(hash)].Erase(key, hash);
+  }
+  void* Value(Handle* handle) override {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  uint64_t NewId() override {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  void Prune() override {
+    for (int s = 0; s < kNumShards; s++) {
+      shard_[s].Prune();
+    }
+  }
+  size_t TotalCharge() const override {
+    size_t total = 0;
+    for (int s = 0; s < kNumShards; s++) {
+      total += shard_[s].TotalCharge();
+    }
+    return total;
+  }
+};
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge) {
+  return new ShardedClockCache(capacity, estimated_entry_charge);
+}
+
+}  // namespace leveldb
@@ -22,6 +22,26 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::SetMaxMmapFiles(int max_mmap_files) {
+  return Status::NotSupported("SetMaxMmapFiles");
+}
+
+Status Env::NewDirectRandomAccessFile(const std::string& fname,
+                                      RandomAccessFile** result) {
+  return NewRandomAccessFile(fname, result);
+}
+
+Status Env::NewDirectWritableFile(const std::string& fname,
+                                  WritableFile** result) {
+  return NewWritableFile(fname, result);
+}
+
+void Env::IncreaseBackgroundThreads(int number) {}
+
+bool Env::ScheduleHighPriority(void (*function)(void* arg), void* arg) {
+  return false;
+}
+
 Status Env::RemoveDir(const std::string& dirname) { return DeleteDir(dirname); }
 Status Env::DeleteDir(const std::string& dirname) { return RemoveDir(dirname); }
 
@@ -32,6 +52,20 @@ SequentialFile::~SequentialFile() = default;
 
 RandomAccessFile::~RandomAccessFile() = default;
 
+Status RandomAccessFile::MultiRead(ReadRequest* requests, size_t n) const {
+  Status result;
+  for (size_t i = 0; i < n; i++) {
+    ReadRequest* r = &requests[i];
+    r->status = Read(r->offset, r->n, &r->result, r->scratch);
+    if (result.ok() && !r->status.ok()) {
+      result = r->status;
+    }
+  }
+  return result;
+}
+
+void RandomAccessFile::Hint(AccessPattern pattern) {}
+
 WritableFile::~WritableFile() = default;
 
 Logger::~Logger() = default;
@@ -12,20 +12,24 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <set>
 #include <string>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
@@ -34,6 +38,12 @@
 #include "port/thread_annotations.h"
 #include "util/env_posix_test_helper.h"
 #include "util/posix_logger.h"
+#include "util/thread_pool.h"
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif  // HAVE_IO_URING
 
 namespace leveldb {
 
@@ -48,6 +58,16 @@ constexpr const int kDefaultMmapLimit = (sizeof(void*) >= 8) ? 1000 : 0;
 // Can be set using EnvPosixTestHelper::SetReadOnlyMMapLimit().
 int g_mmap_limit = kDefaultMmapLimit;
 
+// Set by EnvPosixTestHelper::SetIoUringEnterFailure().
+std::atomic<bool> g_fail_io_uring_enter(false);
+
+// Set by EnvPosixTestHelper::SetIoUringReadsUnsupported().
+std::atomic<bool> g_fail_io_uring_reads(false);
+
+// Set once io_uring turns out not to support reads, so that all threads
+// fall back to pread() without trying.
+std::atomic<bool> g_io_uring_unsupported(false);
+
 // Common flags defined for all posix open operations
 #if defined(HAVE_O_CLOEXEC)
 constexpr const int kOpenBaseFlags = O_CLOEXEC;
@@ -57,6 +77,25 @@ constexpr const int kOpenBaseFlags = 0;
 
 constexpr const size_t kWritableFileBufferSize = 65536;
 
+// O_DIRECT requires the memory buffer, the file offset and the size of
+// every transfer to be multiples of the logical block size of the device,
+// which is at most 4KB on the devices in use.
+constexpr const size_t kDirectIOAlignment = 4096;
+constexpr const size_t kDirectWritableFileBufferSize = 1 << 20;
+
+// Allocates "size" bytes aligned for O_DIRECT.  Free with std::free().
+char* AllocateAligned(size_t size) {
+  void* ptr = nullptr;
+  if (::posix_memalign(&ptr, kDirectIOAlignment, size) != 0) {
+    std::abort();
+  }
+  return static_cast<char*>(ptr);
+}
+
+size_t RoundUpToAlignment(size_t n) {
+  return (n + kDirectIOAlignment - 1) & ~(kDirectIOAlignment - 1);
+}
+
 Status PosixError(const std::string& context, int error_number) {
   if (error_number == ENOENT) {
     return Status::NotFound(context, std::strerror(error_number));
@@ -72,7 +111,8 @@ Status PosixError(const std::string& context, int error_number) {
 class Limiter {
  public:
   // Limit maximum number of resources to |max_acquires|.
-  Limiter(int max_acquires) : acquires_allowed_(max_acquires) {}
+  Limiter(int max_acquires)
+      : max_acquires_(max_acquires), acquires_allowed_(max_acquires) {}
 
   Limiter(const Limiter&) = delete;
   Limiter operator=(const Limiter&) = delete;
@@ -93,7 +133,20 @@ class Limiter {
   // true.
   void Release() { acquires_allowed_.fetch_add(1, std::memory_order_relaxed); }
 
+  // Change the maximum number of resources to |max_acquires|.  Resources
+  // that are already acquired stay acquired, so more than |max_acquires|
+  // may be in use until enough of them are released.
+  void SetMaxAcquires(int max_acquires) {
+    int old_max_acquires =
+        max_acquires_.exchange(max_acquires, std::memory_order_relaxed);
+    acquires_allowed_.fetch_add(max_acquires - old_max_acquires,
+                                std::memory_order_relaxed);
+  }
+
  private:
+  // The maximum number of resources, used by SetMaxAcquires().
+  std::atomic<int> max_acquires_;
+
   // The number of available resources.
   //
   // This is a counter and is not tied to the invariants of any other class, so
@@ -101,6 +154,263 @@ class Limiter {
   std::atomic<int> acquires_allowed_;
 };
 
+#if HAVE_IO_URING
+
+// Submits batches of reads to the kernel with io_uring, so that a batch
+// costs a single system call and its reads are served in parallel.
+//
+// Instances are not thread-safe.  Each thread that issues a MultiRead()
+// uses its own instance, returned by ForCurrentThread().
+class IoUring {
+ public:
+  // Returns the instance of the calling thread, creating it on first
+  // use, or nullptr if the kernel does not support io_uring.
+  static IoUring* ForCurrentThread() {
+    if (g_io_uring_unsupported.load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    thread_local std::unique_ptr<IoUring> ring;
+    if (ring == nullptr) {
+      ring.reset(new IoUring);
+      if (!ring->Init()) {
+        ring.reset();
+        g_io_uring_unsupported.store(true, std::memory_order_relaxed);
+      }
+    }
+    return (ring != nullptr && ring->ok_) ? ring.get() : nullptr;
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  ~IoUring() {
+    if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr) ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr) ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0) ::close(ring_fd_);
+  }
+
+  // Result of a read that was not performed.
+  static constexpr ssize_t kNotRead = std::numeric_limits<ssize_t>::min();
+
+  // Reads requests[0..n-1] from "fd", storing the number of bytes read by
+  // each request, or -errno, in results[0..n-1].  Returns false if the
+  // reads could not be issued, in which case the caller should fall back
+  // to pread() for the requests whose result is kNotRead.
+  bool Read(int fd, const ReadRequest* requests, size_t n, ssize_t* results) {
+    std::fill(results, results + n, kNotRead);
+    size_t next = 0;  // Next request to submit
+    size_t done = 0;  // Number of completed requests
+    while (done < n) {
+      // Fill the submission queue, leaving room in the completion queue
+      // for every read in flight.
+      unsigned to_submit = 0;
+      unsigned tail = *sq_tail_;
+      while (next < n && next - done < sq_entries_) {
+        const unsigned index = tail & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->off = requests[next].offset;
+        sqe->addr = reinterpret_cast<uint64_t>(requests[next].scratch);
+        sqe->len = static_cast<uint32_t>(requests[next].n);
+        sqe->user_data = next;
+        sq_array_[index] = index;
+        tail++;
+        next++;
+        to_submit++;
+      }
+      __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+      // Submit the new reads and wait for at least one completion.
+      while (true) {
+        int r;
+        if (g_fail_io_uring_enter.load(std::memory_order_relaxed)) {
+          // Injected by tests: fail once the reads are in flight.
+          ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, 0, 0, nullptr,
+                    0);
+          errno = EIO;
+          r = -1;
+        } else {
+          r = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+        if (r >= 0) {
+          to_submit -= std::min<unsigned>(r, to_submit);
+          if (to_submit == 0) break;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          // The reads the kernel has taken write to the caller's
+          // buffers, so wait for them before the caller falls back to
+          // pread() and possibly frees the buffers.  Reads may be left
+          // in the queue, so the instance cannot be used again.
+          Drain(next, &done, results);
+          ok_ = false;
+          return false;
+        }
+      }
+
+      Reap(&done, results);
+    }
+    if (reads_unsupported_) {
+      ok_ = false;
+      g_io_uring_unsupported.store(true, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // Entries in the submission queue, i.e. the maximum number of reads
+  // in flight.
+  static constexpr unsigned kQueueDepth = 32;
+
+  // Stores the results of the completed reads, adding their number to
+  // *done.  Reads the kernel rejects as unsupported keep kNotRead.
+  void Reap(size_t* done, ssize_t* results) {
+    unsigned head = *cq_head_;
+    const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != cq_tail) {
+      const io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+      int res = cqe->res;
+      if (g_fail_io_uring_reads.load(std::memory_order_relaxed)) {
+        res = -EINVAL;  // Injected by tests
+      }
+      if (res == -EINVAL || res == -EOPNOTSUPP) {
+        reads_unsupported_ = true;
+      } else {
+        results[cqe->user_data] = res;
+      }
+      head++;
+      (*done)++;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  // Of the "queued" reads placed in the submission queue so far,
+  // withdraws those that the kernel has not taken yet, and waits for the
+  // others to complete.
+  void Drain(size_t queued, size_t* done, ssize_t* results) {
+    const unsigned sq_head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    const unsigned sq_tail = *sq_tail_;
+    __atomic_store_n(sq_tail_, sq_head, __ATOMIC_RELEASE);
+    const size_t taken = queued - (sq_tail - sq_head);
+    while (true) {
+      Reap(done, results);
+      if (*done >= taken) {
+        break;
+      }
+      // Waiting in io_uring_enter() may fail like submitting did, but
+      // completions are posted to the ring regardless, so poll for them.
+      if (::syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+
+  IoUring()
+      : ok_(false),
+        reads_unsupported_(false),
+        ring_fd_(-1),
+        sq_entries_(0),
+        sq_ring_(nullptr),
+        sq_ring_size_(0),
+        cq_ring_(nullptr),
+        cq_ring_size_(0),
+        sqes_(nullptr),
+        sqes_size_(0) {}
+
+  bool Init() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd_ = ::syscall(__NR_io_uring_setup, kQueueDepth, &params);
+    if (ring_fd_ < 0) {
+      return false;
+    }
+    sq_entries_ = params.sq_entries;
+
+    // io_uring_setup() succeeds from Linux 5.1, but IORING_OP_READ needs
+    // Linux 5.6, which also added the probe.
+    if (!SupportsRead()) {
+      return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sq_ring = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd_,
+                           IORING_OFF_SQ_RING);
+    void* cq_ring = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd_,
+                           IORING_OFF_CQ_RING);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    sq_ring_ = (sq_ring == MAP_FAILED) ? nullptr : sq_ring;
+    cq_ring_ = (cq_ring == MAP_FAILED) ? nullptr : cq_ring;
+    sqes_ = (sqes == MAP_FAILED) ? nullptr : static_cast<io_uring_sqe*>(sqes);
+    if (sq_ring_ == nullptr || cq_ring_ == nullptr || sqes_ == nullptr) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    ok_ = true;
+    return true;
+  }
+
+  // Returns true if the kernel supports IORING_OP_READ.
+  bool SupportsRead() {
+    constexpr unsigned kNumProbeOps = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) +
+                             kNumProbeOps * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE,
+                  probe, kNumProbeOps) < 0) {
+      return false;
+    }
+    return probe->last_op >= IORING_OP_READ &&
+           (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+  }
+
+  bool ok_;  // False if the instance cannot be used
+  bool reads_unsupported_;  // Set by Reap() if reads completed with EINVAL
+  int ring_fd_;
+  unsigned sq_entries_;
+
+  // The submission queue ring, its entries and the completion queue
+  // ring, which are shared with the kernel.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+};
+
+constexpr ssize_t IoUring::kNotRead;
+
+#endif  // HAVE_IO_URING
+
 // Implements sequential read access in a file using read().
 //
 // Instances of this class are thread-friendly but not thread-safe, as required
@@ -148,9 +458,12 @@ class PosixSequentialFile final : public SequentialFile {
 class PosixRandomAccessFile final : public RandomAccessFile {
  public:
   // The new instance takes ownership of |fd|. |fd_limiter| must outlive this
-  // instance, and will be used to determine if .
-  PosixRandomAccessFile(std::string filename, int fd, Limiter* fd_limiter)
+  // instance, and will be used to determine if .  If |direct| is true, |fd|
+  // was opened with O_DIRECT and reads are aligned as it requires.
+  PosixRandomAccessFile(std::string filename, int fd, Limiter* fd_limiter,
+                        bool direct = false)
       : has_permanent_fd_(fd_limiter->Acquire()),
+        direct_(direct),
         fd_(has_permanent_fd_ ? fd : -1),
         fd_limiter_(fd_limiter),
         filename_(std::move(filename)) {
@@ -172,7 +485,7 @@ class PosixRandomAccessFile final : public RandomAccessFile {
               char* scratch) const override {
     int fd = fd_;
     if (!has_permanent_fd_) {
-      fd = ::open(filename_.c_str(), O_RDONLY | kOpenBaseFlags);
+      fd = ::open(filename_.c_str(), OpenFlags());
       if (fd < 0) {
         return PosixError(filename_, errno);
       }
@@ -181,11 +494,15 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     assert(fd != -1);
 
     Status status;
-    ssize_t read_size = ::pread(fd, scratch, n, static_cast<off_t>(offset));
-    *result = Slice(scratch, (read_size < 0) ? 0 : read_size);
-    if (read_size < 0) {
-      // An error: return a non-ok status.
-      status = PosixError(filename_, errno);
+    if (direct_) {
+      status = DirectRead(fd, offset, n, result, scratch);
+    } else {
+      ssize_t read_size = ::pread(fd, scratch, n, static_cast<off_t>(offset));
+      *result = Slice(scratch, (read_size < 0) ? 0 : read_size);
+      if (read_size < 0) {
+        // An error: return a non-ok status.
+        status = PosixError(filename_, errno);
+      }
     }
     if (!has_permanent_fd_) {
       // Close the temporary file descriptor opened earlier.
@@ -195,8 +512,122 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     return status;
   }
 
+  Status MultiRead(ReadRequest* requests, size_t n) const override {
+#if HAVE_IO_URING
+    IoUring* ring =
+        (n > 1 && !direct_) ? IoUring::ForCurrentThread() : nullptr;
+    if (ring == nullptr) {
+      return RandomAccessFile::MultiRead(requests, n);
+    }
+
+    int fd = fd_;
+    if (!has_permanent_fd_) {
+      fd = ::open(filename_.c_str(), OpenFlags());
+      if (fd < 0) {
+        Status status = PosixError(filename_, errno);
+        for (size_t i = 0; i < n; i++) {
+          requests[i].result = Slice();
+          requests[i].status = status;
+        }
+        return status;
+      }
+    }
+
+    std::vector<ssize_t> results(n);
+    ring->Read(fd, requests, n, results.data());
+    Status status;
+    for (size_t i = 0; i < n; i++) {
+      ReadRequest* r = &requests[i];
+      ssize_t read_size = results[i];
+      if (read_size == IoUring::kNotRead) {
+        read_size =
+            ::pread(fd, r->scratch, r->n, static_cast<off_t>(r->offset));
+        if (read_size < 0) {
+          read_size = -errno;
+        }
+      }
+      r->result = Slice(r->scratch, (read_size < 0) ? 0 : read_size);
+      r->status = (read_size < 0) ? PosixError(filename_, -read_size)
+                                  : Status::OK();
+      if (status.ok() && !r->status.ok()) {
+        status = r->status;
+      }
+    }
+
+    if (!has_permanent_fd_) {
+      assert(fd != fd_);
+      ::close(fd);
+    }
+    return status;
+#else
+    return RandomAccessFile::MultiRead(requests, n);
+#endif  // HAVE_IO_URING
+  }
+
+  void Hint(AccessPattern pattern) override {
+#if defined(POSIX_FADV_RANDOM)
+    // Without a permanent descriptor there is nothing to advise, as the
+    // advice applies to the descriptor.
+    if (has_permanent_fd_) {
+      int advice = POSIX_FADV_NORMAL;
+      if (pattern == kRandom) {
+        advice = POSIX_FADV_RANDOM;
+      } else if (pattern == kSequential) {
+        advice = POSIX_FADV_SEQUENTIAL;
+      }
+      ::posix_fadvise(fd_, 0, 0, advice);
+    }
+#endif  // defined(POSIX_FADV_RANDOM)
+  }
+
  private:
+  int OpenFlags() const {
+#if defined(O_DIRECT)
+    if (direct_) {
+      return O_RDONLY | O_DIRECT | kOpenBaseFlags;
+    }
+#endif  // defined(O_DIRECT)
+    return O_RDONLY | kOpenBaseFlags;
+  }
+
+  // Reads the aligned range around [offset, offset + n) into an aligned
+  // buffer and copies the requested bytes to "scratch".
+  Status DirectRead(int fd, uint64_t offset, size_t n, Slice* result,
+                    char* scratch) const {
+    const uint64_t aligned_offset = offset & ~(kDirectIOAlignment - 1);
+    const size_t skip = static_cast<size_t>(offset - aligned_offset);
+    const size_t size = RoundUpToAlignment(skip + n);
+    char* buf = AllocateAligned(size);
+    size_t read_total = 0;
+    Status status;
+    while (read_total < size) {
+      ssize_t read_size =
+          ::pread(fd, buf + read_total, size - read_total,
+                  static_cast<off_t>(aligned_offset + read_total));
+      if (read_size < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        status = PosixError(filename_, errno);
+        break;
+      }
+      if (read_size == 0) {
+        break;  // End of file
+      }
+      read_total += read_size;
+    }
+    size_t available = 0;
+    if (status.ok() && read_total > skip) {
+      available = std::min(n, read_total - skip);
+      std::memcpy(scratch, buf + skip, available);
+    }
+    std::free(buf);
+    *result = Slice(scratch, available);
+    return status;
+  }
+
   const bool has_permanent_fd_;  // If false, the file is opened on every read.
+  const bool direct_;            // If true, the file is opened with O_DIRECT.
   const int fd_;                 // -1 if has_permanent_fd_ is false.
   Limiter* const fd_limiter_;
   const std::string filename_;
@@ -239,6 +670,18 @@ class PosixMmapReadableFile final : public RandomAccessFile {
     return Status::OK();
   }
 
+  void Hint(AccessPattern pattern) override {
+    // Random access disables the kernel's read-ahead, which would
+    // otherwise fault in pages around every block that is read.
+    int advice = POSIX_MADV_NORMAL;
+    if (pattern == kRandom) {
+      advice = POSIX_MADV_RANDOM;
+    } else if (pattern == kSequential) {
+      advice = POSIX_MADV_SEQUENTIAL;
+    }
+    ::posix_madvise(static_cast<void*>(mmap_base_), length_, advice);
+  }
+
  private:
   char* const mmap_base_;
   const size_t length_;
@@ -246,6 +689,35 @@ class PosixMmapReadableFile final : public RandomAccessFile {
   const std::string filename_;
 };
 
+// Ensures that all the caches associated with the given file descriptor's
+// data are flushed all the way to durable media, and can withstand power
+// failures.
+//
+// The path argument is only used to populate the description string in the
+// returned Status if an error occurs.
+Status SyncFd(int fd, const std::string& fd_path) {
+#if HAVE_FULLFSYNC
+  // On macOS and iOS, fsync() doesn't guarantee durability past power
+  // failures. fcntl(F_FULLFSYNC) is required for that purpose. Some
+  // filesystems don't support fcntl(F_FULLFSYNC), and require a fallback to
+  // fsync().
+  if (::fcntl(fd, F_FULLFSYNC) == 0) {
+    return Status::OK();
+  }
+#endif  // HAVE_FULLFSYNC
+
+#if HAVE_FDATASYNC
+  bool sync_success = ::fdatasync(fd) == 0;
+#else
+  bool sync_success = ::fsync(fd) == 0;
+#endif  // HAVE_FDATASYNC
+
+  if (sync_success) {
+    return Status::OK();
+  }
+  return PosixError(fd_path, errno);
+}
+
 class PosixWritableFile final : public WritableFile {
  public:
   PosixWritableFile(std::string filename, int fd)
@@ -360,35 +832,6 @@ class PosixWritableFile final : public WritableFile {
     return status;
   }
 
-  // Ensures that all the caches associated with the given file descriptor's
-  // data are flushed all the way to durable media, and can withstand power
-  // failures.
-  //
-  // The path argument is only used to populate the description string in the
-  // returned Status if an error occurs.
-  static Status SyncFd(int fd, const std::string& fd_path) {
-#if HAVE_FULLFSYNC
-    // On macOS and iOS, fsync() doesn't guarantee durability past power
-    // failures. fcntl(F_FULLFSYNC) is required for that purpose. Some
-    // filesystems don't support fcntl(F_FULLFSYNC), and require a fallback to
-    // fsync().
-    if (::fcntl(fd, F_FULLFSYNC) == 0) {
-      return Status::OK();
-    }
-#endif  // HAVE_FULLFSYNC
-
-#if HAVE_FDATASYNC
-    bool sync_success = ::fdatasync(fd) == 0;
-#else
-    bool sync_success = ::fsync(fd) == 0;
-#endif  // HAVE_FDATASYNC
-
-    if (sync_success) {
-      return Status::OK();
-    }
-    return PosixError(fd_path, errno);
-  }
-
   // Returns the directory name in a path pointing to a file.
   //
   // Returns "." if the path does not contain any directory separator.
@@ -436,6 +879,119 @@ class PosixWritableFile final : public WritableFile {
   const std::string dirname_;  // The directory of filename_.
 };
 
+// Implements writes that bypass the page cache using O_DIRECT.
+//
+// O_DIRECT requires aligned buffers, offsets and sizes, so data is staged
+// in an aligned buffer and written in whole aligned blocks.  Flush() keeps
+// a partial block in the buffer.  Sync() and Close() write it padded with
+// zeros and truncate the file to its real size; the block is written again
+// once more data is appended.
+class PosixDirectWritableFile final : public WritableFile {
+ public:
+  PosixDirectWritableFile(std::string filename, int fd)
+      : buf_(AllocateAligned(kDirectWritableFileBufferSize)),
+        pos_(0),
+        buf_offset_(0),
+        fd_(fd),
+        filename_(std::move(filename)) {}
+
+  ~PosixDirectWritableFile() override {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors
+      Close();
+    }
+    std::free(buf_);
+  }
+
+  Status Append(const Slice& data) override {
+    const char* write_data = data.data();
+    size_t write_size = data.size();
+    while (write_size > 0) {
+      size_t copy_size =
+          std::min(write_size, kDirectWritableFileBufferSize - pos_);
+      std::memcpy(buf_ + pos_, write_data, copy_size);
+      write_data += copy_size;
+      write_size -= copy_size;
+      pos_ += copy_size;
+      if (pos_ == kDirectWritableFileBufferSize) {
+        Status status = WriteAligned(kDirectWritableFileBufferSize);
+        if (!status.ok()) {
+          return status;
+        }
+        buf_offset_ += kDirectWritableFileBufferSize;
+        pos_ = 0;
+      }
+    }
+    return Status::OK();
+  }
+
+  Status Close() override {
+    Status status = WriteTail();
+    const int close_result = ::close(fd_);
+    if (close_result < 0 && status.ok()) {
+      status = PosixError(filename_, errno);
+    }
+    fd_ = -1;
+    return status;
+  }
+
+  // Partial blocks cannot be written without padding, so they are kept
+  // until Sync() or Close().
+  Status Flush() override { return Status::OK(); }
+
+  Status Sync() override {
+    Status status = WriteTail();
+    if (!status.ok()) {
+      return status;
+    }
+    return SyncFd(fd_, filename_);
+  }
+
+ private:
+  // Writes buf_[0, size - 1] at buf_offset_.  "size" must be aligned.
+  Status WriteAligned(size_t size) {
+    size_t written = 0;
+    while (written < size) {
+      ssize_t write_result =
+          ::pwrite(fd_, buf_ + written, size - written,
+                   static_cast<off_t>(buf_offset_ + written));
+      if (write_result < 0) {
+        if (errno == EINTR) {
+          continue;  // Retry
+        }
+        return PosixError(filename_, errno);
+      }
+      written += write_result;
+    }
+    return Status::OK();
+  }
+
+  // Writes the buffered data, padded to a whole block, and drops the
+  // padding from the file.
+  Status WriteTail() {
+    if (pos_ == 0) {
+      return Status::OK();
+    }
+    const size_t size = RoundUpToAlignment(pos_);
+    std::memset(buf_ + pos_, 0, size - pos_);
+    Status status = WriteAligned(size);
+    if (status.ok() &&
+        ::ftruncate(fd_, static_cast<off_t>(buf_offset_ + pos_)) != 0) {
+      status = PosixError(filename_, errno);
+    }
+    return status;
+  }
+
+  // buf_[0, pos_ - 1] contains data to be written at file offset
+  // buf_offset_, which is aligned.
+  char* const buf_;
+  size_t pos_;
+  uint64_t buf_offset_;
+  int fd_;
+
+  const std::string filename_;
+};
+
 int LockOrUnlock(int fd, bool lock) {
   errno = 0;
   struct ::flock file_lock_info;
@@ -542,6 +1098,34 @@ class PosixEnv : public Env {
     return status;
   }
 
+  Status SetMaxMmapFiles(int max_mmap_files) override {
+    mmap_limiter_.SetMaxAcquires(max_mmap_files < 0
+                                     ? std::numeric_limits<int>::max()
+                                     : max_mmap_files);
+    return Status::OK();
+  }
+
+  Status NewDirectRandomAccessFile(const std::string& filename,
+                                   RandomAccessFile** result) override {
+#if defined(O_DIRECT)
+    *result = nullptr;
+    int fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT | kOpenBaseFlags);
+    if (fd < 0) {
+      if (errno == EINVAL) {
+        // The file system does not support O_DIRECT.
+        return NewRandomAccessFile(filename, result);
+      }
+      return PosixError(filename, errno);
+    }
+
+    *result = new PosixRandomAccessFile(filename, fd, &fd_limiter_,
+                                        /*direct=*/true);
+    return Status::OK();
+#else
+    return NewRandomAccessFile(filename, result);
+#endif  // defined(O_DIRECT)
+  }
+
   Status NewWritableFile(const std::string& filename,
                          WritableFile** result) override {
     int fd = ::open(filename.c_str(),
@@ -555,6 +1139,28 @@ class PosixEnv : public Env {
     return Status::OK();
   }
 
+  Status NewDirectWritableFile(const std::string& filename,
+                               WritableFile** result) override {
+#if defined(O_DIRECT)
+    int fd = ::open(filename.c_str(),
+                    O_TRUNC | O_WRONLY | O_CREAT | O_DIRECT | kOpenBaseFlags,
+                    0644);
+    if (fd < 0) {
+      *result = nullptr;
+      if (errno == EINVAL) {
+        // The file system does not support O_DIRECT.
+        return NewWritableFile(filename, result);
+      }
+      return PosixError(filename, errno);
+    }
+
+    *result = new PosixDirectWritableFile(filename, fd);
+    return Status::OK();
+#else
+    return NewWritableFile(filename, result);
+#endif  // defined(O_DIRECT)
+  }
+
   Status NewAppendableFile(const std::string& filename,
                            WritableFile** result) override {
     int fd = ::open(filename.c_str(),
@@ -663,6 +1269,10 @@ class PosixEnv : public Env {
   void Schedule(void (*background_work_function)(void* background_work_arg),
                 void* background_work_arg) override;
 
+  void IncreaseBackgroundThreads(int number) override;
+
+  bool ScheduleHighPriority(void (*function)(void* arg), void* arg) override;
+
   void StartThread(void (*thread_main)(void* thread_main_arg),
                    void* thread_main_arg) override {
     std::thread new_thread(thread_main, thread_main_arg);
@@ -719,6 +1329,10 @@ class PosixEnv : public Env {
  private:
   void BackgroundThreadMain();
 
+  // Start background threads until there are as many as allowed.
+  void StartBackgroundThreads()
+      EXCLUSIVE_LOCKS_REQUIRED(background_work_mutex_);
+
   static void BackgroundThreadEntryPoint(PosixEnv* env) {
     env->BackgroundThreadMain();
   }
@@ -739,11 +1353,15 @@ class PosixEnv : public Env {
 
   port::Mutex background_work_mutex_;
   port::CondVar background_work_cv_ GUARDED_BY(background_work_mutex_);
-  bool started_background_thread_ GUARDED_BY(background_work_mutex_);
+  int started_background_threads_ GUARDED_BY(background_work_mutex_);
+  int max_background_threads_ GUARDED_BY(background_work_mutex_);
 
   std::queue<BackgroundWorkItem> background_work_queue_
       GUARDED_BY(background_work_mutex_);
 
+  // Runs the work of ScheduleHighPriority().  Created on first use.
+  ThreadPool* high_priority_pool_ GUARDED_BY(background_work_mutex_);
+
   PosixLockTable locks_;  // Thread-safe.
   Limiter mmap_limiter_;  // Thread-safe.
   Limiter fd_limiter_;    // Thread-safe.
@@ -774,7 +1392,9 @@ int MaxOpenFiles() {
 
 PosixEnv::PosixEnv()
     : background_work_cv_(&background_work_mutex_),
-      started_background_thread_(false),
+      started_background_threads_(0),
+      max_background_threads_(1),
+      high_priority_pool_(nullptr),
       mmap_limiter_(MaxMmaps()),
       fd_limiter_(MaxOpenFiles()) {}
 
@@ -783,22 +1403,48 @@ void PosixEnv::Schedule(
     void* background_work_arg) {
   background_work_mutex_.Lock();
 
-  // Start the background thread, if we haven't done so already.
-  if (!started_background_thread_) {
-    started_background_thread_ = true;
-    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this);
-    background_thread.detach();
-  }
+  // Start the background threads, if we haven't done so already.
+  StartBackgroundThreads();
 
-  // If the queue is empty, the background thread may be waiting for work.
-  if (background_work_queue_.empty()) {
-    background_work_cv_.Signal();
-  }
+  // With several background threads, an idle one may be waiting for work
+  // even if the queue is not empty, so always wake one up.
+  background_work_cv_.Signal();
 
   background_work_queue_.emplace(background_work_function, background_work_arg);
   background_work_mutex_.Unlock();
 }
 
+void PosixEnv::IncreaseBackgroundThreads(int number) {
+  background_work_mutex_.Lock();
+  if (number > max_background_threads_) {
+    max_background_threads_ = number;
+    // Threads are started by the first call to Schedule().
+    if (started_background_threads_ > 0) {
+      StartBackgroundThreads();
+    }
+  }
+  background_work_mutex_.Unlock();
+}
+
+bool PosixEnv::ScheduleHighPriority(void (*function)(void* arg), void* arg) {
+  background_work_mutex_.Lock();
+  if (high_priority_pool_ == nullptr) {
+    high_priority_pool_ = new ThreadPool(1);
+  }
+  ThreadPool* pool = high_priority_pool_;
+  background_work_mutex_.Unlock();
+  pool->Schedule(function, arg);
+  return true;
+}
+
+void PosixEnv::StartBackgroundThreads() {
+  while (started_background_threads_ < max_background_threads_) {
+    started_background_threads_++;
+    std::thread background_thread(PosixEnv::BackgroundThreadEntryPoint, this);
+    background_thread.detach();
+  }
+}
+
 void PosixEnv::BackgroundThreadMain() {
   while (true) {
     background_work_mutex_.Lock();
@@ -885,6 +1531,17 @@ void EnvPosixTestHelper::SetReadOnlyMMapLimit(int limit) {
   g_mmap_limit = limit;
 }
 
+void EnvPosixTestHelper::SetIoUringEnterFailure(bool fail) {
+  g_fail_io_uring_enter.store(fail, std::memory_order_relaxed);
+}
+
+void EnvPosixTestHelper::SetIoUringReadsUnsupported(bool unsupported) {
+  g_fail_io_uring_reads.store(unsupported, std::memory_order_relaxed);
+  if (!unsupported) {
+    g_io_uring_unsupported.store(false, std::memory_order_relaxed);
+  }
+}
+
 Env* Env::Default() {
   static PosixDefaultEnv env_container;
   return env_container.env();
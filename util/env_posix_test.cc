@@ -10,6 +10,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -176,6 +177,14 @@ class EnvPosixTest : public testing::Test {
     EnvPosixTestHelper::SetReadOnlyMMapLimit(mmap_limit);
   }
 
+  static void SetIoUringEnterFailure(bool fail) {
+    EnvPosixTestHelper::SetIoUringEnterFailure(fail);
+  }
+
+  static void SetIoUringReadsUnsupported(bool unsupported) {
+    EnvPosixTestHelper::SetIoUringReadsUnsupported(unsupported);
+  }
+
   EnvPosixTest() : env_(Env::Default()) {}
 
   Env* env_;
@@ -212,6 +221,224 @@ TEST_F(EnvPosixTest, TestOpenOnRead) {
   ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
 }
 
+TEST_F(EnvPosixTest, TestSetMaxMmapFiles) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/set_max_mmap_files.txt";
+  const char kFileData[] = "abcdefghijklmnopqrstuvwxyz";
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, kFileData, test_file));
+
+  // A read from a mapped file points into the mapping rather than into
+  // the scratch buffer.
+  const int kNumFiles = kMMapLimit + 5;
+  leveldb::RandomAccessFile* files[kNumFiles] = {0};
+  char scratch;
+  Slice read_result;
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(0));
+  ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &files[0]));
+  files[0]->Hint(RandomAccessFile::kRandom);
+  ASSERT_LEVELDB_OK(files[0]->Read(1, 1, &read_result, &scratch));
+  ASSERT_EQ(kFileData[1], read_result[0]);
+  ASSERT_EQ(&scratch, read_result.data());
+  delete files[0];
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(-1));
+  for (int i = 0; i < kNumFiles; i++) {
+    ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &files[i]));
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    files[i]->Hint(i % 2 == 0 ? RandomAccessFile::kRandom
+                              : RandomAccessFile::kSequential);
+    ASSERT_LEVELDB_OK(files[i]->Read(i, 1, &read_result, &scratch));
+    ASSERT_EQ(kFileData[i], read_result[0]);
+    ASSERT_NE(&scratch, read_result.data());
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    delete files[i];
+  }
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(kMMapLimit));
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
+TEST_F(EnvPosixTest, TestMultiRead) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read.txt";
+  std::string data;
+  for (int i = 0; i < 10000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, data, test_file));
+
+  // Read files without mmap, some of which are opened on every read.
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(0));
+  const int kNumFiles = kReadOnlyFileLimit + 2;
+  leveldb::RandomAccessFile* files[kNumFiles] = {0};
+  for (int i = 0; i < kNumFiles; i++) {
+    ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &files[i]));
+  }
+
+  // More requests than the reads that can be in flight at once, the last
+  // one running past the end of the file.
+  const int kNumRequests = 100;
+  const size_t kReadSize = 100;
+  std::vector<char> scratch(kNumRequests * kReadSize);
+  ReadRequest requests[kNumRequests];
+  for (int f = 0; f < kNumFiles; f++) {
+    for (int i = 0; i < kNumRequests; i++) {
+      requests[i].offset = (i * 7919) % (data.size() - kReadSize);
+      requests[i].n = kReadSize;
+      requests[i].scratch = &scratch[i * kReadSize];
+    }
+    requests[kNumRequests - 1].offset = data.size() - 10;
+    ASSERT_LEVELDB_OK(files[f]->MultiRead(requests, kNumRequests));
+    for (int i = 0; i < kNumRequests; i++) {
+      ASSERT_LEVELDB_OK(requests[i].status);
+      ASSERT_EQ(data.substr(requests[i].offset, kReadSize),
+                requests[i].result.ToString())
+          << "file " << f << " request " << i;
+    }
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    delete files[i];
+  }
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(kMMapLimit));
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
+TEST_F(EnvPosixTest, TestMultiReadSubmitFailure) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read_failure.txt";
+  std::string data;
+  for (int i = 0; i < 1000000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, data, test_file));
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(0));
+  leveldb::RandomAccessFile* file = nullptr;
+  ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &file));
+
+  // Submitting fails with reads in flight.  They complete before
+  // MultiRead() returns, and the remaining ones are read with pread().
+  // The thread's io_uring instance cannot be used again, so use a
+  // thread of its own.
+  const int kNumRequests = 64;
+  const size_t kReadSize = 8192;
+  std::vector<char> scratch(kNumRequests * kReadSize);
+  ReadRequest requests[kNumRequests];
+  for (int i = 0; i < kNumRequests; i++) {
+    requests[i].offset = (i * 7919) % (data.size() - kReadSize);
+    requests[i].n = kReadSize;
+    requests[i].scratch = &scratch[i * kReadSize];
+  }
+  SetIoUringEnterFailure(true);
+  Status status;
+  std::thread reader(
+      [&]() { status = file->MultiRead(requests, kNumRequests); });
+  reader.join();
+  SetIoUringEnterFailure(false);
+
+  ASSERT_LEVELDB_OK(status);
+  for (int i = 0; i < kNumRequests; i++) {
+    ASSERT_LEVELDB_OK(requests[i].status);
+    ASSERT_EQ(data.substr(requests[i].offset, kReadSize),
+              requests[i].result.ToString())
+        << "request " << i;
+  }
+  delete file;
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(kMMapLimit));
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
+TEST_F(EnvPosixTest, TestMultiReadUnsupported) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read_unsupported.txt";
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data.push_back(static_cast<char>('a' + i % 26));
+  }
+  ASSERT_LEVELDB_OK(WriteStringToFile(env_, data, test_file));
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(0));
+  leveldb::RandomAccessFile* file = nullptr;
+  ASSERT_LEVELDB_OK(env_->NewRandomAccessFile(test_file, &file));
+
+  // Reads complete with EINVAL, as on kernels without IORING_OP_READ.
+  // They are read again with pread(), here and in later calls.
+  const int kNumRequests = 8;
+  const size_t kReadSize = 1000;
+  std::vector<char> scratch(kNumRequests * kReadSize);
+  ReadRequest requests[kNumRequests];
+  SetIoUringReadsUnsupported(true);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < kNumRequests; i++) {
+      requests[i].offset = (i * 7919 + round) % (data.size() - kReadSize);
+      requests[i].n = kReadSize;
+      requests[i].scratch = &scratch[i * kReadSize];
+    }
+    ASSERT_LEVELDB_OK(file->MultiRead(requests, kNumRequests));
+    for (int i = 0; i < kNumRequests; i++) {
+      ASSERT_LEVELDB_OK(requests[i].status);
+      ASSERT_EQ(data.substr(requests[i].offset, kReadSize),
+                requests[i].result.ToString())
+          << "round " << round << " request " << i;
+    }
+  }
+  SetIoUringReadsUnsupported(false);
+  delete file;
+
+  ASSERT_LEVELDB_OK(env_->SetMaxMmapFiles(kMMapLimit));
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
+TEST_F(EnvPosixTest, TestDirectIO) {
+  std::string test_dir;
+  ASSERT_LEVELDB_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/direct_io.txt";
+
+  // Unaligned appends that span more than one buffer, with syncs that
+  // write partial blocks in between.
+  std::string data;
+  WritableFile* writable_file;
+  ASSERT_LEVELDB_OK(env_->NewDirectWritableFile(test_file, &writable_file));
+  for (int i = 0; data.size() < 3 * 1024 * 1024; i++) {
+    std::string piece(1 + (i * 7919) % 10000, static_cast<char>('a' + i % 26));
+    ASSERT_LEVELDB_OK(writable_file->Append(piece));
+    data += piece;
+    if (i % 100 == 0) {
+      ASSERT_LEVELDB_OK(writable_file->Sync());
+      uint64_t file_size;
+      ASSERT_LEVELDB_OK(env_->GetFileSize(test_file, &file_size));
+      ASSERT_EQ(data.size(), file_size);
+    }
+  }
+  ASSERT_LEVELDB_OK(writable_file->Close());
+  delete writable_file;
+
+  std::string contents;
+  ASSERT_LEVELDB_OK(ReadFileToString(env_, test_file, &contents));
+  ASSERT_EQ(data, contents);
+
+  // Unaligned reads, the last one running past the end of the file.
+  RandomAccessFile* file;
+  ASSERT_LEVELDB_OK(env_->NewDirectRandomAccessFile(test_file, &file));
+  std::vector<char> scratch(10000);
+  Slice read_result;
+  for (uint64_t offset = 0; offset < data.size(); offset += 65537) {
+    ASSERT_LEVELDB_OK(
+        file->Read(offset, scratch.size(), &read_result, scratch.data()));
+    ASSERT_EQ(data.substr(offset, scratch.size()), read_result.ToString());
+  }
+  delete file;
+
+  ASSERT_LEVELDB_OK(env_->RemoveFile(test_file));
+}
+
 #if HAVE_O_CLOEXEC
 
 TEST_F(EnvPosixTest, TestCloseOnExecSequentialFile) {
@@ -21,6 +21,16 @@ class EnvPosixTestHelper {
   // Set the maximum number of read-only files that will be mapped via mmap.
   // Must be called before creating an Env.
   static void SetReadOnlyMMapLimit(int limit);
+
+  // If true, make io_uring_enter() fail once it has submitted reads, so
+  // that MultiRead() falls back to pread() with reads in flight.
+  static void SetIoUringEnterFailure(bool fail);
+
+  // If true, make io_uring reads complete with EINVAL, as on kernels
+  // older than Linux 5.6, so that MultiRead() falls back to pread() and
+  // stops using io_uring.  Setting it back to false lets io_uring be
+  // used again.
+  static void SetIoUringReadsUnsupported(bool unsupported);
 };
 
 }  // namespace leveldb
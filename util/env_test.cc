@@ -134,6 +134,42 @@ TEST_F(EnvTest, RunMany) {
   }
 }
 
+TEST_F(EnvTest, RunHighPriorityWhileBusy) {
+  struct RunState {
+    port::Mutex mu;
+    port::CondVar cvar{&mu};
+    bool released = false;
+    bool done = false;
+
+    // Occupies a background thread until Release() has run.
+    static void Block(void* arg) {
+      RunState* state = reinterpret_cast<RunState*>(arg);
+      MutexLock l(&state->mu);
+      while (!state->released) {
+        state->cvar.Wait();
+      }
+      state->done = true;
+      state->cvar.SignalAll();
+    }
+
+    static void Release(void* arg) {
+      RunState* state = reinterpret_cast<RunState*>(arg);
+      MutexLock l(&state->mu);
+      state->released = true;
+      state->cvar.SignalAll();
+    }
+  };
+
+  RunState state;
+  env_->Schedule(&RunState::Block, &state);
+  ASSERT_TRUE(env_->ScheduleHighPriority(&RunState::Release, &state));
+
+  MutexLock l(&state.mu);
+  while (!state.done) {
+    state.cvar.Wait();
+  }
+}
+
 struct State {
   port::Mutex mu;
   port::CondVar cvar{&mu};
@@ -166,6 +202,40 @@ TEST_F(EnvTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+TEST_F(EnvTest, RunConcurrently) {
+  struct RunState {
+    port::Mutex mu;
+    port::CondVar cvar{&mu};
+    int num_running = 0;
+    int num_done = 0;
+
+    // Returns only once all three callbacks are running at the same time.
+    static void Run(void* arg) {
+      RunState* state = reinterpret_cast<RunState*>(arg);
+      MutexLock l(&state->mu);
+      state->num_running++;
+      state->cvar.SignalAll();
+      while (state->num_running < 3) {
+        state->cvar.Wait();
+      }
+      state->num_done++;
+      state->cvar.SignalAll();
+    }
+  };
+
+  env_->IncreaseBackgroundThreads(3);
+
+  RunState state;
+  for (int i = 0; i < 3; i++) {
+    env_->Schedule(&RunState::Run, &state);
+  }
+
+  MutexLock l(&state.mu);
+  while (state.num_done != 3) {
+    state.cvar.Wait();
+  }
+}
+
 TEST_F(EnvTest, TestOpenNonExistentFile) {
   // Write some test data to a single file that will be opened |n| times.
   std::string test_dir;
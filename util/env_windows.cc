@@ -17,6 +17,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -31,6 +32,7 @@
 #include "util/env_windows_test_helper.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/thread_pool.h"
 #include "util/windows_logger.h"
 
 namespace leveldb {
@@ -114,7 +116,8 @@ class ScopedHandle {
 class Limiter {
  public:
   // Limit maximum number of resources to |max_acquires|.
-  Limiter(int max_acquires) : acquires_allowed_(max_acquires) {}
+  Limiter(int max_acquires)
+      : max_acquires_(max_acquires), acquires_allowed_(max_acquires) {}
 
   Limiter(const Limiter&) = delete;
   Limiter operator=(const Limiter&) = delete;
@@ -135,7 +138,20 @@ class Limiter {
   // true.
   void Release() { acquires_allowed_.fetch_add(1, std::memory_order_relaxed); }
 
+  // Change the maximum number of resources to |max_acquires|.  Resources
+  // that are already acquired stay acquired, so more than |max_acquires|
+  // may be in use until enough of them are released.
+  void SetMaxAcquires(int max_acquires) {
+    int old_max_acquires =
+        max_acquires_.exchange(max_acquires, std::memory_order_relaxed);
+    acquires_allowed_.fetch_add(max_acquires - old_max_acquires,
+                                std::memory_order_relaxed);
+  }
+
  private:
+  // The maximum number of resources, used by SetMaxAcquires().
+  std::atomic<int> max_acquires_;
+
   // The number of available resources.
   //
   // This is a counter and is not tied to the invariants of any other class, so
@@ -434,6 +450,13 @@ class WindowsEnv : public Env {
     return WindowsError(filename, ::GetLastError());
   }
 
+  Status SetMaxMmapFiles(int max_mmap_files) override {
+    mmap_limiter_.SetMaxAcquires(max_mmap_files < 0
+                                     ? std::numeric_limits<int>::max()
+                                     : max_mmap_files);
+    return Status::OK();
+  }
+
   Status NewWritableFile(const std::string& filename,
                          WritableFile** result) override {
     DWORD desired_access = GENERIC_WRITE;
@@ -595,6 +618,10 @@ class WindowsEnv : public Env {
   void Schedule(void (*background_work_function)(void* background_work_arg),
                 void* background_work_arg) override;
 
+  void IncreaseBackgroundThreads(int number) override;
+
+  bool ScheduleHighPriority(void (*function)(void* arg), void* arg) override;
+
   void StartThread(void (*thread_main)(void* thread_main_arg),
                    void* thread_main_arg) override {
     std::thread new_thread(thread_main, thread_main_arg);
@@ -652,6 +679,10 @@ class WindowsEnv : public Env {
  private:
   void BackgroundThreadMain();
 
+  // Start background threads until there are as many as allowed.
+  void StartBackgroundThreads()
+      EXCLUSIVE_LOCKS_REQUIRED(background_work_mutex_);
+
   static void BackgroundThreadEntryPoint(WindowsEnv* env) {
     env->BackgroundThreadMain();
   }
@@ -672,11 +703,15 @@ class WindowsEnv : public Env {
 
   port::Mutex background_work_mutex_;
   port::CondVar background_work_cv_ GUARDED_BY(background_work_mutex_);
-  bool started_background_thread_ GUARDED_BY(background_work_mutex_);
+  int started_background_threads_ GUARDED_BY(background_work_mutex_);
+  int max_background_threads_ GUARDED_BY(background_work_mutex_);
 
   std::queue<BackgroundWorkItem> background_work_queue_
       GUARDED_BY(background_work_mutex_);
 
+  // Runs the work of ScheduleHighPriority().  Created on first use.
+  ThreadPool* high_priority_pool_ GUARDED_BY(background_work_mutex_);
+
   Limiter mmap_limiter_;  // Thread-safe.
 };
 
@@ -685,7 +720,9 @@ int MaxMmaps() { return g_mmap_limit; }
 
 WindowsEnv::WindowsEnv()
     : background_work_cv_(&background_work_mutex_),
-      started_background_thread_(false),
+      started_background_threads_(0),
+      max_background_threads_(1),
+      high_priority_pool_(nullptr),
       mmap_limiter_(MaxMmaps()) {}
 
 void WindowsEnv::Schedule(
@@ -693,22 +730,48 @@ void WindowsEnv::Schedule(
     void* background_work_arg) {
   background_work_mutex_.Lock();
 
-  // Start the background thread, if we haven't done so already.
-  if (!started_background_thread_) {
-    started_background_thread_ = true;
-    std::thread background_thread(WindowsEnv::BackgroundThreadEntryPoint, this);
-    background_thread.detach();
-  }
+  // Start the background threads, if we haven't done so already.
+  StartBackgroundThreads();
 
-  // If the queue is empty, the background thread may be waiting for work.
-  if (background_work_queue_.empty()) {
-    background_work_cv_.Signal();
-  }
+  // With several background threads, an idle one may be waiting for work
+  // even if the queue is not empty, so always wake one up.
+  background_work_cv_.Signal();
 
   background_work_queue_.emplace(background_work_function, background_work_arg);
   background_work_mutex_.Unlock();
 }
 
+void WindowsEnv::IncreaseBackgroundThreads(int number) {
+  background_work_mutex_.Lock();
+  if (number > max_background_threads_) {
+    max_background_threads_ = number;
+    // Threads are started by the first call to Schedule().
+    if (started_background_threads_ > 0) {
+      StartBackgroundThreads();
+    }
+  }
+  background_work_mutex_.Unlock();
+}
+
+bool WindowsEnv::ScheduleHighPriority(void (*function)(void* arg), void* arg) {
+  background_work_mutex_.Lock();
+  if (high_priority_pool_ == nullptr) {
+    high_priority_pool_ = new ThreadPool(1);
+  }
+  ThreadPool* pool = high_priority_pool_;
+  background_work_mutex_.Unlock();
+  pool->Schedule(function, arg);
+  return true;
+}
+
+void WindowsEnv::StartBackgroundThreads() {
+  while (started_background_threads_ < max_background_threads_) {
+    started_background_threads_++;
+    std::thread background_thread(WindowsEnv::BackgroundThreadEntryPoint, this);
+    background_thread.detach();
+  }
+}
+
 void WindowsEnv::BackgroundThreadMain() {
   while (true) {
     background_work_mutex_.Lock();
@@ -0,0 +1,360 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
+#include "util/crc32c.h"
+#include "util/mutexlock.h"
+#include "util/persistent_cache_test_helper.h"
+#include "util/thread_pool.h"
+
+namespace leveldb {
+
+PersistentCache::~PersistentCache() {}
+
+void PersistentCache::Erase(const Slice& key) {}
+
+namespace {
+
+// Number of sealed segments that may wait to be written at once.
+static const int kMaxPendingWrites = 2;
+
+// Blocks are appended to an in-memory buffer, the active segment.  When
+// the buffer is full it is handed to the cache's writer thread, which
+// writes it out as a file, and reads of its blocks are served from the
+// file once that is done.  Once the sealed segments hold more than the
+// capacity, the oldest one is deleted together with the index entries of
+// its blocks.  Segments are reference counted so that a reader or writer can
+// use a segment outside the mutex while it is being evicted.
+class FilePersistentCache : public PersistentCache {
+ public:
+  FilePersistentCache(Env* env, const std::string& dir, size_t capacity);
+  ~FilePersistentCache() override;
+
+  Status Insert(const Slice& key, const Slice& data) override;
+  Status Lookup(const Slice& key, std::string* data) override;
+  void Erase(const Slice& key) override;
+  uint64_t NewId() override;
+
+  // Wait until every sealed segment has been written or dropped.
+  void WaitForWrites();
+
+ private:
+  struct Segment {
+    uint64_t number;
+    std::string buffer;             // Contents, until written to "file"
+    RandomAccessFile* file;         // Set once the contents are written
+    std::vector<std::string> keys;  // Keys of the blocks in this segment
+    size_t size;
+    int refs;
+  };
+
+  struct Entry {
+    Segment* segment;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t crc;  // crc32c of the block
+  };
+
+  // A sealed segment waiting to be written by BGWrite() on "writer_".
+  struct WriteWork {
+    FilePersistentCache* cache;
+    Segment* segment;
+  };
+
+  std::string SegmentFileName(uint64_t number) const;
+
+  // Write the buffer of "s" to its file and open the file for reading.
+  Status WriteSegment(Segment* s, RandomAccessFile** file);
+
+  static void BGWrite(void* arg);
+  void BackgroundWrite(Segment* s);
+
+  // Remove the sealed segment "s" from the cache and drop the cache's
+  // reference to it, unless that was already done.
+  void DropSegment(Segment* s) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Unref(Segment* s) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Env* const env_;
+  const std::string dir_;
+  const size_t capacity_;
+  const size_t segment_size_;
+
+  port::Mutex mu_;
+  port::CondVar writes_done_ GUARDED_BY(mu_);
+  int pending_writes_ GUARDED_BY(mu_);  // Scheduled BGWrite() calls
+  uint64_t last_id_ GUARDED_BY(mu_);
+  uint64_t next_segment_number_ GUARDED_BY(mu_);
+  Segment* active_ GUARDED_BY(mu_);
+  std::deque<Segment*> sealed_ GUARDED_BY(mu_);  // Full segments, oldest first
+  size_t sealed_size_ GUARDED_BY(mu_);
+  std::unordered_map<std::string, Entry> index_ GUARDED_BY(mu_);
+
+  // Writes sealed segments.  A thread of its own, rather than the Env's
+  // background work, so that writes do not wait behind compactions.
+  // Declared last, so that it is joined before the rest is destroyed.
+  ThreadPool writer_;
+};
+
+FilePersistentCache::FilePersistentCache(Env* env, const std::string& dir,
+                                         size_t capacity)
+    : env_(env),
+      dir_(dir),
+      capacity_(capacity),
+      // Small enough to bound the memory used by the active segment and
+      // the amount of data dropped by one eviction.
+      segment_size_(std::min<size_t>(std::max<size_t>(capacity / 16, 4096),
+                                     4 << 20)),
+      writes_done_(&mu_),
+      pending_writes_(0),
+      last_id_(0),
+      next_segment_number_(1),
+      active_(nullptr),
+      sealed_size_(0),
+      writer_(1) {}
+
+FilePersistentCache::~FilePersistentCache() {
+  WaitForWrites();
+  MutexLock l(&mu_);
+  if (active_ != nullptr) {
+    Unref(active_);
+  }
+  while (!sealed_.empty()) {
+    Segment* s = sealed_.front();
+    sealed_.pop_front();
+    Unref(s);
+  }
+}
+
+std::string FilePersistentCache::SegmentFileName(uint64_t number) const {
+  char buf[100];
+  std::snprintf(buf, sizeof(buf), "/%06llu.pcache",
+                static_cast<unsigned long long>(number));
+  return dir_ + buf;
+}
+
+Status FilePersistentCache::WriteSegment(Segment* s, RandomAccessFile** file) {
+  const std::string fname = SegmentFileName(s->number);
+  WritableFile* out;
+  Status status = env_->NewWritableFile(fname, &out);
+  if (!status.ok()) {
+    return status;
+  }
+  status = out->Append(s->buffer);
+  if (status.ok()) {
+    status = out->Close();
+  }
+  delete out;
+  if (status.ok()) {
+    status = env_->NewRandomAccessFile(fname, file);
+  }
+  return status;
+}
+
+void FilePersistentCache::DropSegment(Segment* s) {
+  auto pos = std::find(sealed_.begin(), sealed_.end(), s);
+  if (pos == sealed_.end()) {
+    return;  // Already dropped
+  }
+  sealed_.erase(pos);
+  sealed_size_ -= s->size;
+  for (size_t i = 0; i < s->keys.size(); i++) {
+    auto it = index_.find(s->keys[i]);
+    if (it != index_.end() && it->second.segment == s) {
+      index_.erase(it);
+    }
+  }
+  Unref(s);
+}
+
+void FilePersistentCache::Unref(Segment* s) {
+  assert(s->refs > 0);
+  s->refs--;
+  if (s->refs == 0) {
+    delete s->file;
+    env_->RemoveFile(SegmentFileName(s->number));
+    delete s;
+  }
+}
+
+Status FilePersistentCache::Insert(const Slice& key, const Slice& data) {
+  Segment* s;
+  {
+    MutexLock l(&mu_);
+    const std::string k = key.ToString();
+    if (index_.count(k) != 0) {
+      return Status::OK();
+    }
+
+    if (active_ == nullptr) {
+      active_ = new Segment;
+      active_->number = next_segment_number_++;
+      active_->file = nullptr;
+      active_->size = 0;
+      active_->refs = 1;
+    }
+    s = active_;
+    Entry entry;
+    entry.segment = s;
+    entry.offset = static_cast<uint32_t>(s->buffer.size());
+    entry.size = static_cast<uint32_t>(data.size());
+    entry.crc = crc32c::Value(data.data(), data.size());
+    s->buffer.append(data.data(), data.size());
+    s->keys.push_back(k);
+    s->size += data.size();
+    index_[k] = entry;
+    if (s->buffer.size() < segment_size_) {
+      return Status::OK();
+    }
+
+    // The active segment is full.  Seal it and make room for it by
+    // evicting the oldest segments.
+    active_ = nullptr;
+    sealed_.push_back(s);
+    sealed_size_ += s->size;
+    while (sealed_size_ > capacity_ && sealed_.front() != s) {
+      DropSegment(sealed_.front());
+    }
+    if (pending_writes_ >= kMaxPendingWrites) {
+      // The device is not keeping up, so forget the blocks rather than
+      // hold more of them in memory.
+      DropSegment(s);
+      return Status::OK();
+    }
+    s->refs++;
+    pending_writes_++;
+  }
+
+  // Write it out in the background, so that the caller, usually a
+  // reader that just missed in the cache, does not wait for the write.
+  // Until that is done, reads are served from its buffer, which no
+  // longer changes.
+  writer_.Schedule(&FilePersistentCache::BGWrite, new WriteWork{this, s});
+  return Status::OK();
+}
+
+void FilePersistentCache::WaitForWrites() {
+  MutexLock l(&mu_);
+  while (pending_writes_ > 0) {
+    writes_done_.Wait();
+  }
+}
+
+void FilePersistentCache::BGWrite(void* arg) {
+  WriteWork* work = reinterpret_cast<WriteWork*>(arg);
+  work->cache->BackgroundWrite(work->segment);
+  delete work;
+}
+
+void FilePersistentCache::BackgroundWrite(Segment* s) {
+  RandomAccessFile* file = nullptr;
+  Status status = WriteSegment(s, &file);
+  MutexLock l(&mu_);
+  if (status.ok()) {
+    s->file = file;
+    std::string().swap(s->buffer);
+  } else {
+    // Forget the blocks rather than keep them in memory.
+    DropSegment(s);
+  }
+  Unref(s);
+  pending_writes_--;
+  writes_done_.SignalAll();
+}
+
+Status FilePersistentCache::Lookup(const Slice& key, std::string* data) {
+  MutexLock l(&mu_);
+  auto it = index_.find(key.ToString());
+  if (it == index_.end()) {
+    return Status::NotFound(Slice());
+  }
+  const Entry entry = it->second;
+  Segment* s = entry.segment;
+  if (s->file == nullptr) {
+    data->assign(s->buffer.data() + entry.offset, entry.size);
+    return Status::OK();
+  }
+
+  s->refs++;
+  mu_.Unlock();
+  data->resize(entry.size);
+  char* scratch = entry.size == 0 ? nullptr : &(*data)[0];
+  Slice result;
+  Status status = s->file->Read(entry.offset, entry.size, &result, scratch);
+  if (status.ok()) {
+    if (result.size() != entry.size) {
+      status = Status::Corruption("truncated persistent cache read");
+    } else {
+      if (result.data() != scratch) {
+        std::memcpy(scratch, result.data(), result.size());
+      }
+      if (crc32c::Value(data->data(), data->size()) != entry.crc) {
+        status = Status::Corruption("persistent cache checksum mismatch");
+      }
+    }
+  }
+  mu_.Lock();
+  if (!status.ok()) {
+    // Do not serve this block again.
+    auto pos = index_.find(key.ToString());
+    if (pos != index_.end() && pos->second.segment == s) {
+      index_.erase(pos);
+    }
+  }
+  Unref(s);
+  return status;
+}
+
+void FilePersistentCache::Erase(const Slice& key) {
+  // The block stays in its segment until the segment is evicted.
+  MutexLock l(&mu_);
+  index_.erase(key.ToString());
+}
+
+uint64_t FilePersistentCache::NewId() {
+  MutexLock l(&mu_);
+  return ++last_id_;
+}
+
+}  // namespace
+
+void PersistentCacheTestHelper::WaitForWrites(PersistentCache* cache) {
+  static_cast<FilePersistentCache*>(cache)->WaitForWrites();
+}
+
+Status NewFilePersistentCache(Env* env, const std::string& dir,
+                              size_t capacity, PersistentCache** result) {
+  *result = nullptr;
+  env->CreateDir(dir);  // Ignore error; it may already exist
+
+  // The blocks left behind by a previous cache cannot be found again.
+  std::vector<std::string> children;
+  Status s = env->GetChildren(dir, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  const std::string suffix = ".pcache";
+  for (size_t i = 0; i < children.size(); i++) {
+    const std::string& name = children[i];
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      env->RemoveFile(dir + "/" + name);
+    }
+  }
+  *result = new FilePersistentCache(env, dir, capacity);
+  return Status::OK();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,217 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/persistent_cache_test_helper.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static std::string Key(int i) {
+  std::string result;
+  PutFixed32(&result, i);
+  return result;
+}
+
+static std::string Value(int i) { return std::string(1000, 'a' + i % 26); }
+
+// Blocks the creation of cache files between Hold() and Release(), so
+// that tests control when segments are written.
+class HoldingEnv : public EnvWrapper {
+ public:
+  HoldingEnv() : EnvWrapper(Env::Default()), cv_(&mu_), hold_(false) {}
+
+  void Hold() {
+    MutexLock l(&mu_);
+    hold_ = true;
+  }
+
+  void Release() {
+    MutexLock l(&mu_);
+    hold_ = false;
+    cv_.SignalAll();
+  }
+
+  Status NewWritableFile(const std::string& fname,
+                         WritableFile** result) override {
+    if (fname.find(".pcache") != std::string::npos) {
+      MutexLock l(&mu_);
+      while (hold_) {
+        cv_.Wait();
+      }
+    }
+    return target()->NewWritableFile(fname, result);
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool hold_;
+};
+
+class PersistentCacheTest : public testing::Test {
+ public:
+  PersistentCacheTest()
+      : env_(&holding_env_),
+        dir_(testing::TempDir() + "persistent_cache_test"),
+        cache_(nullptr) {}
+
+  ~PersistentCacheTest() {
+    delete cache_;
+    std::vector<std::string> children;
+    env_->GetChildren(dir_, &children);
+    for (size_t i = 0; i < children.size(); i++) {
+      env_->RemoveFile(dir_ + "/" + children[i]);
+    }
+    env_->RemoveDir(dir_);
+  }
+
+  void Open(size_t capacity) {
+    delete cache_;
+    cache_ = nullptr;
+    ASSERT_LEVELDB_OK(NewFilePersistentCache(env_, dir_, capacity, &cache_));
+  }
+
+  void WaitForWrites() { PersistentCacheTestHelper::WaitForWrites(cache_); }
+
+  // Insert block "i", and wait for the segment it fills, if any, to be
+  // written, so that no segment is dropped for want of writes.
+  void Insert(int i) {
+    ASSERT_LEVELDB_OK(cache_->Insert(Key(i), Value(i)));
+    WaitForWrites();
+  }
+
+  std::string Lookup(int i) {
+    std::string data;
+    Status s = cache_->Lookup(Key(i), &data);
+    if (s.IsNotFound()) {
+      return "NOT_FOUND";
+    }
+    EXPECT_LEVELDB_OK(s);
+    return data;
+  }
+
+  int NumCacheFiles() {
+    std::vector<std::string> children;
+    env_->GetChildren(dir_, &children);
+    int count = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+      if (children[i].find(".pcache") != std::string::npos) {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  HoldingEnv holding_env_;
+  Env* const env_;
+  const std::string dir_;
+  PersistentCache* cache_;
+};
+
+TEST_F(PersistentCacheTest, InsertAndLookup) {
+  Open(1 << 20);
+  ASSERT_EQ("NOT_FOUND", Lookup(1));
+
+  // Enough data to fill several segments, so that most lookups are
+  // served from files.
+  for (int i = 0; i < 500; i++) {
+    Insert(i);
+  }
+  ASSERT_GT(NumCacheFiles(), 1);
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+
+  // Inserting an existing key keeps the first value.
+  ASSERT_LEVELDB_OK(cache_->Insert(Key(1), "other"));
+  ASSERT_EQ(Value(1), Lookup(1));
+}
+
+TEST_F(PersistentCacheTest, WritesSegmentsInBackground) {
+  Open(1 << 20);
+  holding_env_.Hold();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_LEVELDB_OK(cache_->Insert(Key(i), Value(i)));
+  }
+
+  // A full segment is served from memory until it has been written.
+  ASSERT_EQ(0, NumCacheFiles());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+  holding_env_.Release();
+  WaitForWrites();
+  ASSERT_EQ(1, NumCacheFiles());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(Value(i), Lookup(i)) << i;
+  }
+}
+
+TEST_F(PersistentCacheTest, Erase) {
+  Open(1 << 20);
+  for (int i = 0; i < 100; i++) {
+    Insert(i);
+  }
+  cache_->Erase(Key(1));
+  cache_->Erase(Key(99));
+  ASSERT_EQ("NOT_FOUND", Lookup(1));
+  ASSERT_EQ("NOT_FOUND", Lookup(99));
+  ASSERT_EQ(Value(2), Lookup(2));
+}
+
+TEST_F(PersistentCacheTest, EvictsOldestBlocks) {
+  const size_t kCapacity = 64 << 10;
+  Open(kCapacity);
+  for (int i = 0; i < 1000; i++) {
+    Insert(i);
+  }
+  ASSERT_EQ("NOT_FOUND", Lookup(0));
+  ASSERT_EQ(Value(999), Lookup(999));
+
+  int found = 0;
+  for (int i = 0; i < 1000; i++) {
+    if (Lookup(i) != "NOT_FOUND") {
+      found++;
+    }
+  }
+  // The cache holds about its capacity, plus the unwritten segment.
+  ASSERT_GE(found * 1000, static_cast<int>(kCapacity / 2));
+  ASSERT_LE(found * 1000, static_cast<int>(kCapacity + kCapacity / 8));
+}
+
+TEST_F(PersistentCacheTest, RemovesFilesOfPreviousCache) {
+  Open(1 << 20);
+  for (int i = 0; i < 500; i++) {
+    Insert(i);
+  }
+  ASSERT_GT(NumCacheFiles(), 0);
+
+  // Simulate a crash that leaves the files behind.
+  WritableFile* file;
+  ASSERT_LEVELDB_OK(env_->NewWritableFile(dir_ + "/999999.pcache", &file));
+  ASSERT_LEVELDB_OK(file->Close());
+  delete file;
+
+  Open(1 << 20);
+  ASSERT_EQ(0, NumCacheFiles());
+  ASSERT_EQ("NOT_FOUND", Lookup(1));
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
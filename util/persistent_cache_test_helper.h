@@ -0,0 +1,25 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_PERSISTENT_CACHE_TEST_HELPER_H_
+#define STORAGE_LEVELDB_UTIL_PERSISTENT_CACHE_TEST_HELPER_H_
+
+namespace leveldb {
+
+class PersistentCache;
+class PersistentCacheTest;
+
+// A helper for the file persistent cache to facilitate testing.
+class PersistentCacheTestHelper {
+ private:
+  friend class PersistentCacheTest;
+
+  // Wait until the segments sealed so far have been written or dropped.
+  // REQUIRES: "cache" was created by NewFilePersistentCache().
+  static void WaitForWrites(PersistentCache* cache);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_PERSISTENT_CACHE_TEST_HELPER_H_
@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_pool.h"
+
+#include <cassert>
+
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+ThreadPool::ThreadPool(int num_threads)
+    : work_cv_(&mu_), shutting_down_(false) {
+  assert(num_threads > 0);
+  threads_.reserve(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    threads_.emplace_back(&ThreadPool::ThreadMain, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  mu_.Lock();
+  shutting_down_ = true;
+  work_cv_.SignalAll();
+  mu_.Unlock();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  assert(queue_.empty());
+}
+
+void ThreadPool::Schedule(void (*function)(void* arg), void* arg) {
+  mu_.Lock();
+  assert(!shutting_down_);
+  queue_.emplace_back(function, arg);
+  work_cv_.Signal();
+  mu_.Unlock();
+}
+
+void ThreadPool::EnsureThreads(int num_threads) {
+  MutexLock l(&mu_);
+  assert(!shutting_down_);
+  while (static_cast<int>(threads_.size()) < num_threads) {
+    threads_.emplace_back(&ThreadPool::ThreadMain, this);
+  }
+}
+
+int ThreadPool::num_threads() {
+  MutexLock l(&mu_);
+  return static_cast<int>(threads_.size());
+}
+
+void ThreadPool::ThreadMain() {
+  mu_.Lock();
+  while (true) {
+    if (queue_.empty()) {
+      if (shutting_down_) {
+        break;
+      }
+      work_cv_.Wait();
+      continue;
+    }
+    WorkItem item = queue_.front();
+    queue_.pop_front();
+    mu_.Unlock();
+    (*item.function)(item.arg);
+    mu_.Lock();
+  }
+  mu_.Unlock();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,66 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_THREAD_POOL_H_
+#define STORAGE_LEVELDB_UTIL_THREAD_POOL_H_
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+// A fixed-size pool of threads that run work items in FIFO order.
+//
+// Unlike Env::Schedule(), which leveldb uses for compactions, a pool is
+// private to its owner, so short latency-sensitive work (e.g. reading
+// a block ahead of an iterator) does not queue up behind long-running
+// background work.
+//
+// Thread-safe.
+class ThreadPool {
+ public:
+  // Starts "num_threads" threads.  REQUIRES: num_threads > 0.
+  explicit ThreadPool(int num_threads);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs every work item that has already been scheduled, then joins
+  // all threads.
+  ~ThreadPool();
+
+  // Arrange to run "(*function)(arg)" once on one of the pool's threads.
+  void Schedule(void (*function)(void* arg), void* arg);
+
+  // Starts more threads if the pool has fewer than "num_threads", so that
+  // a pool shared by several users can be sized for the largest of them.
+  void EnsureThreads(int num_threads);
+
+  int num_threads();
+
+ private:
+  struct WorkItem {
+    WorkItem(void (*function)(void*), void* arg)
+        : function(function), arg(arg) {}
+
+    void (*function)(void*);
+    void* arg;
+  };
+
+  void ThreadMain();
+
+  port::Mutex mu_;
+  port::CondVar work_cv_ GUARDED_BY(mu_);
+  std::deque<WorkItem> queue_ GUARDED_BY(mu_);
+  bool shutting_down_ GUARDED_BY(mu_);
+  std::vector<std::thread> threads_;  // Grown under mu_
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_THREAD_POOL_H_
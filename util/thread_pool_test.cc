@@ -0,0 +1,103 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/thread_pool.h"
+
+#include <atomic>
+
+#include "gtest/gtest.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+struct Counter {
+  std::atomic<int> value{0};
+};
+
+void Increment(void* arg) {
+  reinterpret_cast<Counter*>(arg)->value.fetch_add(1);
+}
+
+// Blocks every thread that runs it until Release() is called.
+struct Gate {
+  Gate() : cv(&mu), entered(0), open(false) {}
+
+  void Enter() {
+    MutexLock l(&mu);
+    entered++;
+    cv.SignalAll();
+    while (!open) {
+      cv.Wait();
+    }
+  }
+
+  void WaitForEntries(int n) {
+    MutexLock l(&mu);
+    while (entered < n) {
+      cv.Wait();
+    }
+  }
+
+  void Release() {
+    MutexLock l(&mu);
+    open = true;
+    cv.SignalAll();
+  }
+
+  port::Mutex mu;
+  port::CondVar cv;
+  int entered;
+  bool open;
+};
+
+void EnterGate(void* arg) { reinterpret_cast<Gate*>(arg)->Enter(); }
+
+}  // namespace
+
+TEST(ThreadPoolTest, RunsAllWorkBeforeDestruction) {
+  Counter counter;
+  {
+    ThreadPool pool(3);
+    ASSERT_EQ(3, pool.num_threads());
+    for (int i = 0; i < 1000; i++) {
+      pool.Schedule(&Increment, &counter);
+    }
+  }
+  ASSERT_EQ(1000, counter.value.load());
+}
+
+TEST(ThreadPoolTest, RunsWorkConcurrently) {
+  Gate gate;
+  ThreadPool pool(4);
+  for (int i = 0; i < 4; i++) {
+    pool.Schedule(&EnterGate, &gate);
+  }
+  // All four items are running at once; otherwise this would hang.
+  gate.WaitForEntries(4);
+  gate.Release();
+}
+
+TEST(ThreadPoolTest, EnsureThreadsGrowsPool) {
+  Gate gate;
+  ThreadPool pool(1);
+  pool.EnsureThreads(3);
+  ASSERT_EQ(3, pool.num_threads());
+  pool.EnsureThreads(2);  // Never shrinks
+  ASSERT_EQ(3, pool.num_threads());
+  for (int i = 0; i < 3; i++) {
+    pool.Schedule(&EnterGate, &gate);
+  }
+  gate.WaitForEntries(3);
+  gate.Release();
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
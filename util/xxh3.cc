@@ -0,0 +1,260 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A portable implementation of XXH3_64bits() from the xxHash library
+// (https://github.com/Cyan4973/xxHash), written from its specification.
+// The hash is part of the table format, so the output must not change.
+
+#include "util/xxh3.h"
+
+#include "util/coding.h"
+
+namespace leveldb {
+namespace xxh3 {
+
+namespace {
+
+const uint32_t kPrime32_1 = 0x9e3779b1u;
+const uint32_t kPrime32_2 = 0x85ebca77u;
+const uint32_t kPrime32_3 = 0xc2b2ae3du;
+const uint64_t kPrime64_1 = 0x9e3779b185ebca87ull;
+const uint64_t kPrime64_2 = 0xc2b2ae3d27d4eb4full;
+const uint64_t kPrime64_3 = 0x165667b19e3779f9ull;
+const uint64_t kPrime64_4 = 0x85ebca77c2b2ae63ull;
+const uint64_t kPrime64_5 = 0x27d4eb2f165667c5ull;
+const uint64_t kPrimeMx1 = 0x165667919e3779f9ull;
+const uint64_t kPrimeMx2 = 0x9fb21c651e98df25ull;
+
+const size_t kSecretSize = 192;
+const size_t kStripeLen = 64;
+const size_t kSecretConsumeRate = 8;
+const size_t kAccumulators = 8;
+const size_t kMidSizeMax = 240;
+const size_t kMidSizeStartOffset = 3;
+const size_t kMidSizeLastOffset = 17;
+const size_t kSecretMergeAccsStart = 11;
+const size_t kSecretLastAccStart = 7;
+const size_t kSecretSizeMin = 136;
+
+// The default secret of XXH3.
+const uint8_t kSecret[kSecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint32_t Read32(const uint8_t* p) {
+  return DecodeFixed32(reinterpret_cast<const char*>(p));
+}
+
+inline uint64_t Read64(const uint8_t* p) {
+  return DecodeFixed64(reinterpret_cast<const char*>(p));
+}
+
+inline uint64_t Rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t Swap64(uint64_t x) {
+  return ((x << 56) & 0xff00000000000000ull) |
+         ((x << 40) & 0x00ff000000000000ull) |
+         ((x << 24) & 0x0000ff0000000000ull) |
+         ((x << 8) & 0x000000ff00000000ull) |
+         ((x >> 8) & 0x00000000ff000000ull) |
+         ((x >> 24) & 0x0000000000ff0000ull) |
+         ((x >> 40) & 0x000000000000ff00ull) |
+         ((x >> 56) & 0x00000000000000ffull);
+}
+
+// Returns the xor of the low and high halves of the 128-bit product.
+inline uint64_t Mul128Fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+  return static_cast<uint64_t>(product) ^
+         static_cast<uint64_t>(product >> 64);
+#else
+  const uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  const uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  const uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  const uint64_t hi_hi = (a >> 32) * (b >> 32);
+  const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  const uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  const uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+  return lower ^ upper;
+#endif  // defined(__SIZEOF_INT128__)
+}
+
+inline uint64_t XXH64Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= kPrime64_2;
+  h ^= h >> 29;
+  h *= kPrime64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= kPrimeMx1;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t RrmxmxAvalanche(uint64_t h, uint64_t len) {
+  h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+  h *= kPrimeMx2;
+  h ^= (h >> 35) + len;
+  h *= kPrimeMx2;
+  return h ^ (h >> 28);
+}
+
+inline uint64_t Mix16(const uint8_t* input, const uint8_t* secret) {
+  return Mul128Fold64(Read64(input) ^ Read64(secret),
+                      Read64(input + 8) ^ Read64(secret + 8));
+}
+
+uint64_t Hash0To16(const uint8_t* input, size_t len) {
+  if (len > 8) {
+    const uint64_t bitflip1 = Read64(kSecret + 24) ^ Read64(kSecret + 32);
+    const uint64_t bitflip2 = Read64(kSecret + 40) ^ Read64(kSecret + 48);
+    const uint64_t input_lo = Read64(input) ^ bitflip1;
+    const uint64_t input_hi = Read64(input + len - 8) ^ bitflip2;
+    const uint64_t acc = len + Swap64(input_lo) + input_hi +
+                         Mul128Fold64(input_lo, input_hi);
+    return Avalanche(acc);
+  }
+  if (len >= 4) {
+    const uint64_t input1 = Read32(input);
+    const uint64_t input2 = Read32(input + len - 4);
+    const uint64_t bitflip = Read64(kSecret + 8) ^ Read64(kSecret + 16);
+    const uint64_t keyed = (input2 + (input1 << 32)) ^ bitflip;
+    return RrmxmxAvalanche(keyed, len);
+  }
+  if (len > 0) {
+    const uint32_t combined = (static_cast<uint32_t>(input[0]) << 16) |
+                              (static_cast<uint32_t>(input[len >> 1]) << 24) |
+                              static_cast<uint32_t>(input[len - 1]) |
+                              (static_cast<uint32_t>(len) << 8);
+    const uint64_t bitflip = Read32(kSecret) ^ Read32(kSecret + 4);
+    return XXH64Avalanche(combined ^ bitflip);
+  }
+  return XXH64Avalanche(Read64(kSecret + 56) ^ Read64(kSecret + 64));
+}
+
+uint64_t Hash17To128(const uint8_t* input, size_t len) {
+  uint64_t acc = len * kPrime64_1;
+  if (len > 32) {
+    if (len > 64) {
+      if (len > 96) {
+        acc += Mix16(input + 48, kSecret + 96);
+        acc += Mix16(input + len - 64, kSecret + 112);
+      }
+      acc += Mix16(input + 32, kSecret + 64);
+      acc += Mix16(input + len - 48, kSecret + 80);
+    }
+    acc += Mix16(input + 16, kSecret + 32);
+    acc += Mix16(input + len - 32, kSecret + 48);
+  }
+  acc += Mix16(input, kSecret);
+  acc += Mix16(input + len - 16, kSecret + 16);
+  return Avalanche(acc);
+}
+
+uint64_t Hash129To240(const uint8_t* input, size_t len) {
+  uint64_t acc = len * kPrime64_1;
+  const size_t rounds = len / 16;
+  for (size_t i = 0; i < 8; i++) {
+    acc += Mix16(input + 16 * i, kSecret + 16 * i);
+  }
+  acc = Avalanche(acc);
+  for (size_t i = 8; i < rounds; i++) {
+    acc += Mix16(input + 16 * i, kSecret + 16 * (i - 8) + kMidSizeStartOffset);
+  }
+  acc += Mix16(input + len - 16, kSecret + kSecretSizeMin - kMidSizeLastOffset);
+  return Avalanche(acc);
+}
+
+inline void Accumulate512(uint64_t* acc, const uint8_t* input,
+                          const uint8_t* secret) {
+  for (size_t i = 0; i < kAccumulators; i++) {
+    const uint64_t data_val = Read64(input + 8 * i);
+    const uint64_t data_key = data_val ^ Read64(secret + 8 * i);
+    acc[i ^ 1] += data_val;
+    acc[i] += (data_key & 0xffffffff) * (data_key >> 32);
+  }
+}
+
+inline void Accumulate(uint64_t* acc, const uint8_t* input, size_t stripes) {
+  for (size_t n = 0; n < stripes; n++) {
+    Accumulate512(acc, input + n * kStripeLen,
+                  kSecret + n * kSecretConsumeRate);
+  }
+}
+
+inline void ScrambleAcc(uint64_t* acc, const uint8_t* secret) {
+  for (size_t i = 0; i < kAccumulators; i++) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= Read64(secret + 8 * i);
+    a *= kPrime32_1;
+    acc[i] = a;
+  }
+}
+
+uint64_t HashLong(const uint8_t* input, size_t len) {
+  uint64_t acc[kAccumulators] = {kPrime32_3, kPrime64_1, kPrime64_2,
+                                 kPrime64_3, kPrime64_4, kPrime32_2,
+                                 kPrime64_5, kPrime32_1};
+  const size_t stripes_per_block =
+      (kSecretSize - kStripeLen) / kSecretConsumeRate;
+  const size_t block_len = kStripeLen * stripes_per_block;
+  const size_t blocks = (len - 1) / block_len;
+
+  for (size_t n = 0; n < blocks; n++) {
+    Accumulate(acc, input + n * block_len, stripes_per_block);
+    ScrambleAcc(acc, kSecret + kSecretSize - kStripeLen);
+  }
+
+  // The last partial block, and the last stripe, which may overlap it.
+  const size_t stripes = ((len - 1) - block_len * blocks) / kStripeLen;
+  Accumulate(acc, input + blocks * block_len, stripes);
+  Accumulate512(acc, input + len - kStripeLen,
+                kSecret + kSecretSize - kStripeLen - kSecretLastAccStart);
+
+  uint64_t result = len * kPrime64_1;
+  for (size_t i = 0; i < 4; i++) {
+    const uint8_t* secret = kSecret + kSecretMergeAccsStart + 16 * i;
+    result += Mul128Fold64(acc[2 * i] ^ Read64(secret),
+                           acc[2 * i + 1] ^ Read64(secret + 8));
+  }
+  return Avalanche(result);
+}
+
+}  // namespace
+
+uint64_t Hash64(const char* data, size_t n) {
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+  if (n <= 16) {
+    return Hash0To16(input, n);
+  } else if (n <= 128) {
+    return Hash17To128(input, n);
+  } else if (n <= kMidSizeMax) {
+    return Hash129To240(input, n);
+  }
+  return HashLong(input, n);
+}
+
+}  // namespace xxh3
+}  // namespace leveldb
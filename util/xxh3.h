@@ -0,0 +1,23 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_UTIL_XXH3_H_
+#define STORAGE_LEVELDB_UTIL_XXH3_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace leveldb {
+namespace xxh3 {
+
+// Return the 64-bit XXH3 hash of data[0,n-1], with the default secret
+// and a seed of 0, as computed by XXH3_64bits() of the xxHash library.
+// XXH3 is much faster than the table-driven crc32c on hosts without a
+// crc32c instruction.
+uint64_t Hash64(const char* data, size_t n);
+
+}  // namespace xxh3
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_XXH3_H_
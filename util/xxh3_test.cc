@@ -0,0 +1,67 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/xxh3.h"
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace leveldb {
+namespace xxh3 {
+
+static uint64_t Hash(const char* s) { return Hash64(s, std::strlen(s)); }
+
+// Returns a string of "n" bytes that are not all equal.
+static std::string Pattern(size_t n) {
+  std::string result;
+  for (size_t i = 0; i < n; i++) {
+    result.push_back(static_cast<char>(i * 7 + 3));
+  }
+  return result;
+}
+
+TEST(XXH3, StandardResults) {
+  // Computed with XXH3_64bits() of the xxHash library.
+  ASSERT_EQ(0x2d06800538d394c2ull, Hash(""));
+  ASSERT_EQ(0xe6c632b61e964e1full, Hash("a"));
+  ASSERT_EQ(0x78af5f94892f3950ull, Hash("abc"));
+  ASSERT_EQ(0x5ced9a40b7d4c5c8ull, Hash("leveldb"));
+  ASSERT_EQ(0xe155d613728f4b18ull, Hash("hello world!"));
+  ASSERT_EQ(0xce7d19a5418fb365ull,
+            Hash("The quick brown fox jumps over the lazy dog"));
+}
+
+TEST(XXH3, AllLengthClasses) {
+  // One or more lengths handled by each code path, and their boundaries.
+  struct {
+    size_t length;
+    uint64_t hash;
+  } cases[] = {
+      {5, 0x998620e10e3a4b37ull},    {12, 0x6829454be0cc3199ull},
+      {100, 0xb5937857f0d78c9full},  {200, 0x746cd0025327bf5bull},
+      {240, 0x64556dc6b462a6cfull},  {241, 0x8beadd3a8874fe17ull},
+      {1000, 0x6c4f14bd97bd9e82ull}, {1024, 0x9b81661c641c72b1ull},
+      {1025, 0x806c2072ed713576ull}, {5000, 0x799aaddd7339581dull},
+  };
+  for (const auto& c : cases) {
+    std::string s = Pattern(c.length);
+    ASSERT_EQ(c.hash, Hash64(s.data(), s.size())) << c.length;
+  }
+}
+
+TEST(XXH3, Values) {
+  std::string s = Pattern(1000);
+  ASSERT_NE(Hash64(s.data(), 999), Hash64(s.data(), 1000));
+  ASSERT_NE(Hash64(s.data(), 1000), Hash64(s.data() + 1, 999));
+}
+
+}  // namespace xxh3
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}